@@ -0,0 +1,267 @@
+// Copyright 2024 Samuel Stanley
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <ios>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+#include "BarnesHut.hpp"
+#include "Constants.hpp"
+
+namespace NB {
+
+// Deepest level a particle is pushed to. Particles that still share a leaf there (because they
+// are at or extremely near the same position) are kept together in the leaf's chain
+constexpr int max_tree_depth = 48;
+
+// Fewest particles worth splitting across threads in the tree walk
+constexpr size_t parallel_walk_threshold = 256;
+
+BarnesHutEngine::BarnesHutEngine(double theta) : _theta(theta) {
+    if (theta < 0)
+        throw std::invalid_argument("Error: theta must not be negative");
+}
+
+int32_t BarnesHutEngine::addNode(double center_x, double center_y, double half) {
+    _nodes.push_back({center_x, center_y, half, 0.0, 0.0, 0.0, {-1, -1, -1, -1}, -1});
+    return static_cast<int32_t>(_nodes.size() - 1);
+}
+
+void BarnesHutEngine::insert(const ParticleStore& particles, int32_t node, int32_t i) {
+    for (int depth = 0; ; depth++) {
+        Node& current = _nodes[node];
+        bool leaf = current.child[0] < 0 && current.child[1] < 0 && current.child[2] < 0
+            && current.child[3] < 0;
+
+        if (leaf && (current.body < 0 || depth >= max_tree_depth)) {
+            _next[i] = current.body;
+            current.body = i;
+            return;
+        }
+
+        if (leaf) {
+            // Push the particle already here down one level so this node becomes internal
+            int32_t other = current.body;
+            current.body = -1;
+            int quadrant = (particles.x[other] >= current.center_x)
+                + 2 * (particles.y[other] >= current.center_y);
+            double quarter = current.half / 2;
+            int32_t child = addNode(
+                current.center_x + ((quadrant & 1) ? quarter : -quarter),
+                current.center_y + ((quadrant & 2) ? quarter : -quarter), quarter);
+            _nodes[node].child[quadrant] = child;
+            _nodes[child].body = other;
+            _next[other] = -1;
+        }
+
+        Node& parent = _nodes[node];
+        int quadrant = (particles.x[i] >= parent.center_x)
+            + 2 * (particles.y[i] >= parent.center_y);
+        if (parent.child[quadrant] < 0) {
+            double quarter = parent.half / 2;
+            int32_t child = addNode(
+                parent.center_x + ((quadrant & 1) ? quarter : -quarter),
+                parent.center_y + ((quadrant & 2) ? quarter : -quarter), quarter);
+            _nodes[node].child[quadrant] = child;
+        }
+        node = _nodes[node].child[quadrant];
+    }
+}
+
+void BarnesHutEngine::summarize(const ParticleStore& particles, int32_t node) {
+    double mass = 0.0;
+    double moment_x = 0.0;
+    double moment_y = 0.0;
+
+    for (int32_t i = _nodes[node].body; i >= 0; i = _next[i]) {
+        mass += particles.mass[i];
+        moment_x += particles.mass[i] * particles.x[i];
+        moment_y += particles.mass[i] * particles.y[i];
+    }
+    for (int quadrant = 0; quadrant < 4; quadrant++) {
+        int32_t child = _nodes[node].child[quadrant];
+        if (child < 0)
+            continue;
+        summarize(particles, child);
+        mass += _nodes[child].mass;
+        moment_x += _nodes[child].mass * _nodes[child].com_x;
+        moment_y += _nodes[child].mass * _nodes[child].com_y;
+    }
+
+    Node& current = _nodes[node];
+    current.mass = mass;
+    // Masses that cancel out (negative masses are allowed) have no center, so use the region's
+    current.com_x = mass != 0.0 ? moment_x / mass : current.center_x;
+    current.com_y = mass != 0.0 ? moment_y / mass : current.center_y;
+}
+
+void BarnesHutEngine::build(const ParticleStore& particles) {
+    size_t n = particles.size();
+    _nodes.clear();
+    _next.assign(n, -1);
+    if (n == 0)
+        return;
+
+    // The root is the smallest square holding every particle
+    auto [min_x, max_x] = std::minmax_element(particles.x.begin(), particles.x.end());
+    auto [min_y, max_y] = std::minmax_element(particles.y.begin(), particles.y.end());
+    double half = std::max(*max_x - *min_x, *max_y - *min_y) / 2;
+    half = half > 0 ? half * (1 + 1e-9) : 1.0;
+    _nodes.reserve(2 * n);
+    addNode((*min_x + *max_x) / 2, (*min_y + *max_y) / 2, half);
+
+    for (size_t i = 0; i < n; i++)
+        insert(particles, 0, static_cast<int32_t>(i));
+    summarize(particles, 0);
+}
+
+uint64_t BarnesHutEngine::walk(const ParticleStore& particles, int32_t i, double& sum_x,
+    double& sum_y, double& sum_p) const {
+    uint64_t interactions = 0;
+    double xi = particles.x[i];
+    double yi = particles.y[i];
+    double theta_sqrd = _theta * _theta;
+    double softening_sqrd = _softening * _softening;
+
+    int32_t stack[4 * max_tree_depth + 4];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const Node& node = _nodes[stack[--top]];
+        double dx = node.com_x - xi;
+        double dy = node.com_y - yi;
+        double distance_sqrd = (dx * dx) + (dy * dy);
+        double width = 2 * node.half;
+        bool holds_i = std::abs(xi - node.center_x) <= node.half
+            && std::abs(yi - node.center_y) <= node.half;
+
+        if (node.body >= 0) {
+            // Leaf: sum its particles exactly
+            for (int32_t j = node.body; j >= 0; j = _next[j]) {
+                double jx = particles.x[j] - xi;
+                double jy = particles.y[j] - yi;
+                double r2 = (jx * jx) + (jy * jy);
+                if (r2 == 0.0)
+                    continue;
+                double softened = r2 + softening_sqrd;
+                double inv_r3 = 1.0 / (softened * std::sqrt(softened));
+                sum_x += jx * particles.mass[j] * inv_r3;
+                sum_y += jy * particles.mass[j] * inv_r3;
+                sum_p += particles.mass[j] * inv_r3 * softened;
+                interactions++;
+            }
+        } else if (!holds_i && width * width < theta_sqrd * distance_sqrd) {
+            // Far enough away to treat as one mass, and not a node holding particle i itself
+            double softened = distance_sqrd + softening_sqrd;
+            double inv_r3 = 1.0 / (softened * std::sqrt(softened));
+            sum_x += dx * node.mass * inv_r3;
+            sum_y += dy * node.mass * inv_r3;
+            sum_p += node.mass * inv_r3 * softened;
+            interactions++;
+        } else {
+            for (int quadrant = 0; quadrant < 4; quadrant++) {
+                if (node.child[quadrant] >= 0)
+                    stack[top++] = node.child[quadrant];
+            }
+        }
+    }
+    return interactions;
+}
+
+void BarnesHutEngine::computeAccelerations(ParticleStore& particles, ThreadPool& pool) {
+    _interactions = 0;
+    build(particles);
+    if (_nodes.empty())
+        return;
+
+    double* ax = particles.ax.data();
+    double* ay = particles.ay.data();
+    double* potential = particles.potential.data();
+    std::atomic<uint64_t> interactions(0);
+    pool.parallelFor(particles.size(), [this, &particles, &interactions, ax, ay, potential](
+        size_t begin, size_t end) {
+        uint64_t chunk_interactions = 0;
+        for (size_t i = begin; i < end; i++) {
+            double sum_x = 0.0;
+            double sum_y = 0.0;
+            double sum_p = 0.0;
+            chunk_interactions += walk(particles, static_cast<int32_t>(i), sum_x, sum_y, sum_p);
+            ax[i] = G * sum_x;
+            ay[i] = G * sum_y;
+            potential[i] = -G * sum_p;
+        }
+        interactions.fetch_add(chunk_interactions, std::memory_order_relaxed);
+    }, parallel_walk_threshold);
+    _interactions = interactions.load();
+}
+
+void BarnesHutEngine::computeActiveAccelerations(ParticleStore& particles, ThreadPool& pool,
+    const std::vector<size_t>& active) {
+    _interactions = 0;
+    build(particles);
+    if (_nodes.empty())
+        return;
+
+    double* ax = particles.ax.data();
+    double* ay = particles.ay.data();
+    double* potential = particles.potential.data();
+    std::atomic<uint64_t> interactions(0);
+    pool.parallelFor(active.size(), [this, &particles, &active, &interactions, ax, ay,
+        potential](size_t begin, size_t end) {
+        uint64_t chunk_interactions = 0;
+        for (size_t k = begin; k < end; k++) {
+            size_t i = active[k];
+            double sum_x = 0.0;
+            double sum_y = 0.0;
+            double sum_p = 0.0;
+            chunk_interactions += walk(particles, static_cast<int32_t>(i), sum_x, sum_y, sum_p);
+            ax[i] = G * sum_x;
+            ay[i] = G * sum_y;
+            potential[i] = -G * sum_p;
+        }
+        interactions.fetch_add(chunk_interactions, std::memory_order_relaxed);
+    }, parallel_walk_threshold);
+    _interactions = interactions.load();
+}
+
+std::vector<ThetaAccuracy> barnesHutAccuracy(ParticleStore& particles, ThreadPool& pool,
+    const std::vector<double>& thetas) {
+    DirectEngine direct;
+    direct.computeAccelerations(particles, pool);
+    std::vector<double> direct_x(particles.ax.begin(), particles.ax.end());
+    std::vector<double> direct_y(particles.ay.begin(), particles.ay.end());
+
+    std::vector<ThetaAccuracy> accuracy;
+    for (double theta : thetas) {
+        BarnesHutEngine engine(theta);
+        auto start = std::chrono::steady_clock::now();
+        engine.computeAccelerations(particles, pool);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        AccelerationError error = accelerationError(particles, direct_x, direct_y);
+        accuracy.push_back({theta, error.rms_error, error.max_error, elapsed.count(),
+            engine.nodeCount()});
+    }
+    return accuracy;
+}
+
+void writeAccuracyReport(std::ostream& out, const std::vector<ThetaAccuracy>& accuracy) {
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::setw(8) << "theta" << std::setw(14) << "rms_error" << std::setw(14)
+        << "max_error" << std::setw(14) << "seconds" << std::setw(10) << "nodes" << std::endl;
+    for (const ThetaAccuracy& row : accuracy) {
+        out << std::fixed << std::setprecision(2) << std::setw(8) << row.theta
+            << std::scientific << std::setprecision(3) << std::setw(14) << row.rms_error
+            << std::setw(14) << row.max_error << std::setw(14) << row.seconds
+            << std::setw(10) << row.nodes << std::endl;
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
+
+}  // namespace NB
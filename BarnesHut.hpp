@@ -0,0 +1,90 @@
+// Copyright 2024 Samuel Stanley
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "ForceEngine.hpp"
+#include "ParticleStore.hpp"
+#include "ThreadPool.hpp"
+
+namespace NB {
+
+// O(N log N) approximation of the gravitational accelerations using a 2D Barnes-Hut quadtree.
+// A node is treated as a single mass at its center of mass when its width divided by its
+// distance from the particle is below the opening angle theta. The tree is rebuilt every call
+// in a node pool whose capacity is kept between steps, so it only allocates while N grows
+class BarnesHutEngine : public ForceEngine {
+ public:
+    // Construct a BarnesHutEngine with opening angle theta. If theta is negative,
+    // std::invalid_argument is thrown
+    explicit BarnesHutEngine(double theta = 0.5);
+
+    void computeAccelerations(ParticleStore& particles, ThreadPool& pool) override;
+
+    // Rebuild the tree from every particle but only walk it for the active particles
+    void computeActiveAccelerations(ParticleStore& particles, ThreadPool& pool,
+        const std::vector<size_t>& active) override;
+
+    std::string name() const override { return "barneshut"; }
+
+    // Return the opening angle
+    double theta() const { return _theta; }
+
+    // Return the number of nodes in the tree built by the last call to computeAccelerations
+    size_t nodeCount() const { return _nodes.size(); }
+
+ private:
+    struct Node {
+        double center_x;     // Center of the square region the node covers
+        double center_y;
+        double half;         // Half the width of the region
+        double com_x;        // Center of mass of every particle below the node
+        double com_y;
+        double mass;         // Total mass of every particle below the node
+        int32_t child[4];    // Index of each quadrant's node, or -1
+        int32_t body;        // First particle of a leaf (chained through _next), or -1
+    };
+
+    // Add a node covering the square at (center_x, center_y) and return its index
+    int32_t addNode(double center_x, double center_y, double half);
+
+    // Insert particle i into the tree rooted at node
+    void insert(const ParticleStore& particles, int32_t node, int32_t i);
+
+    // Fill in the mass and center of mass of node and every node below it
+    void summarize(const ParticleStore& particles, int32_t node);
+
+    // Build the tree from every particle in the store
+    void build(const ParticleStore& particles);
+
+    // Add the softened acceleration on particle i divided by G to sum_x and sum_y and the
+    // potential there divided by G to sum_p, and return the number of particles and nodes they
+    // were summed from
+    uint64_t walk(const ParticleStore& particles, int32_t i, double& sum_x, double& sum_y,
+        double& sum_p) const;
+
+    double _theta;
+    std::vector<Node> _nodes;
+    std::vector<int32_t> _next;
+};
+
+// Error of the Barnes-Hut accelerations for one opening angle against direct summation
+struct ThetaAccuracy {
+    double theta;
+    double rms_error;      // RMS of |a_bh - a_direct| divided by the RMS of |a_direct|
+    double max_error;      // Largest |a_bh - a_direct| divided by the RMS of |a_direct|
+    double seconds;        // Time to compute the Barnes-Hut accelerations once
+    size_t nodes;          // Nodes in the tree
+};
+
+// Compare the Barnes-Hut accelerations for every opening angle in thetas against direct
+// summation of the particles in the store. The store's accelerations are overwritten
+std::vector<ThetaAccuracy> barnesHutAccuracy(ParticleStore& particles, ThreadPool& pool,
+    const std::vector<double>& thetas);
+
+// Write accuracy as a table with one row per opening angle
+void writeAccuracyReport(std::ostream& out, const std::vector<ThetaAccuracy>& accuracy);
+
+}  // namespace NB
@@ -2,33 +2,32 @@
 
 #include <iostream>
 #include <string>
-#include <memory>
 #include <cstdlib>
 #include <SFML/Graphics.hpp>
 #include "Constants.hpp"
 #include "CelestialBody.hpp"
+#include "ParticleStore.hpp"
 #include "Universe.hpp"
 
 namespace NB {
 
 std::istream& operator>>(std::istream& in, CelestialBody& celestialbody) {
+    ParticleStore& particles = celestialbody._universe->particles();
+    size_t i = celestialbody._index;
+
     // Get position
-    in >> celestialbody._position.x >> celestialbody._position.y;
+    in >> particles.x[i] >> particles.y[i];
 
     // Get velocity
-    in >> celestialbody._velocity.x >> celestialbody._velocity.y;
+    in >> particles.vx[i] >> particles.vy[i];
 
     // Get mass
-    in >> celestialbody._mass;
+    in >> particles.mass[i];
 
     // Get texture
-    std::string file_name;
-    in >> file_name;
-    celestialbody._texture = celestialbody._universe.getTexture(file_name);
-    celestialbody._sprite = std::make_unique<sf::Sprite>();
-    celestialbody._sprite->setTexture(*(celestialbody._texture));
-    sf::Vector2u texture_size = celestialbody._texture->getSize();
-    celestialbody._sprite->setOrigin(texture_size.x / 2.0, texture_size.y / 2.0);
+    std::string texture_name;
+    in >> texture_name;
+    celestialbody.setTexture(texture_name);
 
     return in;
 }
@@ -46,49 +45,77 @@ std::ostream& operator<<(std::ostream& out, const CelestialBody& celestialbody)
     out << std::scientific << celestialbody.mass() << ' ';
 
     // Output texture name
-    out << celestialbody._universe.getTextureName(celestialbody._texture);
+    out << celestialbody.textureName();
 
     return out;
 }
 
-void CelestialBody::step(double seconds) {
-    // Get component forces
-    sf::Vector2<double> force = _universe.getForce(*this);
+sf::Vector2f CelestialBody::position() const {
+    const ParticleStore& particles = _universe->particles();
+    return sf::Vector2f(particles.x[_index], particles.y[_index]);
+}
+
+sf::Vector2f CelestialBody::velocity() const {
+    const ParticleStore& particles = _universe->particles();
+    return sf::Vector2f(particles.vx[_index], particles.vy[_index]);
+}
 
-    // Calculate new velocity
-    _velocity.x += seconds * (force.x / _mass);
-    _velocity.y += seconds * (force.y / _mass);
+double CelestialBody::mass() const {
+    return _universe->particles().mass[_index];
+}
 
-    // Calculate new position
-    _position.x += seconds * _velocity.x;
-    _position.y += seconds * _velocity.y;
+const std::string& CelestialBody::textureName() const {
+    return _universe->textureName(_texture);
+}
+
+const sf::Texture* CelestialBody::texture() const {
+    return _universe->texture(_texture);
+}
+
+void CelestialBody::setTexture(const std::string& name) {
+    _texture = _universe->textureIndex(name);
 }
 
 sf::Vector2<double> CelestialBody::distance(const CelestialBody& body1,
     const CelestialBody& body2) {
+    const ParticleStore& particles1 = body1._universe->particles();
+    const ParticleStore& particles2 = body2._universe->particles();
     sf::Vector2<double> distance;
-    distance.x = body2._position.x - body1._position.x;
-    distance.y = body2._position.y - body1._position.y;
+    distance.x = particles2.x[body2._index] - particles1.x[body1._index];
+    distance.y = particles2.y[body2._index] - particles1.y[body1._index];
     return distance;
 }
 
 bool operator==(const CelestialBody& body1, const CelestialBody& body2) {
-    return body1._position == body2._position
-        && body1._velocity == body2._velocity
-        && body1._mass == body2._mass;
+    const ParticleStore& particles1 = body1._universe->particles();
+    const ParticleStore& particles2 = body2._universe->particles();
+    size_t i = body1._index;
+    size_t j = body2._index;
+    return particles1.x[i] == particles2.x[j] && particles1.y[i] == particles2.y[j]
+        && particles1.vx[i] == particles2.vx[j] && particles1.vy[i] == particles2.vy[j]
+        && particles1.mass[i] == particles2.mass[j];
 }
 
 void CelestialBody::draw(sf::RenderTarget& target, sf::RenderStates states) const {
+    const sf::Texture* texture = this->texture();
+    if (!texture)
+        return;
+
+    const ParticleStore& particles = _universe->particles();
+
     // Calculate sprite position
     sf::Vector2<double> sprite_pos;
-    sprite_pos.x = (_position.x / _universe.radius()) * (target.getSize().x / 2.0);
+    sprite_pos.x = (particles.x[_index] / _universe->radius()) * (target.getSize().x / 2.0);
     sprite_pos.x += target.getSize().x / 2.0;
-    sprite_pos.y = (_position.y / _universe.radius()) * -(target.getSize().y / 2.0);
+    sprite_pos.y = (particles.y[_index] / _universe->radius()) * -(target.getSize().y / 2.0);
     sprite_pos.y += target.getSize().y / 2.0;
-    _sprite->setPosition(static_cast<sf::Vector2f>(sprite_pos));
 
-    // Draw sprite
-    target.draw(*_sprite, states);
+    // Draw a sprite built for this draw only, so no drawing state is kept per body
+    sf::Sprite sprite;
+    sprite.setTexture(*texture);
+    sprite.setOrigin(texture->getSize().x / 2.0, texture->getSize().y / 2.0);
+    sprite.setPosition(static_cast<sf::Vector2f>(sprite_pos));
+    target.draw(sprite, states);
 }
 
 }  // namespace NB
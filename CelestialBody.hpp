@@ -2,18 +2,23 @@
 
 #pragma once
 
+#include <cstdint>
 #include <iostream>
 #include <string>
-#include <memory>
 #include <SFML/Graphics.hpp>
 #include "ForwardDeclarations.hpp"
 
 namespace NB {
 
+// A lightweight view of one particle in a Universe. The physical state lives in the Universe's
+// ParticleStore at index() and the texture in the Universe's texture table, so a CelestialBody
+// is a small value the Universe stores contiguously, with nothing allocated per body
 class CelestialBody : public sf::Drawable {
  public:
-    // Construct a CelestialBody with default values
-    explicit CelestialBody(Universe& universe) : _universe(universe) {}
+    // Construct a CelestialBody viewing the particle stored at index in the Universe, drawn
+    // with entry texture of the Universe's texture table
+    CelestialBody(Universe& universe, size_t index, uint32_t texture)
+        : _universe(&universe), _index(index), _texture(texture) {}
 
     // Give celestialbody the values read from in
     friend std::istream& operator>>(std::istream& in, CelestialBody& celestialbody);
@@ -21,18 +26,29 @@ class CelestialBody : public sf::Drawable {
     // Write the current state of universe to out
     friend std::ostream& operator<<(std::ostream& out, const CelestialBody& celestialbody);
 
-    // Update the position and velocity according to the force calculated by the universe and the
-    // amount of seconds given since the CelestialBody was last updated
-    void step(double seconds);
-
     // Return the current position of the CelestialBody
-    sf::Vector2f position() const { return static_cast<sf::Vector2f>(_position); }
+    sf::Vector2f position() const;
 
     // Return the current velocity of the CelestialBody
-    sf::Vector2f velocity() const { return static_cast<sf::Vector2f>(_velocity); }
+    sf::Vector2f velocity() const;
 
     // Return the mass of the CelestialBody
-    double mass() const { return _mass; }
+    double mass() const;
+
+    // Return where the CelestialBody's particle is stored in the Universe's ParticleStore
+    size_t index() const { return _index; }
+
+    // Return the file name of the CelestialBody's texture
+    const std::string& textureName() const;
+
+    // Return the texture the CelestialBody is drawn with, or nullptr if it is not drawn
+    const sf::Texture* texture() const;
+
+    // Return the index of the CelestialBody's texture in the Universe's texture table
+    uint32_t textureIndex() const { return _texture; }
+
+    // Draw the CelestialBody with the texture from file name from now on
+    void setTexture(const std::string& name);
 
     // Return the distance between body2 and body1 (body2 - body1)
     static sf::Vector2<double> distance(const CelestialBody& body1, const CelestialBody& body2);
@@ -42,16 +58,13 @@ class CelestialBody : public sf::Drawable {
 
  protected:
     // Draw the CelestialBody to the target with viewport position calculated from CelestialBody
-    // position and Universe radius
+    // position and Universe radius. A CelestialBody read by a headless Universe draws nothing
     virtual void draw(sf::RenderTarget& target, sf::RenderStates states) const;
 
  private:
-    sf::Vector2<double> _position;
-    sf::Vector2<double> _velocity;
-    double _mass;
-    Universe& _universe;
-    std::shared_ptr<sf::Texture> _texture;
-    std::unique_ptr<sf::Sprite> _sprite;
+    Universe* _universe;
+    size_t _index;
+    uint32_t _texture;
 };
 
 }  // namespace NB
@@ -0,0 +1,196 @@
+// Copyright 2024 Samuel Stanley
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Checkpoint.hpp"
+
+namespace NB {
+
+namespace {
+
+constexpr uint32_t byte_order_mark = 0x01020304;
+
+// The embedded snapshot starts on a multiple of this many bytes so it can be read in place
+constexpr size_t snapshot_alignment = 64;
+
+// Append the raw bytes of value to out
+template <typename T>
+void appendRaw(std::string& out, const T& value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Append text to out, preceded by its length
+void appendString(std::string& out, const std::string& text) {
+    appendRaw(out, static_cast<uint64_t>(text.size()));
+    out += text;
+}
+
+// Reads the fields of a checkpoint in order from the bytes of a mapped file
+class CheckpointReader {
+ public:
+    CheckpointReader(const MappedFile& file, const std::string& file_name)
+        : _begin(file.data()), _p(file.data()), _end(file.data() + file.size()),
+        _fileName(file_name) {}
+
+    // Return the next size bytes and move past them
+    const char* take(size_t size) {
+        if (static_cast<size_t>(_end - _p) < size)
+            fail("is truncated");
+        const char* bytes = _p;
+        _p += size;
+        return bytes;
+    }
+
+    // Return the next value of type T
+    template <typename T>
+    T raw() {
+        T value;
+        std::memcpy(&value, take(sizeof(value)), sizeof(value));
+        return value;
+    }
+
+    // Return the next length-prefixed string
+    std::string string() {
+        uint64_t size = raw<uint64_t>();
+        if (size > static_cast<uint64_t>(_end - _p))
+            fail("is truncated");
+        return std::string(take(size), size);
+    }
+
+    // Move to the next multiple of alignment bytes from the start of the file
+    void align(size_t alignment) {
+        size_t offset = _p - _begin;
+        take((alignment - offset % alignment) % alignment);
+    }
+
+    // Throw std::invalid_argument saying what is wrong with the file
+    [[noreturn]] void fail(const std::string& reason) const {
+        throw std::invalid_argument("Error: checkpoint '" + _fileName + "' " + reason);
+    }
+
+ private:
+    const char* _begin;
+    const char* _p;
+    const char* _end;
+    std::string _fileName;
+};
+
+}  // namespace
+
+void writeCheckpointFile(const std::string& file_name, const Checkpoint& checkpoint) {
+    const ParticleStore& particles = checkpoint.data.particles;
+    std::string bytes(checkpoint_magic, sizeof(checkpoint_magic));
+    appendRaw(bytes, checkpoint_version);
+    appendRaw(bytes, byte_order_mark);
+    appendRaw(bytes, checkpoint.step);
+    appendRaw(bytes, checkpoint.time);
+    appendString(bytes, checkpoint.integrator);
+    appendString(bytes, checkpoint.engine);
+    appendRaw(bytes, static_cast<uint8_t>(checkpoint.calculated_forces));
+
+    std::ostringstream snapshot;
+    writeSnapshot(snapshot, checkpoint.data);
+    std::string snapshot_bytes = std::move(snapshot).str();
+    appendRaw(bytes, static_cast<uint64_t>(snapshot_bytes.size()));
+    bytes.append((snapshot_alignment - bytes.size() % snapshot_alignment) % snapshot_alignment,
+        '\0');
+    bytes += snapshot_bytes;
+
+    bytes.append(reinterpret_cast<const char*>(particles.ax.data()),
+        particles.size() * sizeof(double));
+    bytes.append(reinterpret_cast<const char*>(particles.ay.data()),
+        particles.size() * sizeof(double));
+    appendString(bytes, checkpoint.integrator_state);
+    appendRaw(bytes, checkpoint.steps_since_reorder);
+    appendRaw(bytes, static_cast<uint64_t>(checkpoint.slots.size()));
+    bytes.append(reinterpret_cast<const char*>(checkpoint.slots.data()),
+        checkpoint.slots.size() * sizeof(uint64_t));
+
+    // Write and sync a temporary file, then rename it over the old checkpoint in one step
+    std::string temporary = file_name + ".tmp";
+    int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        throw std::invalid_argument("Error: file '" + temporary + "' could not be opened");
+    size_t written = 0;
+    while (written < bytes.size()) {
+        ssize_t result = ::write(fd, bytes.data() + written, bytes.size() - written);
+        if (result <= 0)
+            break;
+        written += static_cast<size_t>(result);
+    }
+    bool synced = written == bytes.size() && ::fsync(fd) == 0;
+    ::close(fd);
+    if (!synced || std::rename(temporary.c_str(), file_name.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        throw std::invalid_argument("Error: checkpoint '" + file_name + "' could not be written");
+    }
+
+    // The rename only survives a crash once the directory holding it is synced too. Some file
+    // systems cannot sync a directory and say so with EINVAL; their renames need no sync
+    std::string directory = std::filesystem::path(file_name).parent_path().string();
+    int directory_fd = ::open(directory.empty() ? "." : directory.c_str(),
+        O_RDONLY | O_DIRECTORY);
+    bool directory_synced = directory_fd >= 0 && (::fsync(directory_fd) == 0 || errno == EINVAL);
+    if (directory_fd >= 0)
+        ::close(directory_fd);
+    if (!directory_synced)
+        throw std::invalid_argument("Error: checkpoint '" + file_name + "' could not be synced");
+}
+
+Checkpoint readCheckpointFile(const std::string& file_name) {
+    MappedFile file(file_name);
+    CheckpointReader reader(file, file_name);
+    if (std::memcmp(reader.take(sizeof(checkpoint_magic)), checkpoint_magic,
+        sizeof(checkpoint_magic)) != 0)
+        reader.fail("is not a checkpoint");
+    if (reader.raw<uint32_t>() != checkpoint_version)
+        reader.fail("has an unsupported version");
+    if (reader.raw<uint32_t>() != byte_order_mark)
+        reader.fail("was written with a different byte order");
+
+    Checkpoint checkpoint;
+    checkpoint.step = reader.raw<uint64_t>();
+    checkpoint.time = reader.raw<double>();
+    checkpoint.integrator = reader.string();
+    checkpoint.engine = reader.string();
+    checkpoint.calculated_forces = reader.raw<uint8_t>() != 0;
+
+    uint64_t snapshot_size = reader.raw<uint64_t>();
+    reader.align(snapshot_alignment);
+    if (snapshot_size > file.size())
+        reader.fail("is truncated");
+    checkpoint.data = SnapshotView(reader.take(snapshot_size), snapshot_size).data();
+
+    ParticleStore& particles = checkpoint.data.particles;
+    for (AlignedArray* column : {&particles.ax, &particles.ay}) {
+        const char* bytes = reader.take(column->size() * sizeof(double));
+        std::memcpy(column->data(), bytes, column->size() * sizeof(double));
+    }
+    checkpoint.integrator_state = reader.string();
+    checkpoint.steps_since_reorder = reader.raw<uint64_t>();
+    uint64_t num_slots = reader.raw<uint64_t>();
+    if (num_slots != 0 && num_slots != particles.size())
+        reader.fail("has the wrong number of slots");
+    checkpoint.slots.resize(num_slots);
+    std::memcpy(checkpoint.slots.data(), reader.take(num_slots * sizeof(uint64_t)),
+        num_slots * sizeof(uint64_t));
+    std::vector<char> used(num_slots);
+    for (uint64_t slot : checkpoint.slots) {
+        if (slot >= num_slots || used[slot])
+            reader.fail("has invalid slots");
+        used[slot] = 1;
+    }
+    return checkpoint;
+}
+
+}  // namespace NB
@@ -0,0 +1,43 @@
+// Copyright 2024 Samuel Stanley
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Snapshot.hpp"
+
+namespace NB {
+
+// Everything needed to continue a run exactly where it stopped: how far it got, the full
+// precision state of every particle including its acceleration, and the state of the integrator
+struct Checkpoint {
+    uint64_t step = 0;
+    double time = 0.0;
+    std::string integrator;
+    std::string engine;
+    bool calculated_forces = false;
+    UniverseData data;                 // Every particle, in input order
+    std::string integrator_state;
+    uint64_t steps_since_reorder = 0;  // Steps since the particles were last reordered
+    std::vector<uint64_t> slots;       // Where each particle is stored, or empty if in order
+};
+
+// A checkpoint file is this magic number, a uint32_t version and a uint32_t byte order mark,
+// followed by the step, time, names, force flag, a binary snapshot starting on a 64 byte
+// boundary, the acceleration columns, the integrator state, the uint64_t steps since the last
+// reorder, the uint64_t number of slots and the slots
+constexpr char checkpoint_magic[8] = {'N', 'B', 'C', 'K', 'P', 'T', '\r', '\n'};
+constexpr uint32_t checkpoint_version = 1;
+
+// Write checkpoint to file_name atomically: it is written to a temporary file in the same
+// directory, flushed to disk and then renamed over file_name, and the directory is flushed so
+// the rename is on disk too. file_name always holds either the previous checkpoint or the new
+// one in full. If it cannot be written, std::invalid_argument is thrown
+void writeCheckpointFile(const std::string& file_name, const Checkpoint& checkpoint);
+
+// Read the checkpoint file_name. If it cannot be read or is not a valid checkpoint,
+// std::invalid_argument is thrown
+Checkpoint readCheckpointFile(const std::string& file_name);
+
+}  // namespace NB
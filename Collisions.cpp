@@ -0,0 +1,93 @@
+// Copyright 2024 Samuel Stanley
+
+#include <algorithm>
+#include <numeric>
+#include <vector>
+#include "Collisions.hpp"
+
+namespace NB {
+
+size_t mergeCloseParticles(ParticleStore& particles, double radius, std::vector<size_t>& sources) {
+    size_t n = particles.size();
+    if (n < 2 || !(radius > 0))
+        return 0;
+    double* x = particles.x.data();
+    double* y = particles.y.data();
+    double* vx = particles.vx.data();
+    double* vy = particles.vy.data();
+    double* mass = particles.mass.data();
+
+    // Ties are broken by index so the groups do not depend on the sort implementation
+    std::vector<size_t> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [x](size_t a, size_t b) {
+        return x[a] < x[b] || (x[a] == x[b] && a < b);
+    });
+    // Merged particles move, so the sweep runs over the positions from before any merge
+    std::vector<double> sorted_x(n);
+    for (size_t a = 0; a < n; a++)
+        sorted_x[a] = x[order[a]];
+
+    const double radius_sqrd = radius * radius;
+    std::vector<char> merged(n, 0);
+    std::vector<char> removed(n, 0);
+    std::vector<size_t> group;
+    size_t num_removed = 0;
+    for (size_t a = 0; a < n; a++) {
+        size_t i = order[a];
+        if (merged[i])
+            continue;
+        group.assign(1, i);
+        for (size_t b = a + 1; b < n && sorted_x[b] - sorted_x[a] < radius; b++) {
+            size_t j = order[b];
+            double dx = x[j] - x[i];
+            double dy = y[j] - y[i];
+            if (!merged[j] && (dx * dx) + (dy * dy) < radius_sqrd)
+                group.push_back(j);
+        }
+        if (group.size() < 2)
+            continue;
+
+        double total = 0.0;
+        double moment_x = 0.0;
+        double moment_y = 0.0;
+        double momentum_x = 0.0;
+        double momentum_y = 0.0;
+        size_t heaviest = i;
+        for (size_t j : group) {
+            total += mass[j];
+            moment_x += mass[j] * x[j];
+            moment_y += mass[j] * y[j];
+            momentum_x += mass[j] * vx[j];
+            momentum_y += mass[j] * vy[j];
+            if (mass[j] > mass[heaviest] || (mass[j] == mass[heaviest] && j < heaviest))
+                heaviest = j;
+        }
+        if (total == 0.0)
+            continue;
+
+        for (size_t j : group) {
+            merged[j] = 1;
+            removed[j] = j != heaviest;
+        }
+        x[heaviest] = moment_x / total;
+        y[heaviest] = moment_y / total;
+        vx[heaviest] = momentum_x / total;
+        vy[heaviest] = momentum_y / total;
+        mass[heaviest] = total;
+        num_removed += group.size() - 1;
+    }
+    if (num_removed == 0)
+        return 0;
+
+    sources.clear();
+    sources.reserve(n - num_removed);
+    for (size_t i = 0; i < n; i++) {
+        if (!removed[i])
+            sources.push_back(i);
+    }
+    particles.keep(sources);
+    return num_removed;
+}
+
+}  // namespace NB
@@ -0,0 +1,22 @@
+// Copyright 2024 Samuel Stanley
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include "ParticleStore.hpp"
+
+namespace NB {
+
+// Merge particles closer than radius to each other. Each group of close particles becomes one
+// particle with their total mass, at their center of mass and with their total momentum, so
+// mass and momentum are conserved; the kinetic energy of their relative motion is lost, as in
+// a perfectly inelastic collision. The merged particle takes the place of the heaviest of the
+// group and the rest are removed, keeping the order of every other particle. A particle takes
+// part in at most one merge per call, and groups whose masses sum to zero are left alone.
+// Close pairs are found by sweeping the particles in order of x, so the cost is O(N log N) plus
+// the number of pairs closer than radius in x. Return the number of particles removed, and if
+// any were, set sources to the index every remaining particle had before the call
+size_t mergeCloseParticles(ParticleStore& particles, double radius, std::vector<size_t>& sources);
+
+}  // namespace NB
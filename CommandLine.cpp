@@ -0,0 +1,51 @@
+// Copyright 2024 Samuel Stanley
+
+#include <cmath>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include "CommandLine.hpp"
+
+namespace NB {
+
+unsigned int positiveInteger(const std::string& option, const std::string& value) {
+    size_t used = 0;
+    int result = 0;
+    try {
+        result = std::stoi(value, &used);
+    } catch (const std::exception&) {
+        used = 0;
+    }
+    if (used != value.size() || result < 1)
+        throw std::invalid_argument("Error: " + option + " must be a positive integer");
+    return static_cast<unsigned int>(result);
+}
+
+double nonNegativeReal(const std::string& option, const std::string& value) {
+    size_t used = 0;
+    double result = -1;
+    try {
+        result = std::stod(value, &used);
+    } catch (const std::exception&) {
+        used = 0;
+    }
+    if (used != value.size() || !(result >= 0) || !std::isfinite(result))
+        throw std::invalid_argument("Error: " + option + " must be a non-negative number");
+    return result;
+}
+
+double positiveReal(const std::string& option, const std::string& value) {
+    double result = nonNegativeReal(option, value);
+    if (result == 0)
+        throw std::invalid_argument("Error: " + option + " must be a positive number");
+    return result;
+}
+
+size_t countValue(const std::string& option, const std::string& value) {
+    double result = nonNegativeReal(option, value);
+    if (result > 9007199254740992.0 || result != std::floor(result))
+        throw std::invalid_argument("Error: " + option + " must be a whole number up to 2^53");
+    return static_cast<size_t>(result);
+}
+
+}  // namespace NB
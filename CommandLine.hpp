@@ -0,0 +1,26 @@
+// Copyright 2024 Samuel Stanley
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace NB {
+
+// Helpers the command line parsers of NBody, NBodyBench and NBodyEnsemble share. Each converts
+// the value given for option, or throws std::invalid_argument naming option if it is invalid
+
+// Return value converted to a positive integer no larger than an int
+unsigned int positiveInteger(const std::string& option, const std::string& value);
+
+// Return value converted to a finite non-negative real number
+double nonNegativeReal(const std::string& option, const std::string& value);
+
+// Return value converted to a finite positive real number
+double positiveReal(const std::string& option, const std::string& value);
+
+// Return value, a non-negative whole number that may be written like 1e6, converted to a count.
+// Counts above 2^53, which a double cannot hold exactly, are rejected
+size_t countValue(const std::string& option, const std::string& value);
+
+}  // namespace NB
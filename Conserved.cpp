@@ -0,0 +1,98 @@
+// Copyright 2024 Samuel Stanley
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Conserved.hpp"
+#include "Snapshot.hpp"
+
+namespace NB {
+
+namespace {
+
+// Fewest particles worth splitting the sums across threads
+constexpr size_t parallel_sum_threshold = 4096;
+
+}  // namespace
+
+ConservedQuantities measureConserved(const ParticleStore& particles, ThreadPool& pool) {
+    const double* x = particles.x.data();
+    const double* y = particles.y.data();
+    const double* vx = particles.vx.data();
+    const double* vy = particles.vy.data();
+    const double* mass = particles.mass.data();
+    const double* potential = particles.potential.data();
+
+    // Each chunk sums its own particles; the chunk totals are then added in order
+    std::mutex mutex;
+    std::vector<std::pair<size_t, ConservedQuantities>> chunks;
+    pool.parallelFor(particles.size(), [&](size_t begin, size_t end) {
+        ConservedQuantities sum;
+        for (size_t i = begin; i < end; i++) {
+            double px = mass[i] * vx[i];
+            double py = mass[i] * vy[i];
+            sum.kinetic += 0.5 * (px * vx[i] + py * vy[i]);
+            // Every pair appears in the potential of both its particles
+            sum.potential += 0.5 * mass[i] * potential[i];
+            sum.momentum_x += px;
+            sum.momentum_y += py;
+            sum.angular_momentum += x[i] * py - y[i] * px;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        chunks.emplace_back(begin, sum);
+    }, parallel_sum_threshold);
+    std::sort(chunks.begin(), chunks.end(), [](const auto& a, const auto& b) {
+        return a.first < b.first;
+    });
+
+    ConservedQuantities total;
+    for (const auto& [begin, sum] : chunks) {
+        total.kinetic += sum.kinetic;
+        total.potential += sum.potential;
+        total.momentum_x += sum.momentum_x;
+        total.momentum_y += sum.momentum_y;
+        total.angular_momentum += sum.angular_momentum;
+    }
+    return total;
+}
+
+ConservedLog::ConservedLog(const std::string& file_name)
+    : _fileName(file_name), _out(file_name), _first(true), _energy0(0.0) {
+    if (!_out)
+        throw std::invalid_argument("Error: file '" + file_name + "' could not be opened");
+    _out << "step time kinetic potential energy momentum_x momentum_y angular_momentum "
+        "energy_drift\n";
+}
+
+double ConservedLog::record(uint64_t step, double time, const ConservedQuantities& quantities) {
+    double energy = quantities.energy();
+    if (_first) {
+        _energy0 = energy;
+        _first = false;
+    }
+    double drift = _energy0 != 0 ? (energy - _energy0) / std::abs(_energy0) : 0.0;
+
+    _line = std::to_string(step);
+    for (double value : {time, quantities.kinetic, quantities.potential, energy,
+        quantities.momentum_x, quantities.momentum_y, quantities.angular_momentum, drift}) {
+        _line += ' ';
+        appendNumber(_line, value);
+    }
+    _line += '\n';
+    _out << _line;
+    return drift;
+}
+
+void ConservedLog::close() {
+    _out.close();
+    if (_out.fail())
+        throw std::runtime_error("Error: conserved quantity log '" + _fileName +
+            "' could not be written");
+}
+
+}  // namespace NB
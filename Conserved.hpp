@@ -0,0 +1,53 @@
+// Copyright 2024 Samuel Stanley
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include "ParticleStore.hpp"
+#include "ThreadPool.hpp"
+
+namespace NB {
+
+// The totals an isolated system of particles keeps constant, up to integration and force errors
+struct ConservedQuantities {
+    double kinetic = 0.0;
+    double potential = 0.0;
+    double momentum_x = 0.0;
+    double momentum_y = 0.0;
+    double angular_momentum = 0.0;    // About the origin
+
+    // Return the total energy
+    double energy() const { return kinetic + potential; }
+};
+
+// Return the conserved quantities of particles, taking the potential energy from the potential
+// column written by the last force pass. The sums run on the threads of pool in chunks that
+// depend only on the number of particles and threads, so the result is deterministic
+ConservedQuantities measureConserved(const ParticleStore& particles, ThreadPool& pool);
+
+// Writes the conserved quantities of a run to a text file, one row per record, with the energy
+// drift relative to the first record
+class ConservedLog {
+ public:
+    // Open file_name and write the header row. If it cannot be opened, std::invalid_argument is
+    // thrown
+    explicit ConservedLog(const std::string& file_name);
+
+    // Write quantities after step steps and time seconds, and return the energy drift
+    // (E - E0) / |E0| since the first record
+    double record(uint64_t step, double time, const ConservedQuantities& quantities);
+
+    // Close the file. If any write failed, std::runtime_error is thrown
+    void close();
+
+ private:
+    std::string _fileName;
+    std::ofstream _out;
+    bool _first;
+    double _energy0;
+    std::string _line;
+};
+
+}  // namespace NB
@@ -0,0 +1,436 @@
+// Copyright 2024 Samuel Stanley
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Ensemble.hpp"
+#include "Constants.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace NB {
+
+namespace {
+
+constexpr size_t lanes = ensemble_lanes;
+
+// The particles of up to lanes members with the same number of particles, interleaved so
+// element i * lanes + lane of every array belongs to particle i of the member in lane. Unused
+// lanes hold a copy of lane 0 and never step
+struct Batch {
+    size_t n = 0;                         // Particles per member
+    size_t used = 0;                      // Lanes holding members
+    size_t member[lanes] = {};            // Index of the member in each used lane
+    AlignedArray x, y, vx, vy, mass, ax, ay, potential;
+};
+
+// Compute the accelerations and potential of every particle of every lane of batch from the
+// other particles of the same lane
+using BatchKernel = void (*)(Batch& batch, double softening_sqrd);
+
+// Each lane adds its terms in the same order and with the same roundings as accumulateScalar in
+// ForceKernels.cpp, so a member gets the same accelerations as DirectEngine's scalar kernel
+void batchForcesScalar(Batch& batch, double softening_sqrd) {
+    const double* x = batch.x.data();
+    const double* y = batch.y.data();
+    const double* mass = batch.mass.data();
+    for (size_t i = 0; i < batch.n; i++) {
+        for (size_t lane = 0; lane < lanes; lane++) {
+            const size_t k = i * lanes + lane;
+            double sum_x = 0.0;
+            double sum_y = 0.0;
+            double sum_p = 0.0;
+            for (size_t j = lane; j < batch.n * lanes; j += lanes) {
+                double dx = x[j] - x[k];
+                double dy = y[j] - y[k];
+                double distance_sqrd = (dx * dx) + (dy * dy);
+                if (distance_sqrd == 0.0)
+                    continue;
+                double softened = distance_sqrd + softening_sqrd;
+                double inv_r3 = 1.0 / (softened * std::sqrt(softened));
+                sum_x += dx * mass[j] * inv_r3;
+                sum_y += dy * mass[j] * inv_r3;
+                sum_p += mass[j] * inv_r3 * softened;
+            }
+            batch.ax[k] = G * sum_x;
+            batch.ay[k] = G * sum_y;
+            batch.potential[k] = -G * sum_p;
+        }
+    }
+}
+
+// The AVX2 kernel is only built for x86; elsewhere every batch uses the scalar one
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+void batchForcesAVX2(Batch& batch, double softening_sqrd) {
+    const double* x = batch.x.data();
+    const double* y = batch.y.data();
+    const double* mass = batch.mass.data();
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d eps2 = _mm256_set1_pd(softening_sqrd);
+    const __m256d g = _mm256_set1_pd(G);
+    const __m256d minus_g = _mm256_set1_pd(-G);
+
+    for (size_t i = 0; i < batch.n; i++) {
+        __m256d xi = _mm256_load_pd(x + i * lanes);
+        __m256d yi = _mm256_load_pd(y + i * lanes);
+        __m256d sum_x = zero;
+        __m256d sum_y = zero;
+        __m256d sum_p = zero;
+        for (size_t j = 0; j < batch.n * lanes; j += lanes) {
+            __m256d dx = _mm256_sub_pd(_mm256_load_pd(x + j), xi);
+            __m256d dy = _mm256_sub_pd(_mm256_load_pd(y + j), yi);
+            __m256d r2 = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+            __m256d soft = _mm256_add_pd(r2, eps2);
+            __m256d inv_r3 = _mm256_div_pd(one, _mm256_mul_pd(soft, _mm256_sqrt_pd(soft)));
+            __m256d m = _mm256_load_pd(mass + j);
+            // Zero the lanes where the particles coincide, which the scalar kernel skips
+            __m256d apart = _mm256_cmp_pd(r2, zero, _CMP_NEQ_OQ);
+            sum_x = _mm256_add_pd(sum_x,
+                _mm256_and_pd(_mm256_mul_pd(_mm256_mul_pd(dx, m), inv_r3), apart));
+            sum_y = _mm256_add_pd(sum_y,
+                _mm256_and_pd(_mm256_mul_pd(_mm256_mul_pd(dy, m), inv_r3), apart));
+            sum_p = _mm256_add_pd(sum_p,
+                _mm256_and_pd(_mm256_mul_pd(_mm256_mul_pd(m, inv_r3), soft), apart));
+        }
+        _mm256_store_pd(batch.ax.data() + i * lanes, _mm256_mul_pd(g, sum_x));
+        _mm256_store_pd(batch.ay.data() + i * lanes, _mm256_mul_pd(g, sum_y));
+        _mm256_store_pd(batch.potential.data() + i * lanes, _mm256_mul_pd(minus_g, sum_p));
+    }
+}
+#endif
+
+// v += h[lane] * a for every particle of every lane
+void kick(Batch& batch, const double* h) {
+    for (size_t i = 0; i < batch.n; i++) {
+        for (size_t lane = 0; lane < lanes; lane++) {
+            const size_t k = i * lanes + lane;
+            batch.vx[k] += h[lane] * batch.ax[k];
+            batch.vy[k] += h[lane] * batch.ay[k];
+        }
+    }
+}
+
+// x += h[lane] * v for every particle of every lane
+void drift(Batch& batch, const double* h) {
+    for (size_t i = 0; i < batch.n; i++) {
+        for (size_t lane = 0; lane < lanes; lane++) {
+            const size_t k = i * lanes + lane;
+            batch.x[k] += h[lane] * batch.vx[k];
+            batch.y[k] += h[lane] * batch.vy[k];
+        }
+    }
+}
+
+// Return the total energy of the member in lane from the last force pass
+double energy(const Batch& batch, size_t lane) {
+    double kinetic = 0.0;
+    double potential = 0.0;
+    for (size_t i = 0; i < batch.n; i++) {
+        const size_t k = i * lanes + lane;
+        double speed_sqrd = batch.vx[k] * batch.vx[k] + batch.vy[k] * batch.vy[k];
+        kinetic += 0.5 * batch.mass[k] * speed_sqrd;
+        potential += 0.5 * batch.mass[k] * batch.potential[k];
+    }
+    return kinetic + potential;
+}
+
+// Interleave the members of batch into its arrays
+void load(Batch& batch, const std::vector<EnsembleMember>& members) {
+    for (AlignedArray* column : {&batch.x, &batch.y, &batch.vx, &batch.vy, &batch.mass,
+        &batch.ax, &batch.ay, &batch.potential})
+        column->assign(batch.n * lanes, 0.0);
+    for (size_t lane = 0; lane < lanes; lane++) {
+        const ParticleStore& particles =
+            members[batch.member[lane < batch.used ? lane : 0]].data.particles;
+        for (size_t i = 0; i < batch.n; i++) {
+            const size_t k = i * lanes + lane;
+            batch.x[k] = particles.x[i];
+            batch.y[k] = particles.y[i];
+            batch.vx[k] = particles.vx[i];
+            batch.vy[k] = particles.vy[i];
+            batch.mass[k] = particles.mass[i];
+        }
+    }
+}
+
+// Copy the state of every used lane of batch back to its member
+void store(const Batch& batch, std::vector<EnsembleMember>& members) {
+    for (size_t lane = 0; lane < batch.used; lane++) {
+        ParticleStore& particles = members[batch.member[lane]].data.particles;
+        for (size_t i = 0; i < batch.n; i++) {
+            const size_t k = i * lanes + lane;
+            particles.x[i] = batch.x[k];
+            particles.y[i] = batch.y[k];
+            particles.vx[i] = batch.vx[k];
+            particles.vy[i] = batch.vy[k];
+            particles.ax[i] = batch.ax[k];
+            particles.ay[i] = batch.ay[k];
+            particles.potential[i] = batch.potential[k];
+        }
+    }
+}
+
+// Step the members of batch until T seconds have passed, with leapfrog if it is set and
+// symplectic Euler otherwise. A lane whose member is done, or that holds no member, steps by 0
+void run(Batch& batch, std::vector<EnsembleMember>& members, double T, bool leapfrog,
+    double softening_sqrd, BatchKernel forces) {
+    load(batch, members);
+    forces(batch, softening_sqrd);
+    for (size_t lane = 0; lane < batch.used; lane++)
+        members[batch.member[lane]].energy0 = energy(batch, lane);
+
+    // The accelerations match the positions, as they do after a leapfrog step
+    bool current = true;
+    double time[lanes] = {};
+    double h[lanes];
+    double half[lanes];
+    while (true) {
+        bool any = false;
+        for (size_t lane = 0; lane < lanes; lane++) {
+            EnsembleMember* member = lane < batch.used ? &members[batch.member[lane]] : nullptr;
+            bool active = member && time[lane] < T;
+            h[lane] = active ? member->dt : 0.0;
+            half[lane] = h[lane] / 2;
+            if (active) {
+                time[lane] += member->dt;
+                member->steps++;
+                any = true;
+            }
+        }
+        if (!any)
+            break;
+
+        if (!current)
+            forces(batch, softening_sqrd);
+        if (leapfrog) {
+            kick(batch, half);
+            drift(batch, h);
+            forces(batch, softening_sqrd);
+            kick(batch, half);
+        } else {
+            kick(batch, h);
+            drift(batch, h);
+            current = false;
+        }
+    }
+
+    if (!current)
+        forces(batch, softening_sqrd);
+    for (size_t lane = 0; lane < batch.used; lane++)
+        members[batch.member[lane]].energy = energy(batch, lane);
+    store(batch, members);
+}
+
+// Return value converted to a number, naming where in errors
+double numberValue(const std::string& value, const std::string& where) {
+    size_t used = 0;
+    double result = 0;
+    try {
+        result = std::stod(value, &used);
+    } catch (const std::exception&) {
+        used = 0;
+    }
+    if (used == 0 || used != value.size() || !std::isfinite(result))
+        throw std::invalid_argument("Error: " + where + ": '" + value + "' is not a number");
+    return result;
+}
+
+}  // namespace
+
+double EnsembleMember::drift() const {
+    return energy0 != 0 ? (energy - energy0) / std::abs(energy0) : 0.0;
+}
+
+std::vector<EnsembleMember> readEnsembleFile(const std::string& file_name) {
+    std::ifstream in(file_name);
+    if (!in)
+        throw std::invalid_argument("Error: file '" + file_name + "' could not be opened");
+
+    // Universe files shared by several members are read once
+    std::map<std::string, UniverseData> universes;
+    std::vector<EnsembleMember> members;
+    std::string line;
+    for (size_t number = 1; std::getline(in, line); number++) {
+        std::istringstream fields(line);
+        std::string name, universe, dt_text;
+        if (!(fields >> name) || name[0] == '#')
+            continue;
+        const std::string where = file_name + " line " + std::to_string(number);
+        if (!(fields >> universe >> dt_text))
+            throw std::invalid_argument("Error: " + where +
+                ": expected a name, a universe file and dt");
+        double dt = numberValue(dt_text, where);
+        if (!(dt > 0))
+            throw std::invalid_argument("Error: " + where + ": dt must be positive");
+
+        double relative = 0.0;
+        double seed = 0.0;
+        double mass0 = 1.0;
+        double copies = 0.0;
+        std::string field;
+        while (fields >> field) {
+            size_t equals = field.find('=');
+            std::string key = field.substr(0, equals);
+            double value = numberValue(equals == std::string::npos ? "" :
+                field.substr(equals + 1), where);
+            if (key == "perturb" && value >= 0)
+                relative = value;
+            else if (key == "seed" && value >= 0 && value == std::floor(value))
+                seed = value;
+            else if (key == "mass0" && value >= 0)
+                mass0 = value;
+            else if (key == "copies" && value >= 1 && value == std::floor(value))
+                copies = value;
+            else
+                throw std::invalid_argument("Error: " + where + ": invalid field '" + field +
+                    "'");
+        }
+
+        auto found = universes.find(universe);
+        if (found == universes.end())
+            found = universes.emplace(universe, readUniverseFile(universe)).first;
+        const UniverseData& start = found->second;
+        if (mass0 != 1.0 && start.particles.size() == 0)
+            throw std::invalid_argument("Error: " + where + ": mass0 needs a particle");
+
+        uint64_t count = copies > 0 ? static_cast<uint64_t>(copies) : 1;
+        for (uint64_t copy = 0; copy < count; copy++) {
+            EnsembleMember member;
+            member.name = copies > 0 ? name + "-" + std::to_string(copy) : name;
+            member.data = start;
+            member.dt = dt;
+            if (mass0 != 1.0)
+                member.data.particles.mass[0] *= mass0;
+            if (relative > 0)
+                perturb(member.data.particles, relative, static_cast<uint64_t>(seed) + copy);
+            members.push_back(std::move(member));
+        }
+    }
+    return members;
+}
+
+void perturb(ParticleStore& particles, double relative, uint64_t seed) {
+    const size_t n = particles.size();
+    if (n == 0)
+        return;
+    // Scaled by the whole system, so particles at rest or at the origin are perturbed too
+    double distance_sqrd = 0.0;
+    double speed_sqrd = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        distance_sqrd += particles.x[i] * particles.x[i] + particles.y[i] * particles.y[i];
+        speed_sqrd += particles.vx[i] * particles.vx[i] + particles.vy[i] * particles.vy[i];
+    }
+    const double position_scale = relative * std::sqrt(distance_sqrd / n);
+    const double velocity_scale = relative * std::sqrt(speed_sqrd / n);
+
+    std::mt19937_64 generator(seed);
+    std::normal_distribution<double> normal;
+    for (size_t i = 0; i < n; i++) {
+        particles.x[i] += position_scale * normal(generator);
+        particles.y[i] += position_scale * normal(generator);
+        particles.vx[i] += velocity_scale * normal(generator);
+        particles.vy[i] += velocity_scale * normal(generator);
+    }
+}
+
+void runEnsemble(std::vector<EnsembleMember>& members, double T, const std::string& integrator,
+    double softening, ThreadPool& pool, KernelIsa isa) {
+    if (integrator != "euler" && integrator != "leapfrog")
+        throw std::invalid_argument("Error: ensembles support only the euler and leapfrog "
+            "integrators, not '" + integrator + "'");
+    if (!isaSupported(isa))
+        throw std::invalid_argument("Error: instruction set '" + isaName(isa) +
+            "' is not supported by this CPU");
+    if (!(softening >= 0))
+        throw std::invalid_argument("Error: softening must not be negative");
+    for (const EnsembleMember& member : members) {
+        if (!(member.dt > 0))
+            throw std::invalid_argument("Error: member '" + member.name +
+                "' needs a positive dt");
+    }
+    BatchKernel forces = batchForcesScalar;
+#if defined(__x86_64__) || defined(__i386__)
+    if (static_cast<int>(isa) >= static_cast<int>(KernelIsa::AVX2))
+        forces = batchForcesAVX2;
+#endif
+
+    // Batch members of the same size, and among those the ones taking a similar number of
+    // steps, so few lanes sit idle waiting for the longest member of their batch
+    std::vector<size_t> order(members.size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&members](size_t a, size_t b) {
+        size_t n_a = members[a].data.particles.size();
+        size_t n_b = members[b].data.particles.size();
+        return n_a != n_b ? n_a < n_b : members[a].dt < members[b].dt;
+    });
+    std::vector<Batch> batches;
+    for (size_t index : order) {
+        size_t n = members[index].data.particles.size();
+        members[index].steps = 0;
+        if (batches.empty() || batches.back().n != n || batches.back().used == lanes) {
+            batches.emplace_back();
+            batches.back().n = n;
+        }
+        Batch& batch = batches.back();
+        batch.member[batch.used++] = index;
+    }
+
+    // Batches take very different times, so threads take the next one as they finish. Each
+    // batch is stepped by one thread, so the results do not depend on which
+    const bool leapfrog = integrator == "leapfrog";
+    const double softening_sqrd = softening * softening;
+    std::atomic<size_t> next(0);
+    pool.run([&](unsigned int) {
+        for (size_t b = next++; b < batches.size(); b = next++) {
+            run(batches[b], members, T, leapfrog, softening_sqrd, forces);
+            // Free the batch's arrays as soon as it is done
+            batches[b] = Batch();
+        }
+    });
+}
+
+void writeEnsembleSummary(std::ostream& out, const std::vector<EnsembleMember>& members) {
+    out << "name n dt steps energy0 energy drift\n";
+    std::string line;
+    for (const EnsembleMember& member : members) {
+        line = member.name + ' ' + std::to_string(member.data.particles.size()) + ' ';
+        appendNumber(line, member.dt);
+        line += ' ' + std::to_string(member.steps) + ' ';
+        appendNumber(line, member.energy0);
+        line += ' ';
+        appendNumber(line, member.energy);
+        line += ' ';
+        appendNumber(line, member.drift());
+        out << line << '\n';
+    }
+}
+
+void writeEnsembleStates(const std::string& directory,
+    const std::vector<EnsembleMember>& members) {
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    for (const EnsembleMember& member : members) {
+        std::string file_name = (std::filesystem::path(directory) / (member.name + ".txt"))
+            .string();
+        std::ofstream out(file_name);
+        writeText(out, member.data);
+        if (!out)
+            throw std::invalid_argument("Error: file '" + file_name + "' could not be written");
+    }
+}
+
+}  // namespace NB
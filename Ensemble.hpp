@@ -0,0 +1,64 @@
+// Copyright 2024 Samuel Stanley
+
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "ForceKernels.hpp"
+#include "Snapshot.hpp"
+#include "ThreadPool.hpp"
+
+namespace NB {
+
+// Number of members a batch advances in lockstep, one per lane of an AVX2 register
+constexpr size_t ensemble_lanes = 4;
+
+// One small universe of an ensemble, run independently of the others
+struct EnsembleMember {
+    std::string name;
+    UniverseData data;         // Starting state, advanced in place by runEnsemble
+    double dt = 0.0;
+    uint64_t steps = 0;        // Steps taken by runEnsemble
+    double energy0 = 0.0;      // Total energy before and after runEnsemble
+    double energy = 0.0;
+
+    // Return the energy drift (E - E0) / |E0| over the run
+    double drift() const;
+};
+
+// Read an ensemble file. Each line that is not blank or a # comment is one member:
+//
+//     name universe_file dt [perturb=X] [seed=S] [mass0=M] [copies=K]
+//
+// The member starts from universe_file (text or binary snapshot) and steps by dt. perturb
+// applies perturb(particles, X, seed) below. mass0 scales the mass of the first particle, for
+// mass ratio sweeps. copies makes K members name-0 to name-(K-1) with seeds S to S + K - 1. If
+// the file cannot be read or is malformed, std::invalid_argument is thrown
+std::vector<EnsembleMember> readEnsembleFile(const std::string& file_name);
+
+// Add relative g R to every position component of particles and relative g V to every velocity
+// component, with R and V the RMS distance from the origin and speed of the particles and g
+// drawn from a standard normal distribution seeded by seed
+void perturb(ParticleStore& particles, double relative, uint64_t seed);
+
+// Advance every member until T seconds have passed, stepping while its time is below T as NBody
+// does, with integrator ("euler" or "leapfrog") and direct summation Plummer softened by softening.
+// Members with the same number of particles are batched ensemble_lanes at a time and each batch is
+// stepped in lockstep by a kernel whose lanes are the members, with isa choosing the AVX2 (built
+// only for x86) or scalar kernel. Every lane computes exactly what DirectEngine's scalar kernel
+// does for its member, so results do not depend on isa, the batching or the number of threads. If
+// integrator is not supported or isa is not supported by the CPU, std::invalid_argument is thrown
+void runEnsemble(std::vector<EnsembleMember>& members, double T, const std::string& integrator,
+    double softening, ThreadPool& pool, KernelIsa isa = detectIsa());
+
+// Write one row per member with its name, particle count, dt, steps and energy drift
+void writeEnsembleSummary(std::ostream& out, const std::vector<EnsembleMember>& members);
+
+// Write the final state of every member to directory/name.txt in the universe file format. If a
+// file cannot be written, std::invalid_argument is thrown
+void writeEnsembleStates(const std::string& directory,
+    const std::vector<EnsembleMember>& members);
+
+}  // namespace NB
@@ -0,0 +1,468 @@
+// Copyright 2024 Samuel Stanley
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <iomanip>
+#include <ios>
+#include <iostream>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+#include "Fmm.hpp"
+#include "Constants.hpp"
+
+namespace NB {
+
+namespace {
+
+// Deepest level a cell is split to. Particles that still share a leaf there (because they are
+// at or extremely near the same position) are summed directly
+constexpr int max_fmm_depth = 48;
+
+// Roughly how many subtrees the work is split over; each holds at most this fraction of the
+// particles
+constexpr size_t fmm_subtrees = 256;
+
+// Fill powers[n] with z^n / n! for n <= max
+inline void scaledPowers(std::complex<double> z, unsigned int max, std::complex<double>* powers) {
+    powers[0] = 1.0;
+    for (unsigned int n = 1; n <= max; n++)
+        powers[n] = powers[n - 1] * z / static_cast<double>(n);
+}
+
+}  // namespace
+
+FmmEngine::FmmEngine(unsigned int order, double theta, size_t leaf_size)
+    : _order(order), _theta(theta), _leafSize(leaf_size) {
+    if (order == 0 || order > max_fmm_order)
+        throw std::invalid_argument("Error: FMM order must be from 1 to " +
+            std::to_string(max_fmm_order));
+    if (!(theta > 0 && theta < 1))
+        throw std::invalid_argument("Error: FMM theta must be between 0 and 1");
+    if (leaf_size == 0)
+        throw std::invalid_argument("Error: FMM leaf size must be positive");
+
+    // Coefficients (k, l) with k + l <= p, stored row by row
+    _rowOffset.resize(order + 1);
+    _terms = 0;
+    for (unsigned int k = 0; k <= order; k++) {
+        _rowOffset[k] = _terms;
+        _terms += order + 1 - k;
+    }
+    _derivative.resize(2 * order + 1);
+    _derivative[0] = 1.0;
+    for (unsigned int n = 1; n <= 2 * order; n++)
+        _derivative[n] = _derivative[n - 1] * (-0.5 - (n - 1));
+}
+
+int32_t FmmEngine::addCell(double center_x, double center_y, double half, uint32_t begin,
+    uint32_t end) {
+    _cells.push_back({center_x, center_y, half, 0.0, begin, end, {-1, -1, -1, -1}});
+    return static_cast<int32_t>(_cells.size() - 1);
+}
+
+void FmmEngine::split(const ParticleStore& particles, int32_t cell, int depth) {
+    const Cell current = _cells[cell];
+    if (current.end - current.begin <= _leafSize || depth >= max_fmm_depth)
+        return;
+
+    auto quadrantOf = [&particles, &current](uint32_t i) {
+        return (particles.x[i] >= current.center_x) + 2 * (particles.y[i] >= current.center_y);
+    };
+    uint32_t count[4] = {0, 0, 0, 0};
+    for (uint32_t k = current.begin; k < current.end; k++)
+        count[quadrantOf(_index[k])]++;
+    uint32_t start[4];
+    start[0] = current.begin;
+    for (int quadrant = 1; quadrant < 4; quadrant++)
+        start[quadrant] = start[quadrant - 1] + count[quadrant - 1];
+    uint32_t next[4] = {start[0], start[1], start[2], start[3]};
+    for (uint32_t k = current.begin; k < current.end; k++)
+        _scratch[next[quadrantOf(_index[k])]++] = _index[k];
+    std::copy(_scratch.begin() + current.begin, _scratch.begin() + current.end,
+        _index.begin() + current.begin);
+
+    double quarter = current.half / 2;
+    for (int quadrant = 0; quadrant < 4; quadrant++) {
+        if (count[quadrant] == 0)
+            continue;
+        int32_t child = addCell(current.center_x + ((quadrant & 1) ? quarter : -quarter),
+            current.center_y + ((quadrant & 2) ? quarter : -quarter), quarter, start[quadrant],
+            start[quadrant] + count[quadrant]);
+        _cells[cell].child[quadrant] = child;
+        split(particles, child, depth + 1);
+    }
+}
+
+void FmmEngine::build(const ParticleStore& particles) {
+    size_t n = particles.size();
+    _cells.clear();
+    _roots.clear();
+    _upper.clear();
+    if (n == 0)
+        return;
+    _index.resize(n);
+    std::iota(_index.begin(), _index.end(), 0);
+    _scratch.resize(n);
+
+    // The root is the smallest square holding every particle
+    auto [min_x, max_x] = std::minmax_element(particles.x.begin(), particles.x.end());
+    auto [min_y, max_y] = std::minmax_element(particles.y.begin(), particles.y.end());
+    double half = std::max(*max_x - *min_x, *max_y - *min_y) / 2;
+    half = half > 0 ? half * (1 + 1e-9) : 1.0;
+    _cells.reserve(2 * n / _leafSize + 1);
+    addCell((*min_x + *max_x) / 2, (*min_y + *max_y) / 2, half, 0, static_cast<uint32_t>(n));
+    split(particles, 0, 0);
+
+    // Split the work over the largest subtrees holding at most n / fmm_subtrees particles.
+    // Children always come after their parents, so _upper lists parents first
+    size_t most = std::max(_leafSize, n / fmm_subtrees);
+    std::vector<int32_t> stack = {0};
+    while (!stack.empty()) {
+        int32_t cell = stack.back();
+        stack.pop_back();
+        const Cell& current = _cells[cell];
+        if (current.end - current.begin <= most || leaf(current)) {
+            _roots.push_back(cell);
+            continue;
+        }
+        _upper.push_back(cell);
+        for (int quadrant = 3; quadrant >= 0; quadrant--) {
+            if (current.child[quadrant] >= 0)
+                stack.push_back(current.child[quadrant]);
+        }
+    }
+    std::sort(_upper.begin(), _upper.end());
+}
+
+void FmmEngine::upward(const ParticleStore& particles, int32_t cell, bool below) {
+    const unsigned int p = _order;
+    Complex* multipole = row(_multipoles, cell, 0);
+    std::fill(multipole, multipole + _terms, Complex(0.0));
+    Cell& current = _cells[cell];
+
+    if (leaf(current)) {
+        Complex center(current.center_x, current.center_y);
+        Complex powers[max_fmm_order + 1];
+        // Q(k, l) = sum of m b^k conj(b)^l / (k! l!), with b the particle's offset from center
+        double radius = 0.0;
+        for (uint32_t k = current.begin; k < current.end; k++) {
+            uint32_t i = _index[k];
+            Complex b = Complex(particles.x[i], particles.y[i]) - center;
+            radius = std::max(radius, std::abs(b));
+            scaledPowers(b, p, powers);
+            for (unsigned int row_k = 0; row_k <= p; row_k++) {
+                Complex scaled = particles.mass[i] * powers[row_k];
+                Complex* q = row(_multipoles, cell, row_k);
+                for (unsigned int l = 0; l + row_k <= p; l++)
+                    q[l] += scaled * std::conj(powers[l]);
+            }
+        }
+        current.radius = radius;
+        return;
+    }
+
+    double radius = 0.0;
+    for (int quadrant = 0; quadrant < 4; quadrant++) {
+        int32_t child = _cells[cell].child[quadrant];
+        if (child < 0)
+            continue;
+        if (below)
+            upward(particles, child, true);
+        const Cell& from = _cells[child];
+        radius = std::max(radius, std::hypot(from.center_x - current.center_x,
+            from.center_y - current.center_y) + from.radius);
+        multipoleToMultipole(child, cell);
+    }
+    // Every particle is also inside the cell's square
+    current.radius = std::min(radius, current.half * std::sqrt(2.0));
+}
+
+void FmmEngine::multipoleToMultipole(int32_t child, int32_t parent) {
+    const unsigned int p = _order;
+    const Cell& from = _cells[child];
+    const Cell& to = _cells[parent];
+    Complex powers[max_fmm_order + 1];
+    scaledPowers(Complex(from.center_x - to.center_x, from.center_y - to.center_y), p, powers);
+
+    // Q'(k, l) = sum over i <= k, j <= l of Q(i, j) d^(k-i) conj(d)^(l-j) / ((k-i)! (l-j)!),
+    // applied as a pass over l and then one over k
+    Complex partial[(max_fmm_order + 1) * (max_fmm_order + 1)];
+    for (unsigned int i = 0; i <= p; i++) {
+        const Complex* q = row(_multipoles, child, i);
+        for (unsigned int l = 0; i + l <= p; l++) {
+            Complex sum = 0.0;
+            for (unsigned int j = 0; j <= l; j++)
+                sum += q[j] * std::conj(powers[l - j]);
+            partial[i * (p + 1) + l] = sum;
+        }
+    }
+    for (unsigned int k = 0; k <= p; k++) {
+        Complex* q = row(_multipoles, parent, k);
+        for (unsigned int l = 0; k + l <= p; l++) {
+            Complex sum = 0.0;
+            for (unsigned int i = 0; i <= k; i++)
+                sum += powers[k - i] * partial[i * (p + 1) + l];
+            q[l] += sum;
+        }
+    }
+}
+
+void FmmEngine::multipoleToLocal(int32_t source, int32_t target) {
+    const unsigned int p = _order;
+    const Cell& from = _cells[source];
+    const Cell& to = _cells[target];
+    Complex r(to.center_x - from.center_x, to.center_y - from.center_y);
+    Complex inverse = 1.0 / r;
+    double inverse_abs = 1.0 / std::abs(r);
+
+    // d^n/dz^n d^m/dconj(z)^m |z|^-1 at r = |r|^-1 a(n) conj(a(m)), a(n) = c(n) r^-n
+    Complex a[2 * max_fmm_order + 1];
+    Complex power = 1.0;
+    for (unsigned int n = 0; n <= 2 * p; n++) {
+        a[n] = _derivative[n] * power;
+        power *= inverse;
+    }
+
+    // L(i, j) += |r|^-1 sum over k, l of (-1)^(k+l) Q(k, l) a(i+k) conj(a(j+l)), applied as a
+    // pass over l and then one over k
+    Complex partial[(max_fmm_order + 1) * (max_fmm_order + 1)];
+    for (unsigned int k = 0; k <= p; k++) {
+        const Complex* q = row(_multipoles, source, k);
+        for (unsigned int j = 0; j <= p; j++) {
+            Complex sum = 0.0;
+            for (unsigned int l = 0; k + l <= p; l++) {
+                Complex term = q[l] * std::conj(a[j + l]);
+                sum += ((k + l) & 1) ? -term : term;
+            }
+            partial[k * (p + 1) + j] = sum;
+        }
+    }
+    for (unsigned int i = 0; i <= p; i++) {
+        Complex* local = row(_locals, target, i);
+        for (unsigned int j = 0; i + j <= p; j++) {
+            Complex sum = 0.0;
+            for (unsigned int k = 0; k <= p; k++)
+                sum += a[i + k] * partial[k * (p + 1) + j];
+            local[j] += inverse_abs * sum;
+        }
+    }
+}
+
+uint64_t FmmEngine::interact(const ParticleStore& particles, int32_t target, int32_t source,
+    double softening_sqrd, double* sum_x, double* sum_y, double* sum_p) {
+    const Cell& to = _cells[target];
+    const Cell& from = _cells[source];
+    double dx = to.center_x - from.center_x;
+    double dy = to.center_y - from.center_y;
+    double separation = to.radius + from.radius;
+
+    if (separation * separation < _theta * _theta * ((dx * dx) + (dy * dy))) {
+        multipoleToLocal(source, target);
+        return 1;
+    }
+
+    bool target_leaf = leaf(to);
+    bool source_leaf = leaf(from);
+    if (target_leaf && source_leaf) {
+        // Near field: sum every pair exactly
+        uint64_t pairs = 0;
+        const double* x = particles.x.data();
+        const double* y = particles.y.data();
+        const double* mass = particles.mass.data();
+        for (uint32_t a = to.begin; a < to.end; a++) {
+            uint32_t i = _index[a];
+            for (uint32_t b = from.begin; b < from.end; b++) {
+                uint32_t j = _index[b];
+                double jx = x[j] - x[i];
+                double jy = y[j] - y[i];
+                double r2 = (jx * jx) + (jy * jy);
+                if (r2 == 0.0)
+                    continue;
+                double softened = r2 + softening_sqrd;
+                double inv_r3 = 1.0 / (softened * std::sqrt(softened));
+                sum_x[i] += jx * mass[j] * inv_r3;
+                sum_y[i] += jy * mass[j] * inv_r3;
+                sum_p[i] += mass[j] * inv_r3 * softened;
+                pairs++;
+            }
+        }
+        return pairs;
+    }
+
+    // Split the larger cell, or the one that can be split
+    uint64_t count = 0;
+    if (source_leaf || (!target_leaf && to.radius >= from.radius)) {
+        for (int quadrant = 0; quadrant < 4; quadrant++) {
+            int32_t child = _cells[target].child[quadrant];
+            if (child >= 0)
+                count += interact(particles, child, source, softening_sqrd, sum_x, sum_y, sum_p);
+        }
+    } else {
+        for (int quadrant = 0; quadrant < 4; quadrant++) {
+            int32_t child = _cells[source].child[quadrant];
+            if (child >= 0)
+                count += interact(particles, target, child, softening_sqrd, sum_x, sum_y, sum_p);
+        }
+    }
+    return count;
+}
+
+void FmmEngine::downward(const ParticleStore& particles, int32_t cell, double* sum_x,
+    double* sum_y, double* sum_p) {
+    const unsigned int p = _order;
+    const Cell& current = _cells[cell];
+
+    if (leaf(current)) {
+        Complex center(current.center_x, current.center_y);
+        Complex powers[max_fmm_order + 1];
+        // phi = sum of L(i, j) a^i conj(a)^j / (i! j!) at a = z - center, and the acceleration
+        // over G is grad phi = (2 Re dphi/dz, -2 Im dphi/dz)
+        for (uint32_t k = current.begin; k < current.end; k++) {
+            uint32_t i = _index[k];
+            Complex a = Complex(particles.x[i], particles.y[i]) - center;
+            scaledPowers(a, p, powers);
+            Complex phi = 0.0;
+            Complex dphi = 0.0;
+            for (unsigned int row_i = 0; row_i <= p; row_i++) {
+                const Complex* local = row(_locals, cell, row_i);
+                Complex across = 0.0;
+                for (unsigned int j = 0; row_i + j <= p; j++)
+                    across += local[j] * std::conj(powers[j]);
+                phi += powers[row_i] * across;
+                if (row_i > 0)
+                    dphi += powers[row_i - 1] * across;
+            }
+            sum_x[i] += 2 * dphi.real();
+            sum_y[i] -= 2 * dphi.imag();
+            sum_p[i] += phi.real();
+        }
+        return;
+    }
+
+    for (int quadrant = 0; quadrant < 4; quadrant++) {
+        int32_t child = current.child[quadrant];
+        if (child < 0)
+            continue;
+        localToLocal(cell, child);
+        downward(particles, child, sum_x, sum_y, sum_p);
+    }
+}
+
+void FmmEngine::localToLocal(int32_t parent, int32_t child) {
+    const unsigned int p = _order;
+    const Cell& from = _cells[parent];
+    const Cell& to = _cells[child];
+    Complex powers[max_fmm_order + 1];
+    scaledPowers(Complex(to.center_x - from.center_x, to.center_y - from.center_y), p, powers);
+
+    // L'(i, j) = sum over k >= i, l >= j of L(k, l) e^(k-i) conj(e)^(l-j) / ((k-i)! (l-j)!),
+    // applied as a pass over l and then one over k
+    Complex partial[(max_fmm_order + 1) * (max_fmm_order + 1)];
+    for (unsigned int k = 0; k <= p; k++) {
+        const Complex* local = row(_locals, parent, k);
+        for (unsigned int j = 0; k + j <= p; j++) {
+            Complex sum = 0.0;
+            for (unsigned int l = j; k + l <= p; l++)
+                sum += local[l] * std::conj(powers[l - j]);
+            partial[k * (p + 1) + j] = sum;
+        }
+    }
+    for (unsigned int i = 0; i <= p; i++) {
+        Complex* local = row(_locals, child, i);
+        for (unsigned int j = 0; i + j <= p; j++) {
+            Complex sum = 0.0;
+            for (unsigned int k = i; k + j <= p; k++)
+                sum += powers[k - i] * partial[k * (p + 1) + j];
+            local[j] += sum;
+        }
+    }
+}
+
+void FmmEngine::computeAccelerations(ParticleStore& particles, ThreadPool& pool) {
+    _interactions = 0;
+    build(particles);
+    if (_cells.empty())
+        return;
+    _multipoles.resize(_cells.size() * _terms);
+    _locals.assign(_cells.size() * _terms, Complex(0.0));
+
+    // Multipoles from the leaves up: each subtree on its own, then the cells above them
+    pool.parallelFor(_roots.size(), [this, &particles](size_t begin, size_t end) {
+        for (size_t r = begin; r < end; r++)
+            upward(particles, _roots[r], true);
+    });
+    for (auto cell = _upper.rbegin(); cell != _upper.rend(); ++cell)
+        upward(particles, *cell, false);
+
+    // Each subtree gathers the pull of the whole tree on its own particles and passes it down,
+    // so every thread writes only its own cells and particles
+    double* ax = particles.ax.data();
+    double* ay = particles.ay.data();
+    double* potential = particles.potential.data();
+    double softening_sqrd = _softening * _softening;
+    std::atomic<uint64_t> interactions(0);
+    pool.parallelFor(_roots.size(), [this, &particles, &interactions, ax, ay, potential,
+        softening_sqrd](size_t begin, size_t end) {
+        uint64_t chunk_interactions = 0;
+        for (size_t r = begin; r < end; r++) {
+            const Cell& root = _cells[_roots[r]];
+            for (uint32_t k = root.begin; k < root.end; k++) {
+                uint32_t i = _index[k];
+                ax[i] = 0.0;
+                ay[i] = 0.0;
+                potential[i] = 0.0;
+            }
+            chunk_interactions += interact(particles, _roots[r], 0, softening_sqrd, ax, ay,
+                potential);
+            downward(particles, _roots[r], ax, ay, potential);
+            for (uint32_t k = root.begin; k < root.end; k++) {
+                uint32_t i = _index[k];
+                ax[i] *= G;
+                ay[i] *= G;
+                potential[i] *= -G;
+            }
+        }
+        interactions.fetch_add(chunk_interactions, std::memory_order_relaxed);
+    });
+    _interactions = interactions.load();
+}
+
+std::vector<FmmAccuracy> fmmAccuracy(ParticleStore& particles, ThreadPool& pool,
+    const std::vector<unsigned int>& orders, double theta) {
+    DirectEngine direct;
+    direct.computeAccelerations(particles, pool);
+    std::vector<double> direct_x(particles.ax.begin(), particles.ax.end());
+    std::vector<double> direct_y(particles.ay.begin(), particles.ay.end());
+
+    std::vector<FmmAccuracy> accuracy;
+    for (unsigned int order : orders) {
+        FmmEngine engine(order, theta);
+        auto start = std::chrono::steady_clock::now();
+        engine.computeAccelerations(particles, pool);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        AccelerationError error = accelerationError(particles, direct_x, direct_y);
+        accuracy.push_back({order, error.rms_error, error.max_error, elapsed.count(),
+            engine.cellCount()});
+    }
+    return accuracy;
+}
+
+void writeFmmAccuracyReport(std::ostream& out, const std::vector<FmmAccuracy>& accuracy) {
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::setw(8) << "order" << std::setw(14) << "rms_error" << std::setw(14)
+        << "max_error" << std::setw(14) << "seconds" << std::setw(10) << "cells" << std::endl;
+    for (const FmmAccuracy& row : accuracy) {
+        out << std::setw(8) << row.order << std::scientific << std::setprecision(3)
+            << std::setw(14) << row.rms_error << std::setw(14) << row.max_error
+            << std::setw(14) << row.seconds << std::setw(10) << row.cells << std::endl;
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
+
+}  // namespace NB
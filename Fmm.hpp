@@ -0,0 +1,144 @@
+// Copyright 2024 Samuel Stanley
+
+#pragma once
+
+#include <complex>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "ForceEngine.hpp"
+#include "ParticleStore.hpp"
+#include "ThreadPool.hpp"
+
+namespace NB {
+
+// Highest expansion order an FmmEngine accepts
+constexpr unsigned int max_fmm_order = 20;
+
+// O(N) approximation of the gravitational accelerations by the fast multipole method on a 2D
+// quadtree. With z = x + iy, the 1/|z - w| potential of the particles in a cell is expanded
+// about the cell's center in powers of z and its conjugate up to total order p (the multipole
+// expansion), translated into the local expansion of every cell far enough away and passed
+// down the tree to the particles. Two cells are far enough apart when the sum of their radii is
+// below theta times the distance between their centers, and the error falls off like
+// theta^(p+1). Particles of cells that are not far enough apart are summed directly, and only
+// those sums are softened. Every translation costs O(p^3), since the derivatives of 1/|z|
+// split into a product of a power of z and a power of its conjugate
+class FmmEngine : public ForceEngine {
+ public:
+    // Construct an FmmEngine with expansion order order, separation ratio theta and at most
+    // leaf_size particles per leaf cell. If order is 0 or above max_fmm_order, theta is not
+    // in (0, 1) or leaf_size is 0, std::invalid_argument is thrown
+    explicit FmmEngine(unsigned int order = 6, double theta = 0.5, size_t leaf_size = 32);
+
+    void computeAccelerations(ParticleStore& particles, ThreadPool& pool) override;
+
+    std::string name() const override { return "fmm"; }
+
+    // Return the expansion order
+    unsigned int order() const { return _order; }
+
+    // Return the separation ratio
+    double theta() const { return _theta; }
+
+    // Return the number of cells in the tree built by the last call to computeAccelerations
+    size_t cellCount() const { return _cells.size(); }
+
+ private:
+    using Complex = std::complex<double>;
+
+    struct Cell {
+        double center_x;     // Center of the square region the cell covers, and of its expansions
+        double center_y;
+        double half;         // Half the width of the region
+        double radius;       // Distance from the center to the farthest particle below the cell
+        uint32_t begin;      // The cell's particles are _index[begin, end)
+        uint32_t end;
+        int32_t child[4];    // Index of each quadrant's cell, or -1
+    };
+
+    // Add a cell covering the square at (center_x, center_y) holding _index[begin, end) and
+    // return its index
+    int32_t addCell(double center_x, double center_y, double half, uint32_t begin, uint32_t end);
+
+    // Sort the particles of cell into its quadrants and add a child cell for each quadrant
+    // holding any, down to leaves of at most _leafSize particles
+    void split(const ParticleStore& particles, int32_t cell, int depth);
+
+    // Build the tree from every particle in the store and choose the subtrees the work is split
+    // over, which depend only on the tree so results do not depend on the number of threads
+    void build(const ParticleStore& particles);
+
+    // Return if cell has no children
+    bool leaf(const Cell& cell) const { return cell.child[0] < 0 && cell.child[1] < 0
+        && cell.child[2] < 0 && cell.child[3] < 0; }
+
+    // Return a pointer to the coefficient (k, 0) of the expansion in coefficients for cell;
+    // coefficient (k, l) follows it at l, for k + l <= p
+    Complex* row(std::vector<Complex>& coefficients, int32_t cell, unsigned int k) {
+        return coefficients.data() + cell * _terms + _rowOffset[k];
+    }
+    const Complex* row(const std::vector<Complex>& coefficients, int32_t cell,
+        unsigned int k) const {
+        return coefficients.data() + cell * _terms + _rowOffset[k];
+    }
+
+    // Compute the multipole expansion and radius of cell from its particles or children, and
+    // those of every cell below it if below is set
+    void upward(const ParticleStore& particles, int32_t cell, bool below);
+
+    // Add the pull of the particles of source to the targets below target, either through
+    // target's local expansion or by splitting the larger of the two, and return the number of
+    // translations and particle pairs evaluated
+    uint64_t interact(const ParticleStore& particles, int32_t target, int32_t source,
+        double softening_sqrd, double* sum_x, double* sum_y, double* sum_p);
+
+    // Add the multipole expansion of child, moved to the center of parent, to parent's
+    void multipoleToMultipole(int32_t child, int32_t parent);
+
+    // Translate the multipole expansion of source into the local expansion of target
+    void multipoleToLocal(int32_t source, int32_t target);
+
+    // Add the local expansion of parent, moved to the center of child, to child's
+    void localToLocal(int32_t parent, int32_t child);
+
+    // Pass the local expansion of cell down to its children, or to its particles if it is a
+    // leaf, and so on for every cell below it
+    void downward(const ParticleStore& particles, int32_t cell, double* sum_x, double* sum_y,
+        double* sum_p);
+
+    unsigned int _order;
+    double _theta;
+    size_t _leafSize;
+    size_t _terms;                        // Coefficients per expansion
+    std::vector<size_t> _rowOffset;       // Offset of coefficient (k, 0) in an expansion
+    std::vector<double> _derivative;      // d^n/dz^n z^(-1/2) = _derivative[n] z^(-1/2 - n)
+    std::vector<Cell> _cells;
+    std::vector<uint32_t> _index;         // Particle indices, with every cell's contiguous
+    std::vector<uint32_t> _scratch;
+    std::vector<int32_t> _roots;          // Disjoint subtrees the work is split over
+    std::vector<int32_t> _upper;          // Cells above the roots, parents first
+    std::vector<Complex> _multipoles;
+    std::vector<Complex> _locals;
+};
+
+// Error of the FMM accelerations for one expansion order against direct summation
+struct FmmAccuracy {
+    unsigned int order;
+    double rms_error;      // RMS of |a_fmm - a_direct| divided by the RMS of |a_direct|
+    double max_error;      // Largest |a_fmm - a_direct| divided by the RMS of |a_direct|
+    double seconds;        // Time to compute the FMM accelerations once
+    size_t cells;          // Cells in the tree
+};
+
+// Compare the FMM accelerations with separation ratio theta for every expansion order in
+// orders against direct summation of the particles in the store. The store's accelerations are
+// overwritten
+std::vector<FmmAccuracy> fmmAccuracy(ParticleStore& particles, ThreadPool& pool,
+    const std::vector<unsigned int>& orders, double theta);
+
+// Write accuracy as a table with one row per expansion order
+void writeFmmAccuracyReport(std::ostream& out, const std::vector<FmmAccuracy>& accuracy);
+
+}  // namespace NB
@@ -0,0 +1,171 @@
+// Copyright 2024 Samuel Stanley
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <ios>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "ForceEngine.hpp"
+#include "SmallKernels.hpp"
+
+namespace NB {
+
+void ForceEngine::setSoftening(double length) {
+    if (!(length >= 0))
+        throw std::invalid_argument("Error: softening must not be negative");
+    _softening = length;
+}
+
+// Fewest particles worth splitting across threads in the direct force pass
+constexpr size_t parallel_force_threshold = 64;
+
+std::string precisionName(Precision precision) {
+    return precision == Precision::Mixed ? "mixed" : "double";
+}
+
+Precision precisionFromName(const std::string& name) {
+    for (Precision precision : {Precision::Double, Precision::Mixed}) {
+        if (precisionName(precision) == name)
+            return precision;
+    }
+    throw std::invalid_argument("Error: unknown precision '" + name + "'");
+}
+
+DirectEngine::DirectEngine(KernelIsa isa, Precision precision)
+    : _isa(isa), _precision(precision) {
+    if (!isaSupported(isa))
+        throw std::invalid_argument("Error: instruction set '" + isaName(isa) +
+            "' is not supported by this CPU");
+}
+
+void DirectEngine::computeAccelerations(ParticleStore& particles, ThreadPool& pool) {
+    double softening_sqrd = _softening * _softening;
+    _interactions = particles.size() > 0 ? particles.size() * (particles.size() - 1) : 0;
+    // A few particles are faster on one thread with the pair loops unrolled, whatever _isa is
+    if (SmallKernels small = smallKernels(particles.size())) {
+        small.forces(particles, softening_sqrd);
+        return;
+    }
+
+    // Every row of accelerations is computed independently from the positions and masses, so
+    // each thread writes only its own rows and no accumulator is shared
+    double* ax = particles.ax.data();
+    double* ay = particles.ay.data();
+    double* potential = particles.potential.data();
+    if (mixed(particles)) {
+        MixedForceKernel kernel = mixedForceKernel(_isa);
+        const FloatParticles& floats = _floats;
+        pool.parallelFor(particles.size(), [&floats, kernel, ax, ay, potential, softening_sqrd](
+            size_t begin, size_t end) {
+            kernel(floats, begin, end, ax, ay, potential, softening_sqrd);
+        }, parallel_force_threshold);
+        return;
+    }
+    ForceKernel kernel = forceKernel(_isa);
+    pool.parallelFor(particles.size(), [&particles, kernel, ax, ay, potential, softening_sqrd](
+        size_t begin, size_t end) {
+        kernel(particles, begin, end, ax, ay, potential, softening_sqrd);
+    }, parallel_force_threshold);
+}
+
+void DirectEngine::computeActiveAccelerations(ParticleStore& particles, ThreadPool& pool,
+    const std::vector<size_t>& active) {
+    double* ax = particles.ax.data();
+    double* ay = particles.ay.data();
+    double* potential = particles.potential.data();
+    double softening_sqrd = _softening * _softening;
+    _interactions = particles.size() > 0 ? active.size() * (particles.size() - 1) : 0;
+    if (mixed(particles)) {
+        MixedForceKernel kernel = mixedForceKernel(_isa);
+        const FloatParticles& floats = _floats;
+        pool.parallelFor(active.size(), [&floats, &active, kernel, ax, ay, potential,
+            softening_sqrd](size_t begin, size_t end) {
+            for (size_t k = begin; k < end; k++)
+                kernel(floats, active[k], active[k] + 1, ax, ay, potential, softening_sqrd);
+        }, parallel_force_threshold);
+        return;
+    }
+    ForceKernel kernel = forceKernel(_isa);
+    pool.parallelFor(active.size(), [&particles, &active, kernel, ax, ay, potential,
+        softening_sqrd](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; k++)
+            kernel(particles, active[k], active[k] + 1, ax, ay, potential, softening_sqrd);
+    }, parallel_force_threshold);
+}
+
+bool DirectEngine::mixed(const ParticleStore& particles) {
+    if (_precision != Precision::Mixed || particles.size() <= max_small_n)
+        return false;
+    _floats.assign(particles);
+    return true;
+}
+
+AccelerationError accelerationError(const ParticleStore& particles,
+    const std::vector<double>& exact_x, const std::vector<double>& exact_y) {
+    size_t n = particles.size();
+    double error_sqrd = 0.0;
+    double exact_sqrd = 0.0;
+    double max_error_sqrd = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        double ex = particles.ax[i] - exact_x[i];
+        double ey = particles.ay[i] - exact_y[i];
+        error_sqrd += (ex * ex) + (ey * ey);
+        exact_sqrd += (exact_x[i] * exact_x[i]) + (exact_y[i] * exact_y[i]);
+        max_error_sqrd = std::max(max_error_sqrd, (ex * ex) + (ey * ey));
+    }
+    if (exact_sqrd <= 0)
+        return {0.0, 0.0};
+    return {std::sqrt(error_sqrd / exact_sqrd), std::sqrt(max_error_sqrd * n / exact_sqrd)};
+}
+
+PrecisionAccuracy mixedPrecisionAccuracy(ParticleStore& particles, ThreadPool& pool,
+    double softening) {
+    size_t n = particles.size();
+    double seconds[2];
+    std::vector<double> exact_x, exact_y, exact_p;
+    for (Precision precision : {Precision::Double, Precision::Mixed}) {
+        DirectEngine engine(detectIsa(), precision);
+        engine.setSoftening(softening);
+        auto start = std::chrono::steady_clock::now();
+        engine.computeAccelerations(particles, pool);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        seconds[static_cast<int>(precision)] = elapsed.count();
+        if (precision == Precision::Double) {
+            exact_x.assign(particles.ax.begin(), particles.ax.end());
+            exact_y.assign(particles.ay.begin(), particles.ay.end());
+            exact_p.assign(particles.potential.begin(), particles.potential.end());
+        }
+    }
+
+    AccelerationError error = accelerationError(particles, exact_x, exact_y);
+    double error_sqrd = 0.0;
+    double exact_sqrd = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        double e = particles.potential[i] - exact_p[i];
+        error_sqrd += e * e;
+        exact_sqrd += exact_p[i] * exact_p[i];
+    }
+    double potential_error = exact_sqrd > 0 ? std::sqrt(error_sqrd / exact_sqrd) : 0.0;
+    return {error.rms_error, error.max_error, potential_error, seconds[0], seconds[1]};
+}
+
+void writePrecisionReport(std::ostream& out, const PrecisionAccuracy& accuracy) {
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::setw(10) << "precision" << std::setw(14) << "rms_error" << std::setw(14)
+        << "max_error" << std::setw(16) << "potential_error" << std::setw(14) << "seconds"
+        << std::endl;
+    out << std::scientific << std::setprecision(3);
+    out << std::setw(10) << "double" << std::setw(14) << 0.0 << std::setw(14) << 0.0
+        << std::setw(16) << 0.0 << std::setw(14) << accuracy.double_seconds << std::endl;
+    out << std::setw(10) << "mixed" << std::setw(14) << accuracy.rms_error << std::setw(14)
+        << accuracy.max_error << std::setw(16) << accuracy.potential_error << std::setw(14)
+        << accuracy.mixed_seconds << std::endl;
+    out.flags(flags);
+    out.precision(precision);
+}
+
+}  // namespace NB
@@ -0,0 +1,124 @@
+// Copyright 2024 Samuel Stanley
+
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "ParticleStore.hpp"
+#include "ForceKernels.hpp"
+#include "ThreadPool.hpp"
+
+namespace NB {
+
+// A method of computing the gravitational acceleration of every particle in a ParticleStore.
+// Universe holds one and can swap it at runtime
+class ForceEngine {
+ public:
+    virtual ~ForceEngine() = default;
+
+    // Compute the acceleration of every particle from every other particle and store it in
+    // particles.ax and particles.ay, and the potential at every particle in particles.potential,
+    // running on the threads of pool
+    virtual void computeAccelerations(ParticleStore& particles, ThreadPool& pool) = 0;
+
+    // Compute the acceleration and potential of only the particles listed in active and store
+    // them. Those of the other particles may also be updated; by default every acceleration is
+    // recomputed
+    virtual void computeActiveAccelerations(ParticleStore& particles, ThreadPool& pool,
+        const std::vector<size_t>& active) {
+        computeAccelerations(particles, pool);
+    }
+
+    // Return the name of the engine as given on the command line
+    virtual std::string name() const = 0;
+
+    // Return the number of particle-particle (or particle-node) interactions the last
+    // computation evaluated
+    uint64_t interactions() const { return _interactions; }
+
+    // Set the Plummer softening length in meters: every interaction at distance r is computed
+    // as if at sqrt(r^2 + length^2). 0 (the default) is exact Newtonian gravity. If length is
+    // negative, std::invalid_argument is thrown
+    void setSoftening(double length);
+
+    // Return the softening length in meters
+    double softening() const { return _softening; }
+
+ protected:
+    uint64_t _interactions = 0;
+    double _softening = 0.0;
+};
+
+// Arithmetic of the direct force pass: all double, or float pair terms from float positions
+// relative to a double reference origin, added to double sums
+enum class Precision { Double, Mixed };
+
+// Return the name of precision ("double" or "mixed")
+std::string precisionName(Precision precision);
+
+// Return the precision called name. If there is none, std::invalid_argument is thrown
+Precision precisionFromName(const std::string& name);
+
+// Exact O(N^2) summation over every pair using the all-pairs kernel for one instruction set, or
+// the kernel specialized for the number of particles if there are at most max_small_n
+class DirectEngine : public ForceEngine {
+ public:
+    // Construct a DirectEngine using the kernel compiled for isa with precision. Mixed
+    // precision applies above max_small_n particles, below which the double kernels are faster
+    // anyway. If the CPU does not support isa, std::invalid_argument is thrown
+    explicit DirectEngine(KernelIsa isa = detectIsa(), Precision precision = Precision::Double);
+
+    void computeAccelerations(ParticleStore& particles, ThreadPool& pool) override;
+
+    void computeActiveAccelerations(ParticleStore& particles, ThreadPool& pool,
+        const std::vector<size_t>& active) override;
+
+    std::string name() const override { return "direct"; }
+
+    // Return the instruction set of the kernel in use
+    KernelIsa isa() const { return _isa; }
+
+    // Return the precision of the force pass
+    Precision precision() const { return _precision; }
+
+ private:
+    // Return if the force pass on particles runs in mixed precision, after updating _floats
+    bool mixed(const ParticleStore& particles);
+
+    KernelIsa _isa;
+    Precision _precision;
+    FloatParticles _floats;
+};
+
+// Error of approximate accelerations against exact ones, measured against the RMS exact
+// acceleration, since a particle whose pulls nearly cancel (like a central mass) has a
+// meaningless relative error
+struct AccelerationError {
+    double rms_error;      // RMS of |a - a_exact| divided by the RMS of |a_exact|
+    double max_error;      // Largest |a - a_exact| divided by the RMS of |a_exact|
+};
+
+// Return the error of particles.ax and particles.ay against exact_x and exact_y
+AccelerationError accelerationError(const ParticleStore& particles,
+    const std::vector<double>& exact_x, const std::vector<double>& exact_y);
+
+// Error of the mixed precision direct force pass against the double one
+struct PrecisionAccuracy {
+    double rms_error;          // Of the accelerations, as in AccelerationError
+    double max_error;
+    double potential_error;    // RMS of |p - p_double| divided by the RMS of |p_double|
+    double double_seconds;     // Time to compute the accelerations once in each precision
+    double mixed_seconds;
+};
+
+// Compare the mixed precision direct accelerations and potentials of the particles in the store
+// with softening against the double ones. The store's accelerations are overwritten
+PrecisionAccuracy mixedPrecisionAccuracy(ParticleStore& particles, ThreadPool& pool,
+    double softening);
+
+// Write accuracy as a table with one row for each precision
+void writePrecisionReport(std::ostream& out, const PrecisionAccuracy& accuracy);
+
+}  // namespace NB
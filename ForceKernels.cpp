@@ -0,0 +1,504 @@
+// Copyright 2024 Samuel Stanley
+
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "ForceKernels.hpp"
+#include "Constants.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace NB {
+
+namespace {
+
+// Add the acceleration on particle i from particles [j_begin, n) to (sum_x, sum_y) and the
+// potential to sum_p, all divided by G and Plummer softened by softening_sqrd. This is the
+// reference the vector kernels are checked against and also finishes their remainder lanes
+inline void accumulateScalar(const ParticleStore& particles, size_t i, size_t j_begin,
+    double softening_sqrd, double& sum_x, double& sum_y, double& sum_p) {
+    const double* x = particles.x.data();
+    const double* y = particles.y.data();
+    const double* mass = particles.mass.data();
+    size_t n = particles.size();
+
+    for (size_t j = j_begin; j < n; j++) {
+        double dx = x[j] - x[i];
+        double dy = y[j] - y[i];
+        double distance_sqrd = (dx * dx) + (dy * dy);
+        if (distance_sqrd == 0.0)
+            continue;
+        double softened = distance_sqrd + softening_sqrd;
+        double inv_r3 = 1.0 / (softened * std::sqrt(softened));
+        sum_x += dx * mass[j] * inv_r3;
+        sum_y += dy * mass[j] * inv_r3;
+        // m / r from the same terms, so the accelerations are unchanged
+        sum_p += mass[j] * inv_r3 * softened;
+    }
+}
+
+void kernelScalar(const ParticleStore& particles, size_t begin, size_t end,
+    double* ax, double* ay, double* potential, double softening_sqrd) {
+    for (size_t i = begin; i < end; i++) {
+        double sum_x = 0.0;
+        double sum_y = 0.0;
+        double sum_p = 0.0;
+        accumulateScalar(particles, i, 0, softening_sqrd, sum_x, sum_y, sum_p);
+        ax[i] = G * sum_x;
+        ay[i] = G * sum_y;
+        potential[i] = -G * sum_p;
+    }
+}
+
+// The vector kernels use x86 intrinsics; elsewhere only the scalar kernel is built
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("sse2")))
+void kernelSSE2(const ParticleStore& particles, size_t begin, size_t end,
+    double* ax, double* ay, double* potential, double softening_sqrd) {
+    const double* x = particles.x.data();
+    const double* y = particles.y.data();
+    const double* mass = particles.mass.data();
+    size_t n = particles.size();
+    size_t n_vec = n - n % 2;
+    const __m128d zero = _mm_setzero_pd();
+    const __m128d one = _mm_set1_pd(1.0);
+    const __m128d eps2 = _mm_set1_pd(softening_sqrd);
+
+    for (size_t i = begin; i < end; i++) {
+        __m128d xi = _mm_set1_pd(x[i]);
+        __m128d yi = _mm_set1_pd(y[i]);
+        __m128d sum_x = zero;
+        __m128d sum_y = zero;
+        __m128d sum_p = zero;
+        for (size_t j = 0; j < n_vec; j += 2) {
+            __m128d dx = _mm_sub_pd(_mm_load_pd(x + j), xi);
+            __m128d dy = _mm_sub_pd(_mm_load_pd(y + j), yi);
+            __m128d r2 = _mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy));
+            __m128d soft = _mm_add_pd(r2, eps2);
+            __m128d inv_r3 = _mm_div_pd(one, _mm_mul_pd(soft, _mm_sqrt_pd(soft)));
+            // Zero the lanes where the particles coincide
+            __m128d s = _mm_and_pd(_mm_mul_pd(_mm_load_pd(mass + j), inv_r3),
+                _mm_cmpneq_pd(r2, zero));
+            sum_x = _mm_add_pd(sum_x, _mm_mul_pd(dx, s));
+            sum_y = _mm_add_pd(sum_y, _mm_mul_pd(dy, s));
+            sum_p = _mm_add_pd(sum_p, _mm_mul_pd(soft, s));
+        }
+        alignas(16) double lanes_x[2];
+        alignas(16) double lanes_y[2];
+        alignas(16) double lanes_p[2];
+        _mm_store_pd(lanes_x, sum_x);
+        _mm_store_pd(lanes_y, sum_y);
+        _mm_store_pd(lanes_p, sum_p);
+        double total_x = lanes_x[0] + lanes_x[1];
+        double total_y = lanes_y[0] + lanes_y[1];
+        double total_p = lanes_p[0] + lanes_p[1];
+        accumulateScalar(particles, i, n_vec, softening_sqrd, total_x, total_y, total_p);
+        ax[i] = G * total_x;
+        ay[i] = G * total_y;
+        potential[i] = -G * total_p;
+    }
+}
+
+__attribute__((target("avx2")))
+void kernelAVX2(const ParticleStore& particles, size_t begin, size_t end,
+    double* ax, double* ay, double* potential, double softening_sqrd) {
+    const double* x = particles.x.data();
+    const double* y = particles.y.data();
+    const double* mass = particles.mass.data();
+    size_t n = particles.size();
+    size_t n_vec = n - n % 4;
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d eps2 = _mm256_set1_pd(softening_sqrd);
+
+    for (size_t i = begin; i < end; i++) {
+        __m256d xi = _mm256_set1_pd(x[i]);
+        __m256d yi = _mm256_set1_pd(y[i]);
+        __m256d sum_x = zero;
+        __m256d sum_y = zero;
+        __m256d sum_p = zero;
+        for (size_t j = 0; j < n_vec; j += 4) {
+            __m256d dx = _mm256_sub_pd(_mm256_load_pd(x + j), xi);
+            __m256d dy = _mm256_sub_pd(_mm256_load_pd(y + j), yi);
+            __m256d r2 = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+            __m256d soft = _mm256_add_pd(r2, eps2);
+            __m256d inv_r3 = _mm256_div_pd(one, _mm256_mul_pd(soft, _mm256_sqrt_pd(soft)));
+            // Zero the lanes where the particles coincide
+            __m256d s = _mm256_and_pd(_mm256_mul_pd(_mm256_load_pd(mass + j), inv_r3),
+                _mm256_cmp_pd(r2, zero, _CMP_NEQ_OQ));
+            sum_x = _mm256_add_pd(sum_x, _mm256_mul_pd(dx, s));
+            sum_y = _mm256_add_pd(sum_y, _mm256_mul_pd(dy, s));
+            sum_p = _mm256_add_pd(sum_p, _mm256_mul_pd(soft, s));
+        }
+        alignas(32) double lanes_x[4];
+        alignas(32) double lanes_y[4];
+        alignas(32) double lanes_p[4];
+        _mm256_store_pd(lanes_x, sum_x);
+        _mm256_store_pd(lanes_y, sum_y);
+        _mm256_store_pd(lanes_p, sum_p);
+        double total_x = (lanes_x[0] + lanes_x[1]) + (lanes_x[2] + lanes_x[3]);
+        double total_y = (lanes_y[0] + lanes_y[1]) + (lanes_y[2] + lanes_y[3]);
+        double total_p = (lanes_p[0] + lanes_p[1]) + (lanes_p[2] + lanes_p[3]);
+        accumulateScalar(particles, i, n_vec, softening_sqrd, total_x, total_y, total_p);
+        ax[i] = G * total_x;
+        ay[i] = G * total_y;
+        potential[i] = -G * total_p;
+    }
+}
+
+__attribute__((target("avx512f")))
+void kernelAVX512(const ParticleStore& particles, size_t begin, size_t end,
+    double* ax, double* ay, double* potential, double softening_sqrd) {
+    const double* x = particles.x.data();
+    const double* y = particles.y.data();
+    const double* mass = particles.mass.data();
+    size_t n = particles.size();
+    size_t n_vec = n - n % 8;
+    const __m512d zero = _mm512_setzero_pd();
+    const __m512d one = _mm512_set1_pd(1.0);
+    const __m512d eps2 = _mm512_set1_pd(softening_sqrd);
+
+    for (size_t i = begin; i < end; i++) {
+        __m512d xi = _mm512_set1_pd(x[i]);
+        __m512d yi = _mm512_set1_pd(y[i]);
+        __m512d sum_x = zero;
+        __m512d sum_y = zero;
+        __m512d sum_p = zero;
+        for (size_t j = 0; j < n_vec; j += 8) {
+            __m512d dx = _mm512_sub_pd(_mm512_load_pd(x + j), xi);
+            __m512d dy = _mm512_sub_pd(_mm512_load_pd(y + j), yi);
+            __m512d r2 = _mm512_add_pd(_mm512_mul_pd(dx, dx), _mm512_mul_pd(dy, dy));
+            __m512d soft = _mm512_add_pd(r2, eps2);
+            __m512d inv_r3 = _mm512_div_pd(one, _mm512_mul_pd(soft, _mm512_sqrt_pd(soft)));
+            // Only accumulate the lanes where the particles do not coincide
+            __mmask8 apart = _mm512_cmp_pd_mask(r2, zero, _CMP_NEQ_OQ);
+            __m512d s = _mm512_maskz_mul_pd(apart, _mm512_load_pd(mass + j), inv_r3);
+            sum_x = _mm512_add_pd(sum_x, _mm512_mul_pd(dx, s));
+            sum_y = _mm512_add_pd(sum_y, _mm512_mul_pd(dy, s));
+            sum_p = _mm512_add_pd(sum_p, _mm512_mul_pd(soft, s));
+        }
+        alignas(64) double lanes_x[8];
+        alignas(64) double lanes_y[8];
+        alignas(64) double lanes_p[8];
+        _mm512_store_pd(lanes_x, sum_x);
+        _mm512_store_pd(lanes_y, sum_y);
+        _mm512_store_pd(lanes_p, sum_p);
+        double total_x = ((lanes_x[0] + lanes_x[1]) + (lanes_x[2] + lanes_x[3]))
+            + ((lanes_x[4] + lanes_x[5]) + (lanes_x[6] + lanes_x[7]));
+        double total_y = ((lanes_y[0] + lanes_y[1]) + (lanes_y[2] + lanes_y[3]))
+            + ((lanes_y[4] + lanes_y[5]) + (lanes_y[6] + lanes_y[7]));
+        double total_p = ((lanes_p[0] + lanes_p[1]) + (lanes_p[2] + lanes_p[3]))
+            + ((lanes_p[4] + lanes_p[5]) + (lanes_p[6] + lanes_p[7]));
+        accumulateScalar(particles, i, n_vec, softening_sqrd, total_x, total_y, total_p);
+        ax[i] = G * total_x;
+        ay[i] = G * total_y;
+        potential[i] = -G * total_p;
+    }
+}
+#endif
+
+// Scale factors between the float units of a FloatParticles and SI units
+struct MixedScale {
+    float softening_sqrd;      // In float units
+    double acceleration;       // SI acceleration per unit of the acceleration sums
+    double potential;          // SI potential per unit of the potential sums
+};
+
+MixedScale mixedScale(const FloatParticles& particles, double softening_sqrd) {
+    double length_sqrd = particles.length * particles.length;
+    return {static_cast<float>(softening_sqrd / length_sqrd),
+        G * particles.mass_unit / length_sqrd, -G * particles.mass_unit / particles.length};
+}
+
+// Add the acceleration on particle i from particles [j_begin, n) to (sum_x, sum_y) and the
+// potential to sum_p in float units, each term computed in float and added in double. This is
+// the reference the vector mixed kernels are checked against and finishes their remainder lanes
+inline void accumulateMixed(const FloatParticles& particles, size_t i, size_t j_begin,
+    float softening_sqrd, double& sum_x, double& sum_y, double& sum_p) {
+    const float* x = particles.x.data();
+    const float* y = particles.y.data();
+    const float* mass = particles.mass.data();
+    size_t n = particles.size();
+
+    for (size_t j = j_begin; j < n; j++) {
+        float dx = x[j] - x[i];
+        float dy = y[j] - y[i];
+        float distance_sqrd = (dx * dx) + (dy * dy);
+        if (distance_sqrd == 0.0f)
+            continue;
+        float softened = distance_sqrd + softening_sqrd;
+        float s = mass[j] / (softened * std::sqrt(softened));
+        sum_x += dx * s;
+        sum_y += dy * s;
+        sum_p += softened * s;
+    }
+}
+
+void mixedScalar(const FloatParticles& particles, size_t begin, size_t end,
+    double* ax, double* ay, double* potential, double softening_sqrd) {
+    MixedScale scale = mixedScale(particles, softening_sqrd);
+    for (size_t i = begin; i < end; i++) {
+        double sum_x = 0.0;
+        double sum_y = 0.0;
+        double sum_p = 0.0;
+        accumulateMixed(particles, i, 0, scale.softening_sqrd, sum_x, sum_y, sum_p);
+        ax[i] = scale.acceleration * sum_x;
+        ay[i] = scale.acceleration * sum_y;
+        potential[i] = scale.potential * sum_p;
+    }
+}
+
+// Likewise only on x86
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("sse2")))
+void mixedSSE2(const FloatParticles& particles, size_t begin, size_t end,
+    double* ax, double* ay, double* potential, double softening_sqrd) {
+    MixedScale scale = mixedScale(particles, softening_sqrd);
+    const float* x = particles.x.data();
+    const float* y = particles.y.data();
+    const float* mass = particles.mass.data();
+    size_t n = particles.size();
+    size_t n_vec = n - n % 4;
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 eps2 = _mm_set1_ps(scale.softening_sqrd);
+
+    for (size_t i = begin; i < end; i++) {
+        __m128 xi = _mm_set1_ps(x[i]);
+        __m128 yi = _mm_set1_ps(y[i]);
+        // Each sum is kept in double as its low and high pair of lanes
+        __m128d sum_x[2] = {_mm_setzero_pd(), _mm_setzero_pd()};
+        __m128d sum_y[2] = {_mm_setzero_pd(), _mm_setzero_pd()};
+        __m128d sum_p[2] = {_mm_setzero_pd(), _mm_setzero_pd()};
+        for (size_t j = 0; j < n_vec; j += 4) {
+            __m128 dx = _mm_sub_ps(_mm_load_ps(x + j), xi);
+            __m128 dy = _mm_sub_ps(_mm_load_ps(y + j), yi);
+            __m128 r2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+            __m128 soft = _mm_add_ps(r2, eps2);
+            // Zero the lanes where the particles coincide
+            __m128 s = _mm_and_ps(_mm_div_ps(_mm_load_ps(mass + j),
+                _mm_mul_ps(soft, _mm_sqrt_ps(soft))), _mm_cmpneq_ps(r2, zero));
+            __m128 term_x = _mm_mul_ps(dx, s);
+            __m128 term_y = _mm_mul_ps(dy, s);
+            __m128 term_p = _mm_mul_ps(soft, s);
+            sum_x[0] = _mm_add_pd(sum_x[0], _mm_cvtps_pd(term_x));
+            sum_x[1] = _mm_add_pd(sum_x[1], _mm_cvtps_pd(_mm_movehl_ps(term_x, term_x)));
+            sum_y[0] = _mm_add_pd(sum_y[0], _mm_cvtps_pd(term_y));
+            sum_y[1] = _mm_add_pd(sum_y[1], _mm_cvtps_pd(_mm_movehl_ps(term_y, term_y)));
+            sum_p[0] = _mm_add_pd(sum_p[0], _mm_cvtps_pd(term_p));
+            sum_p[1] = _mm_add_pd(sum_p[1], _mm_cvtps_pd(_mm_movehl_ps(term_p, term_p)));
+        }
+        alignas(16) double lanes[3][2];
+        _mm_store_pd(lanes[0], _mm_add_pd(sum_x[0], sum_x[1]));
+        _mm_store_pd(lanes[1], _mm_add_pd(sum_y[0], sum_y[1]));
+        _mm_store_pd(lanes[2], _mm_add_pd(sum_p[0], sum_p[1]));
+        double total_x = lanes[0][0] + lanes[0][1];
+        double total_y = lanes[1][0] + lanes[1][1];
+        double total_p = lanes[2][0] + lanes[2][1];
+        accumulateMixed(particles, i, n_vec, scale.softening_sqrd, total_x, total_y, total_p);
+        ax[i] = scale.acceleration * total_x;
+        ay[i] = scale.acceleration * total_y;
+        potential[i] = scale.potential * total_p;
+    }
+}
+
+__attribute__((target("avx2")))
+void mixedAVX2(const FloatParticles& particles, size_t begin, size_t end,
+    double* ax, double* ay, double* potential, double softening_sqrd) {
+    MixedScale scale = mixedScale(particles, softening_sqrd);
+    const float* x = particles.x.data();
+    const float* y = particles.y.data();
+    const float* mass = particles.mass.data();
+    size_t n = particles.size();
+    size_t n_vec = n - n % 8;
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 eps2 = _mm256_set1_ps(scale.softening_sqrd);
+
+    for (size_t i = begin; i < end; i++) {
+        __m256 xi = _mm256_set1_ps(x[i]);
+        __m256 yi = _mm256_set1_ps(y[i]);
+        // Each sum is kept in double as its low and high four lanes
+        __m256d sum_x[2] = {_mm256_setzero_pd(), _mm256_setzero_pd()};
+        __m256d sum_y[2] = {_mm256_setzero_pd(), _mm256_setzero_pd()};
+        __m256d sum_p[2] = {_mm256_setzero_pd(), _mm256_setzero_pd()};
+        for (size_t j = 0; j < n_vec; j += 8) {
+            __m256 dx = _mm256_sub_ps(_mm256_load_ps(x + j), xi);
+            __m256 dy = _mm256_sub_ps(_mm256_load_ps(y + j), yi);
+            __m256 r2 = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+            __m256 soft = _mm256_add_ps(r2, eps2);
+            // Zero the lanes where the particles coincide
+            __m256 s = _mm256_and_ps(_mm256_div_ps(_mm256_load_ps(mass + j),
+                _mm256_mul_ps(soft, _mm256_sqrt_ps(soft))), _mm256_cmp_ps(r2, zero, _CMP_NEQ_OQ));
+            __m256 term_x = _mm256_mul_ps(dx, s);
+            __m256 term_y = _mm256_mul_ps(dy, s);
+            __m256 term_p = _mm256_mul_ps(soft, s);
+            sum_x[0] = _mm256_add_pd(sum_x[0], _mm256_cvtps_pd(_mm256_castps256_ps128(term_x)));
+            sum_x[1] = _mm256_add_pd(sum_x[1], _mm256_cvtps_pd(_mm256_extractf128_ps(term_x, 1)));
+            sum_y[0] = _mm256_add_pd(sum_y[0], _mm256_cvtps_pd(_mm256_castps256_ps128(term_y)));
+            sum_y[1] = _mm256_add_pd(sum_y[1], _mm256_cvtps_pd(_mm256_extractf128_ps(term_y, 1)));
+            sum_p[0] = _mm256_add_pd(sum_p[0], _mm256_cvtps_pd(_mm256_castps256_ps128(term_p)));
+            sum_p[1] = _mm256_add_pd(sum_p[1], _mm256_cvtps_pd(_mm256_extractf128_ps(term_p, 1)));
+        }
+        alignas(32) double lanes[3][4];
+        _mm256_store_pd(lanes[0], _mm256_add_pd(sum_x[0], sum_x[1]));
+        _mm256_store_pd(lanes[1], _mm256_add_pd(sum_y[0], sum_y[1]));
+        _mm256_store_pd(lanes[2], _mm256_add_pd(sum_p[0], sum_p[1]));
+        double total_x = (lanes[0][0] + lanes[0][1]) + (lanes[0][2] + lanes[0][3]);
+        double total_y = (lanes[1][0] + lanes[1][1]) + (lanes[1][2] + lanes[1][3]);
+        double total_p = (lanes[2][0] + lanes[2][1]) + (lanes[2][2] + lanes[2][3]);
+        accumulateMixed(particles, i, n_vec, scale.softening_sqrd, total_x, total_y, total_p);
+        ax[i] = scale.acceleration * total_x;
+        ay[i] = scale.acceleration * total_y;
+        potential[i] = scale.potential * total_p;
+    }
+}
+
+__attribute__((target("avx512f")))
+void mixedAVX512(const FloatParticles& particles, size_t begin, size_t end,
+    double* ax, double* ay, double* potential, double softening_sqrd) {
+    MixedScale scale = mixedScale(particles, softening_sqrd);
+    const float* x = particles.x.data();
+    const float* y = particles.y.data();
+    const float* mass = particles.mass.data();
+    size_t n = particles.size();
+    size_t n_vec = n - n % 16;
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 eps2 = _mm512_set1_ps(scale.softening_sqrd);
+
+    for (size_t i = begin; i < end; i++) {
+        __m512 xi = _mm512_set1_ps(x[i]);
+        __m512 yi = _mm512_set1_ps(y[i]);
+        // Each sum is kept in double as its low and high eight lanes
+        __m512d sum_x[2] = {_mm512_setzero_pd(), _mm512_setzero_pd()};
+        __m512d sum_y[2] = {_mm512_setzero_pd(), _mm512_setzero_pd()};
+        __m512d sum_p[2] = {_mm512_setzero_pd(), _mm512_setzero_pd()};
+        for (size_t j = 0; j < n_vec; j += 16) {
+            __m512 dx = _mm512_sub_ps(_mm512_load_ps(x + j), xi);
+            __m512 dy = _mm512_sub_ps(_mm512_load_ps(y + j), yi);
+            __m512 r2 = _mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy));
+            __m512 soft = _mm512_add_ps(r2, eps2);
+            // Only keep the lanes where the particles do not coincide
+            __mmask16 apart = _mm512_cmp_ps_mask(r2, zero, _CMP_NEQ_OQ);
+            __m512 s = _mm512_maskz_div_ps(apart, _mm512_load_ps(mass + j),
+                _mm512_mul_ps(soft, _mm512_sqrt_ps(soft)));
+            // Split each vector of terms into its low and high eight floats
+            __m512d term_x = _mm512_castps_pd(_mm512_mul_ps(dx, s));
+            __m512d term_y = _mm512_castps_pd(_mm512_mul_ps(dy, s));
+            __m512d term_p = _mm512_castps_pd(_mm512_mul_ps(soft, s));
+            sum_x[0] = _mm512_add_pd(sum_x[0], _mm512_cvtps_pd(_mm256_castpd_ps(
+                _mm512_castpd512_pd256(term_x))));
+            sum_x[1] = _mm512_add_pd(sum_x[1], _mm512_cvtps_pd(_mm256_castpd_ps(
+                _mm512_extractf64x4_pd(term_x, 1))));
+            sum_y[0] = _mm512_add_pd(sum_y[0], _mm512_cvtps_pd(_mm256_castpd_ps(
+                _mm512_castpd512_pd256(term_y))));
+            sum_y[1] = _mm512_add_pd(sum_y[1], _mm512_cvtps_pd(_mm256_castpd_ps(
+                _mm512_extractf64x4_pd(term_y, 1))));
+            sum_p[0] = _mm512_add_pd(sum_p[0], _mm512_cvtps_pd(_mm256_castpd_ps(
+                _mm512_castpd512_pd256(term_p))));
+            sum_p[1] = _mm512_add_pd(sum_p[1], _mm512_cvtps_pd(_mm256_castpd_ps(
+                _mm512_extractf64x4_pd(term_p, 1))));
+        }
+        alignas(64) double lanes[3][8];
+        _mm512_store_pd(lanes[0], _mm512_add_pd(sum_x[0], sum_x[1]));
+        _mm512_store_pd(lanes[1], _mm512_add_pd(sum_y[0], sum_y[1]));
+        _mm512_store_pd(lanes[2], _mm512_add_pd(sum_p[0], sum_p[1]));
+        double totals[3];
+        for (int k = 0; k < 3; k++) {
+            totals[k] = ((lanes[k][0] + lanes[k][1]) + (lanes[k][2] + lanes[k][3]))
+                + ((lanes[k][4] + lanes[k][5]) + (lanes[k][6] + lanes[k][7]));
+        }
+        accumulateMixed(particles, i, n_vec, scale.softening_sqrd, totals[0], totals[1],
+            totals[2]);
+        ax[i] = scale.acceleration * totals[0];
+        ay[i] = scale.acceleration * totals[1];
+        potential[i] = scale.potential * totals[2];
+    }
+}
+#endif
+
+}  // namespace
+
+KernelIsa detectIsa() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return KernelIsa::AVX512;
+    if (__builtin_cpu_supports("avx2"))
+        return KernelIsa::AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return KernelIsa::SSE2;
+#endif
+    return KernelIsa::Scalar;
+}
+
+bool isaSupported(KernelIsa isa) {
+    return static_cast<int>(isa) <= static_cast<int>(detectIsa());
+}
+
+std::vector<KernelIsa> supportedIsas() {
+    std::vector<KernelIsa> isas;
+    for (KernelIsa isa : {KernelIsa::Scalar, KernelIsa::SSE2, KernelIsa::AVX2, KernelIsa::AVX512}) {
+        if (isaSupported(isa))
+            isas.push_back(isa);
+    }
+    return isas;
+}
+
+ForceKernel forceKernel(KernelIsa isa) {
+#if defined(__x86_64__) || defined(__i386__)
+    switch (isa) {
+    case KernelIsa::AVX512:
+        return kernelAVX512;
+    case KernelIsa::AVX2:
+        return kernelAVX2;
+    case KernelIsa::SSE2:
+        return kernelSSE2;
+    default:
+        break;
+    }
+#endif
+    return kernelScalar;
+}
+
+MixedForceKernel mixedForceKernel(KernelIsa isa) {
+#if defined(__x86_64__) || defined(__i386__)
+    switch (isa) {
+    case KernelIsa::AVX512:
+        return mixedAVX512;
+    case KernelIsa::AVX2:
+        return mixedAVX2;
+    case KernelIsa::SSE2:
+        return mixedSSE2;
+    default:
+        break;
+    }
+#endif
+    return mixedScalar;
+}
+
+std::string isaName(KernelIsa isa) {
+    switch (isa) {
+    case KernelIsa::AVX512:
+        return "avx512";
+    case KernelIsa::AVX2:
+        return "avx2";
+    case KernelIsa::SSE2:
+        return "sse2";
+    default:
+        return "scalar";
+    }
+}
+
+KernelIsa isaFromName(const std::string& name) {
+    for (KernelIsa isa : {KernelIsa::Scalar, KernelIsa::SSE2, KernelIsa::AVX2, KernelIsa::AVX512}) {
+        if (isaName(isa) == name)
+            return isa;
+    }
+    throw std::invalid_argument("Error: unknown instruction set '" + name + "'");
+}
+
+}  // namespace NB
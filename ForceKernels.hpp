@@ -0,0 +1,51 @@
+// Copyright 2024 Samuel Stanley
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "ParticleStore.hpp"
+
+namespace NB {
+
+// Instruction sets the all-pairs gravity kernel is compiled for, from narrowest to widest
+enum class KernelIsa { Scalar, SSE2, AVX2, AVX512 };
+
+// Compute the gravitational acceleration on every particle i in [begin, end) from every other
+// particle in the store and write it to ax[i] and ay[i], and the gravitational potential there
+// to potential[i]. Particles at the same position as i (including i itself) are skipped. The
+// interactions are Plummer softened, with r^2 + softening_sqrd in place of r^2, so the pull of a
+// close pair stays finite; 0 gives exact Newtonian gravity
+using ForceKernel = void (*)(const ParticleStore& particles, size_t begin, size_t end,
+    double* ax, double* ay, double* potential, double softening_sqrd);
+
+// Compute what a ForceKernel does from the float positions and masses of particles. Every pair
+// term is computed in float, so twice as many pairs fit in a vector register, and added to
+// double sums, which are scaled back to SI units. Particles whose float positions coincide are
+// skipped
+using MixedForceKernel = void (*)(const FloatParticles& particles, size_t begin, size_t end,
+    double* ax, double* ay, double* potential, double softening_sqrd);
+
+// Return the widest instruction set supported by the CPU the program is running on. The vector
+// kernels are only built for x86, so elsewhere this is always KernelIsa::Scalar
+KernelIsa detectIsa();
+
+// Return if the CPU the program is running on supports isa
+bool isaSupported(KernelIsa isa);
+
+// Return every instruction set supported by the CPU, from narrowest to widest
+std::vector<KernelIsa> supportedIsas();
+
+// Return the all-pairs kernel compiled for isa, or the scalar kernel if none was
+ForceKernel forceKernel(KernelIsa isa);
+
+// Return the mixed precision kernel compiled for isa, or the scalar kernel if none was
+MixedForceKernel mixedForceKernel(KernelIsa isa);
+
+// Return the name of isa ("scalar", "sse2", "avx2" or "avx512")
+std::string isaName(KernelIsa isa);
+
+// Return the instruction set called name. If there is none, std::invalid_argument is thrown
+KernelIsa isaFromName(const std::string& name);
+
+}  // namespace NB
@@ -0,0 +1,197 @@
+// Copyright 2024 Samuel Stanley
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <SFML/Graphics.hpp>
+#include <SFML/OpenGL.hpp>
+#include "FrameExport.hpp"
+
+namespace NB {
+
+namespace {
+
+// Image formats sf::Image can encode, by file extension
+const char* const image_extensions[] = {".bmp", ".png", ".tga", ".jpg", ".jpeg"};
+
+}  // namespace
+
+std::string frameFileName(const std::string& pattern, uint64_t frame) {
+    // One % followed by up to two digits of width and a d
+    size_t percent = pattern.find('%');
+    size_t end = percent == std::string::npos ? pattern.size() : percent + 1;
+    while (end < pattern.size() && end - percent <= 2 &&
+        std::isdigit(static_cast<unsigned char>(pattern[end])))
+        end++;
+    if (end >= pattern.size() || pattern[end] != 'd' ||
+        pattern.find('%', end) != std::string::npos)
+        throw std::invalid_argument("Error: image sequence '" + pattern +
+            "' must have one %d or %0Nd field");
+
+    std::string number = std::to_string(frame);
+    std::string width = pattern.substr(percent + 1, end - percent - 1);
+    size_t digits = width.empty() ? 0 : std::stoul(width);
+    if (number.size() < digits)
+        number.insert(0, digits - number.size(), width[0] == '0' ? '0' : ' ');
+    return pattern.substr(0, percent) + number + pattern.substr(end + 1);
+}
+
+bool isImageSequence(const std::string& target) {
+    return target.find('%') != std::string::npos;
+}
+
+FrameExporter::FrameExporter(const std::string& target, sf::Vector2u size, unsigned int workers)
+    : _target(target), _sequence(isImageSequence(target)), _size(size), _framesAdded(0),
+    _stop(false), _finished(false) {
+    if (_sequence) {
+        std::filesystem::path first(frameFileName(target, 0));
+        std::string extension = first.extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(),
+            [](unsigned char c) { return std::tolower(c); });
+        if (std::find(std::begin(image_extensions), std::end(image_extensions), extension) ==
+            std::end(image_extensions))
+            throw std::invalid_argument("Error: image sequence '" + target +
+                "' must end in .bmp, .png, .tga or .jpg");
+        if (first.has_parent_path() && !std::filesystem::is_directory(first.parent_path()))
+            throw std::invalid_argument("Error: directory '" + first.parent_path().string() +
+                "' does not exist");
+    } else {
+        _out.open(target, std::ios::binary);
+        if (!_out)
+            throw std::invalid_argument("Error: file '" + target + "' could not be opened");
+        // Frames must reach the pipe in order
+        workers = 1;
+    }
+
+    workers = std::max(1u, workers);
+    _maxPending = 2 * workers;
+    for (unsigned int i = 0; i < workers; i++)
+        _workers.emplace_back(&FrameExporter::workerLoop, this);
+}
+
+FrameExporter::~FrameExporter() {
+    try {
+        finish();
+    } catch (const std::runtime_error&) {
+        // A destructor cannot report the failure; call finish to see it
+    }
+}
+
+void FrameExporter::add(uint64_t frame, const sf::Image& image) {
+    checkSize(image.getSize());
+    Frame entry = takeFrame(frame);
+    const sf::Uint8* pixels = image.getPixelsPtr();
+    entry.pixels.assign(pixels, pixels + entry.pixels.size());
+    queueFrame(std::move(entry));
+}
+
+void FrameExporter::add(uint64_t frame, sf::RenderTexture& target) {
+    checkSize(target.getSize());
+    Frame entry = takeFrame(frame);
+
+    // Reading back is the only work done on the rendering thread. OpenGL returns the bottom row
+    // first, so the rows are swapped in place into the top row first order of sf::Image
+    if (!target.setActive(true))
+        throw std::runtime_error("Error: the off-screen render target could not be activated");
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, _size.x, _size.y, GL_RGBA, GL_UNSIGNED_BYTE, entry.pixels.data());
+    size_t row = static_cast<size_t>(_size.x) * 4;
+    for (size_t top = 0, bottom = _size.y; top + 1 < bottom; top++, bottom--)
+        std::swap_ranges(entry.pixels.begin() + top * row, entry.pixels.begin() + (top + 1) * row,
+            entry.pixels.begin() + (bottom - 1) * row);
+    queueFrame(std::move(entry));
+}
+
+void FrameExporter::finish() {
+    if (_finished)
+        return;
+    _finished = true;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _ready.notify_all();
+    for (std::thread& worker : _workers)
+        worker.join();
+    if (!_sequence) {
+        _out.close();
+        if (_out.fail() && _failure.empty())
+            _failure = _target;
+    }
+    if (!_failure.empty())
+        throw std::runtime_error("Error: frame '" + _failure + "' could not be written");
+}
+
+void FrameExporter::workerLoop() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+        _ready.wait(lock, [this] { return _stop || !_pending.empty(); });
+        if (_pending.empty())
+            break;
+        Frame frame = std::move(_pending.front());
+        _pending.pop_front();
+        _space.notify_one();
+
+        lock.unlock();
+        bool written = writeFrame(frame);
+        lock.lock();
+        if (!written && _failure.empty())
+            _failure = _sequence ? frameFileName(_target, frame.number) : _target;
+        _free.push_back(std::move(frame));
+    }
+    lock.unlock();
+    if (!_sequence)
+        _out.flush();
+}
+
+void FrameExporter::checkSize(sf::Vector2u size) const {
+    if (size.x != _size.x || size.y != _size.y)
+        throw std::invalid_argument("Error: frame is " + std::to_string(size.x) + "x" +
+            std::to_string(size.y) + ", not " + std::to_string(_size.x) + "x" +
+            std::to_string(_size.y));
+}
+
+FrameExporter::Frame FrameExporter::takeFrame(uint64_t frame) {
+    Frame entry;
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _space.wait(lock, [this] { return _pending.size() < _maxPending; });
+        if (!_free.empty()) {
+            entry = std::move(_free.back());
+            _free.pop_back();
+        }
+    }
+    entry.number = frame;
+    entry.pixels.resize(static_cast<size_t>(_size.x) * _size.y * 4);
+    return entry;
+}
+
+void FrameExporter::queueFrame(Frame frame) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _pending.push_back(std::move(frame));
+    }
+    _ready.notify_one();
+    _framesAdded++;
+}
+
+bool FrameExporter::writeFrame(const Frame& frame) {
+    if (!_sequence) {
+        _out.write(reinterpret_cast<const char*>(frame.pixels.data()), frame.pixels.size());
+        return static_cast<bool>(_out);
+    }
+
+    // Encoding, and compressing for png and jpg, is the costly part, so it runs here
+    sf::Image image;
+    image.create(_size.x, _size.y, frame.pixels.data());
+    return image.saveToFile(frameFileName(_target, frame.number));
+}
+
+}  // namespace NB
@@ -0,0 +1,102 @@
+// Copyright 2024 Samuel Stanley
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <SFML/Graphics.hpp>
+
+namespace NB {
+
+// Return the file name of frame number frame in the image sequence pattern, a file name with
+// one printf-style %d or %0Nd field such as "frames/%06d.png". If pattern has no such field or
+// any other %, std::invalid_argument is thrown
+std::string frameFileName(const std::string& pattern, uint64_t frame);
+
+// Return if target names an image sequence pattern rather than a file or named pipe for raw
+// frames, which is if it has a %
+bool isImageSequence(const std::string& target);
+
+// Writes frames rendered off screen, so a run can be made into a movie without a display. If
+// target is an image sequence pattern, each frame is encoded as an image in the format of the
+// pattern's extension (bmp, png, tga or jpg) by one of workers background threads. Otherwise
+// the raw RGBA pixels of each frame, top row first, are written one frame after another to the
+// file or named pipe target by one background thread, for an encoder such as ffmpeg to read.
+// At most two frames per worker are queued; add waits for a free slot beyond that, so a slow
+// encoder slows the run instead of filling memory
+class FrameExporter {
+ public:
+    // Export frames of size pixels to target on workers threads (at least 1; raw frames are
+    // always written by one). If target cannot be opened, is not a valid pattern or names an
+    // unsupported image format, std::invalid_argument is thrown
+    FrameExporter(const std::string& target, sf::Vector2u size, unsigned int workers);
+
+    // Write any queued frames and stop the workers
+    ~FrameExporter();
+
+    FrameExporter(const FrameExporter&) = delete;
+    FrameExporter& operator=(const FrameExporter&) = delete;
+
+    // Queue image as frame number frame, which names its file in an image sequence. If image is
+    // not of the exporter's size, std::invalid_argument is thrown
+    void add(uint64_t frame, const sf::Image& image);
+
+    // Queue the pixels of target, which must have been displayed, as frame number frame. They
+    // are read back straight into a buffer the exporter reuses, so no image is made per frame.
+    // If target is not of the exporter's size, std::invalid_argument is thrown
+    void add(uint64_t frame, sf::RenderTexture& target);
+
+    // Write every queued frame, close the output and stop the workers. If any frame could not
+    // be written, std::runtime_error is thrown
+    void finish();
+
+    // Return the number of frames added so far
+    uint64_t framesAdded() const { return _framesAdded; }
+
+ private:
+    struct Frame {
+        uint64_t number;
+        std::vector<sf::Uint8> pixels;
+    };
+
+    // Throw std::invalid_argument if size is not the exporter's size
+    void checkSize(sf::Vector2u size) const;
+
+    // Wait until fewer than _maxPending frames are queued and return a frame to fill, reusing
+    // the buffer of one already written if there is one
+    Frame takeFrame(uint64_t frame);
+
+    // Queue frame for the workers
+    void queueFrame(Frame frame);
+
+    // Write queued frames until finish is called
+    void workerLoop();
+
+    // Write frame and return if it was written
+    bool writeFrame(const Frame& frame);
+
+    std::string _target;
+    bool _sequence;
+    sf::Vector2u _size;
+    std::ofstream _out;
+    size_t _maxPending;
+    uint64_t _framesAdded;
+
+    std::mutex _mutex;
+    std::condition_variable _ready;
+    std::condition_variable _space;
+    std::deque<Frame> _pending;
+    std::vector<Frame> _free;
+    std::string _failure;       // The first frame that could not be written, or empty
+    bool _stop;
+    bool _finished;
+    std::vector<std::thread> _workers;
+};
+
+}  // namespace NB
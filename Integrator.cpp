@@ -0,0 +1,339 @@
+// Copyright 2024 Samuel Stanley
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Integrator.hpp"
+#include "SmallKernels.hpp"
+
+namespace NB {
+
+namespace {
+
+// Fewest particles worth splitting across threads in an integrator pass
+constexpr size_t parallel_integrate_threshold = 4096;
+
+// v += h * a for every particle
+void kick(ParticleStore& particles, ThreadPool& pool, double h) {
+    if (SmallKernels small = smallKernels(particles.size())) {
+        small.kick(particles, h);
+        return;
+    }
+    double* vx = particles.vx.data();
+    double* vy = particles.vy.data();
+    const double* ax = particles.ax.data();
+    const double* ay = particles.ay.data();
+    pool.parallelFor(particles.size(), [=](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            vx[i] += h * ax[i];
+            vy[i] += h * ay[i];
+        }
+    }, parallel_integrate_threshold);
+}
+
+// x += h * v for every particle
+void drift(ParticleStore& particles, ThreadPool& pool, double h) {
+    if (SmallKernels small = smallKernels(particles.size())) {
+        small.drift(particles, h);
+        return;
+    }
+    double* x = particles.x.data();
+    double* y = particles.y.data();
+    const double* vx = particles.vx.data();
+    const double* vy = particles.vy.data();
+    pool.parallelFor(particles.size(), [=](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            x[i] += h * vx[i];
+            y[i] += h * vy[i];
+        }
+    }, parallel_integrate_threshold);
+}
+
+// One kick-drift-kick leapfrog step of h that leaves the accelerations current
+void leapfrog(ParticleStore& particles, ThreadPool& pool, double h,
+    const AccelerationFunction& accelerate, bool current) {
+    if (!current)
+        accelerate(nullptr);
+    kick(particles, pool, h / 2);
+    drift(particles, pool, h);
+    accelerate(nullptr);
+    kick(particles, pool, h / 2);
+}
+
+}  // namespace
+
+void Integrator::loadState(const std::string& state) {
+    if (!state.empty())
+        throw std::invalid_argument("Error: the " + name() + " integrator has no state to load");
+}
+
+void Integrator::permute(const std::vector<size_t>&) {}
+
+bool EulerIntegrator::step(ParticleStore& particles, ThreadPool& pool, double seconds,
+    const AccelerationFunction& accelerate, bool current) {
+    // New velocity from the acceleration, then new position from it, in one pass
+    if (!current)
+        accelerate(nullptr);
+    if (SmallKernels small = smallKernels(particles.size())) {
+        small.kick(particles, seconds);
+        small.drift(particles, seconds);
+        return false;
+    }
+    double* x = particles.x.data();
+    double* y = particles.y.data();
+    double* vx = particles.vx.data();
+    double* vy = particles.vy.data();
+    const double* ax = particles.ax.data();
+    const double* ay = particles.ay.data();
+    pool.parallelFor(particles.size(), [=](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            vx[i] += seconds * ax[i];
+            vy[i] += seconds * ay[i];
+            x[i] += seconds * vx[i];
+            y[i] += seconds * vy[i];
+        }
+    }, parallel_integrate_threshold);
+    return false;
+}
+
+bool LeapfrogIntegrator::step(ParticleStore& particles, ThreadPool& pool, double seconds,
+    const AccelerationFunction& accelerate, bool current) {
+    leapfrog(particles, pool, seconds, accelerate, current);
+    return true;
+}
+
+bool Yoshida4Integrator::step(ParticleStore& particles, ThreadPool& pool, double seconds,
+    const AccelerationFunction& accelerate, bool current) {
+    // Substep weights w1, w0, w1 with 2 * w1 + w0 = 1
+    const double cbrt2 = std::cbrt(2.0);
+    const double w1 = 1.0 / (2.0 - cbrt2);
+    const double w0 = -cbrt2 / (2.0 - cbrt2);
+
+    leapfrog(particles, pool, w1 * seconds, accelerate, current);
+    leapfrog(particles, pool, w0 * seconds, accelerate, true);
+    leapfrog(particles, pool, w1 * seconds, accelerate, true);
+    return true;
+}
+
+bool RK4Integrator::step(ParticleStore& particles, ThreadPool& pool, double seconds,
+    const AccelerationFunction& accelerate, bool current) {
+    size_t n = particles.size();
+    double* x = particles.x.data();
+    double* y = particles.y.data();
+    double* vx = particles.vx.data();
+    double* vy = particles.vy.data();
+    const double* ax = particles.ax.data();
+    const double* ay = particles.ay.data();
+
+    _x0.assign(particles.x.begin(), particles.x.end());
+    _y0.assign(particles.y.begin(), particles.y.end());
+    _vx0.assign(particles.vx.begin(), particles.vx.end());
+    _vy0.assign(particles.vy.begin(), particles.vy.end());
+    _sum_x.assign(n, 0.0);
+    _sum_y.assign(n, 0.0);
+    _sum_vx.assign(n, 0.0);
+    _sum_vy.assign(n, 0.0);
+    const double* x0 = _x0.data();
+    const double* y0 = _y0.data();
+    const double* vx0 = _vx0.data();
+    const double* vy0 = _vy0.data();
+    double* sum_x = _sum_x.data();
+    double* sum_y = _sum_y.data();
+    double* sum_vx = _sum_vx.data();
+    double* sum_vy = _sum_vy.data();
+
+    // Stage k has velocity v_k (held in the store) and acceleration a(x_k). Add weight times
+    // both to the sums, then set the store to stage k + 1: x = x0 + h * v_k, v = v0 + h * a_k
+    auto stage = [=, &pool](double weight, double h) {
+        pool.parallelFor(n, [=](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                sum_x[i] += weight * vx[i];
+                sum_y[i] += weight * vy[i];
+                sum_vx[i] += weight * ax[i];
+                sum_vy[i] += weight * ay[i];
+                x[i] = x0[i] + h * vx[i];
+                y[i] = y0[i] + h * vy[i];
+                vx[i] = vx0[i] + h * ax[i];
+                vy[i] = vy0[i] + h * ay[i];
+            }
+        }, parallel_integrate_threshold);
+    };
+
+    if (!current)
+        accelerate(nullptr);
+    stage(1.0, seconds / 2);
+    accelerate(nullptr);
+    stage(2.0, seconds / 2);
+    accelerate(nullptr);
+    stage(2.0, seconds);
+    accelerate(nullptr);
+
+    // Final stage: only accumulate, then combine
+    pool.parallelFor(n, [=](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            x[i] = x0[i] + (seconds / 6) * (sum_x[i] + vx[i]);
+            y[i] = y0[i] + (seconds / 6) * (sum_y[i] + vy[i]);
+            vx[i] = vx0[i] + (seconds / 6) * (sum_vx[i] + ax[i]);
+            vy[i] = vy0[i] + (seconds / 6) * (sum_vy[i] + ay[i]);
+        }
+    }, parallel_integrate_threshold);
+    return false;
+}
+
+BlockIntegrator::BlockIntegrator(double eta, unsigned int max_level)
+    : _eta(eta), _maxLevel(max_level), _accelerationsComputed(0) {
+    if (!(eta > 0))
+        throw std::invalid_argument("Error: eta must be positive");
+    if (max_level > 30)
+        throw std::invalid_argument("Error: the block timestep level must be at most 30");
+}
+
+uint8_t BlockIntegrator::levelFor(double dt, double seconds) const {
+    if (!(dt < seconds))
+        return 0;
+    double level = std::ceil(std::log2(seconds / dt));
+    return static_cast<uint8_t>(std::min(level, static_cast<double>(_maxLevel)));
+}
+
+bool BlockIntegrator::step(ParticleStore& particles, ThreadPool& pool, double seconds,
+    const AccelerationFunction& accelerate, bool current) {
+    size_t n = particles.size();
+    if (n == 0)
+        return current;
+    double* vx = particles.vx.data();
+    double* vy = particles.vy.data();
+    const double* ax = particles.ax.data();
+    const double* ay = particles.ay.data();
+
+    // Time within this step is counted in ticks of the finest level, so every step boundary is
+    // an exact integer
+    const uint64_t ticks = uint64_t(1) << _maxLevel;
+
+    if (!current) {
+        accelerate(nullptr);
+        _accelerationsComputed += n;
+    }
+
+    // Without a previous step to take the jerk from, start from the time each particle takes to
+    // change its velocity by eta of itself. That says nothing about a particle at rest under a
+    // force, which starts at the finest level until the jerk test coarsens it
+    if (_level.size() != n) {
+        _level.resize(n);
+        for (size_t i = 0; i < n; i++) {
+            double accel = std::hypot(ax[i], ay[i]);
+            double dt = accel > 0 ? _eta * std::hypot(vx[i], vy[i]) / accel : seconds;
+            _level[i] = dt > 0 ? levelFor(dt, seconds) : _maxLevel;
+        }
+    }
+
+    // Opening half kick for every particle, remembering the acceleration it started with
+    _ax0.assign(particles.ax.begin(), particles.ax.end());
+    _ay0.assign(particles.ay.begin(), particles.ay.end());
+    for (size_t i = 0; i < n; i++) {
+        double h = std::ldexp(seconds, -_level[i]);
+        vx[i] += (h / 2) * ax[i];
+        vy[i] += (h / 2) * ay[i];
+    }
+
+    uint64_t t = 0;
+    while (t < ticks) {
+        // Drift everyone to the next time any particle's step ends
+        uint64_t next = ticks;
+        for (size_t i = 0; i < n; i++) {
+            uint64_t span = ticks >> _level[i];
+            next = std::min(next, t - t % span + span);
+        }
+        drift(particles, pool, seconds * static_cast<double>(next - t) / ticks);
+        t = next;
+
+        _active.clear();
+        for (size_t i = 0; i < n; i++) {
+            if (t % (ticks >> _level[i]) == 0)
+                _active.push_back(i);
+        }
+        accelerate(&_active);
+        _accelerationsComputed += _active.size();
+
+        for (size_t i : _active) {
+            // Closing half kick
+            double h = std::ldexp(seconds, -_level[i]);
+            vx[i] += (h / 2) * ax[i];
+            vy[i] += (h / 2) * ay[i];
+
+            // Next level from eta * |a| / |da/dt|. Refining is always allowed; coarsening only
+            // by one level, and only where the coarser step would begin
+            double jerk = std::hypot(ax[i] - _ax0[i], ay[i] - _ay0[i]) / h;
+            double accel = std::hypot(ax[i], ay[i]);
+            uint8_t level = levelFor(jerk > 0 ? _eta * accel / jerk : seconds, seconds);
+            if (level < _level[i]) {
+                level = _level[i] - 1;
+                if (t % (ticks >> level) != 0)
+                    level = _level[i];
+            }
+            _level[i] = level;
+
+            // Opening half kick of the particle's next step, unless this step is over
+            if (t < ticks) {
+                h = std::ldexp(seconds, -level);
+                vx[i] += (h / 2) * ax[i];
+                vy[i] += (h / 2) * ay[i];
+                _ax0[i] = ax[i];
+                _ay0[i] = ay[i];
+            }
+        }
+    }
+
+    // Every step ends at the final tick, so every acceleration is current
+    return true;
+}
+
+std::string BlockIntegrator::saveState() const {
+    // The acceleration evaluation count, then the level of every particle
+    std::string state(sizeof(_accelerationsComputed) + _level.size(), '\0');
+    std::memcpy(state.data(), &_accelerationsComputed, sizeof(_accelerationsComputed));
+    std::memcpy(state.data() + sizeof(_accelerationsComputed), _level.data(), _level.size());
+    return state;
+}
+
+void BlockIntegrator::loadState(const std::string& state) {
+    if (state.size() < sizeof(_accelerationsComputed))
+        throw std::invalid_argument("Error: the block integrator state is truncated");
+    std::vector<uint8_t> level(state.begin() + sizeof(_accelerationsComputed), state.end());
+    if (std::any_of(level.begin(), level.end(), [this](uint8_t l) { return l > _maxLevel; }))
+        throw std::invalid_argument("Error: the block integrator state has a level above " +
+            std::to_string(_maxLevel));
+    std::memcpy(&_accelerationsComputed, state.data(), sizeof(_accelerationsComputed));
+    _level = std::move(level);
+}
+
+void BlockIntegrator::permute(const std::vector<size_t>& order) {
+    // Levels not yet chosen for these particles are chosen on the next step anyway
+    if (_level.size() != order.size())
+        return;
+    std::vector<uint8_t> level(order.size());
+    for (size_t k = 0; k < order.size(); k++)
+        level[k] = _level[order[k]];
+    _level = std::move(level);
+}
+
+std::unique_ptr<Integrator> makeIntegrator(const std::string& name) {
+    if (name == "euler")
+        return std::make_unique<EulerIntegrator>();
+    if (name == "leapfrog")
+        return std::make_unique<LeapfrogIntegrator>();
+    if (name == "yoshida4")
+        return std::make_unique<Yoshida4Integrator>();
+    if (name == "rk4")
+        return std::make_unique<RK4Integrator>();
+    if (name == "block")
+        return std::make_unique<BlockIntegrator>();
+    throw std::invalid_argument("Error: unknown integrator " + name);
+}
+
+}  // namespace NB
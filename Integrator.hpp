@@ -0,0 +1,137 @@
+// Copyright 2024 Samuel Stanley
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "ParticleStore.hpp"
+#include "ThreadPool.hpp"
+
+namespace NB {
+
+// Recompute particles.ax and particles.ay from the current positions, for only the particles
+// listed in active, or for every particle if active is nullptr
+using AccelerationFunction = std::function<void(const std::vector<size_t>* active)>;
+
+// A scheme for advancing every particle in a ParticleStore by one timestep. Universe holds one
+// and can swap it at runtime
+class Integrator {
+ public:
+    virtual ~Integrator() = default;
+
+    // Advance the particles by seconds, calling accelerate whenever accelerations are needed at
+    // the current positions. current is whether the stored accelerations already match the
+    // current positions, so they can be reused. Return whether the stored accelerations match
+    // the positions after the step
+    virtual bool step(ParticleStore& particles, ThreadPool& pool, double seconds,
+        const AccelerationFunction& accelerate, bool current) = 0;
+
+    // Return the name of the integrator as given on the command line
+    virtual std::string name() const = 0;
+
+    // Return whatever state the integrator carries from one step to the next, as bytes, so a
+    // checkpointed run can resume exactly. By default there is none
+    virtual std::string saveState() const { return std::string(); }
+
+    // Restore state returned by saveState. If it is not valid state for this integrator,
+    // std::invalid_argument is thrown
+    virtual void loadState(const std::string& state);
+
+    // Reorder whatever per-particle state the integrator carries the way the particles were
+    // just reordered, so that particle order[k] became particle k. By default there is none
+    virtual void permute(const std::vector<size_t>& order);
+};
+
+// Semi-implicit (symplectic) Euler: kick by the full step, then drift. First order, one force
+// evaluation per step
+class EulerIntegrator : public Integrator {
+ public:
+    bool step(ParticleStore& particles, ThreadPool& pool, double seconds,
+        const AccelerationFunction& accelerate, bool current) override;
+
+    std::string name() const override { return "euler"; }
+};
+
+// Leapfrog in kick-drift-kick (velocity Verlet) form. Second order and symplectic; the force at
+// the end of one step is reused for the start of the next, so one force evaluation per step
+class LeapfrogIntegrator : public Integrator {
+ public:
+    bool step(ParticleStore& particles, ThreadPool& pool, double seconds,
+        const AccelerationFunction& accelerate, bool current) override;
+
+    std::string name() const override { return "leapfrog"; }
+};
+
+// Yoshida's fourth order symplectic composition of three leapfrog steps. Three force
+// evaluations per step, since the last one is reused by the next step
+class Yoshida4Integrator : public Integrator {
+ public:
+    bool step(ParticleStore& particles, ThreadPool& pool, double seconds,
+        const AccelerationFunction& accelerate, bool current) override;
+
+    std::string name() const override { return "yoshida4"; }
+};
+
+// Classical fourth order Runge-Kutta. Not symplectic; four force evaluations per step, the
+// first of which is reused when the stored accelerations are current
+class RK4Integrator : public Integrator {
+ public:
+    bool step(ParticleStore& particles, ThreadPool& pool, double seconds,
+        const AccelerationFunction& accelerate, bool current) override;
+
+    std::string name() const override { return "rk4"; }
+
+ private:
+    AlignedArray _x0, _y0, _vx0, _vy0;
+    AlignedArray _sum_x, _sum_y, _sum_vx, _sum_vy;
+};
+
+// Leapfrog with individual, hierarchical (block) timesteps. Each particle steps by
+// seconds / 2^level, where its level is chosen from the ratio of its acceleration to its jerk
+// (the change in acceleration over its last step) and may only change where the finer and
+// coarser step boundaries line up. Every particle drifts on the finest active step, but only the
+// particles whose step ends are kicked and have their accelerations recomputed
+class BlockIntegrator : public Integrator {
+ public:
+    // Construct a BlockIntegrator with accuracy parameter eta (smaller is more accurate) and
+    // at most max_level halvings of the step. If eta is not positive or max_level is above 30,
+    // std::invalid_argument is thrown
+    explicit BlockIntegrator(double eta = 0.02, unsigned int max_level = 12);
+
+    bool step(ParticleStore& particles, ThreadPool& pool, double seconds,
+        const AccelerationFunction& accelerate, bool current) override;
+
+    std::string name() const override { return "block"; }
+
+    std::string saveState() const override;
+
+    void loadState(const std::string& state) override;
+
+    void permute(const std::vector<size_t>& order) override;
+
+    // Return the level of every particle; particle i steps by seconds / 2^level[i]
+    const std::vector<uint8_t>& levels() const { return _level; }
+
+    // Return the total number of single-particle acceleration evaluations so far
+    uint64_t accelerationsComputed() const { return _accelerationsComputed; }
+
+ private:
+    // Return the level whose step is closest to (and no longer than) dt for a step of seconds
+    uint8_t levelFor(double dt, double seconds) const;
+
+    double _eta;
+    unsigned int _maxLevel;
+    std::vector<uint8_t> _level;
+    AlignedArray _ax0, _ay0;
+    std::vector<size_t> _active;
+    uint64_t _accelerationsComputed;
+};
+
+// Return a new integrator called name ("euler", "leapfrog", "yoshida4", "rk4" or "block", the
+// last with its default settings). If there is none, std::invalid_argument is thrown
+std::unique_ptr<Integrator> makeIntegrator(const std::string& name);
+
+}  // namespace NB
@@ -0,0 +1,197 @@
+// Copyright 2024 Samuel Stanley
+
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include "Options.hpp"
+#include "CommandLine.hpp"
+#include "BarnesHut.hpp"
+#include "Fmm.hpp"
+#include "Integrator.hpp"
+#include "Renderer.hpp"
+#include "SpaceFillingCurve.hpp"
+
+namespace NB {
+
+namespace {
+
+// Return the value following the option at argv[i] and advance i past it
+std::string optionValue(int argc, const char* const argv[], int& i) {
+    if (i + 1 >= argc)
+        throw std::invalid_argument("Error: missing value for " + std::string(argv[i]));
+    return std::string(argv[++i]);
+}
+
+// Return value, a size like "1920x1080", as its width and height
+std::pair<unsigned int, unsigned int> sizeValue(const std::string& option,
+    const std::string& value) {
+    size_t x = value.find('x');
+    if (x == std::string::npos)
+        throw std::invalid_argument("Error: " + option + " must be a size like 800x800");
+    return {positiveInteger(option, value.substr(0, x)),
+        positiveInteger(option, value.substr(x + 1))};
+}
+
+// Return the comma separated items of value
+std::vector<std::string> listItems(const std::string& value) {
+    std::vector<std::string> items;
+    std::stringstream stream(value);
+    std::string item;
+    while (std::getline(stream, item, ','))
+        items.push_back(item);
+    return items;
+}
+
+// Return text, a string of decimal digits, converted to an index
+size_t indexValue(const std::string& option, const std::string& text) {
+    if (text.empty() || text.find_first_not_of("0123456789") != std::string::npos)
+        throw std::invalid_argument("Error: " + option + " must be a list of indices");
+    return std::stoul(text);
+}
+
+// Return value, a comma separated list of indices and ranges like "0,4,10-19", as indices
+std::vector<size_t> indexList(const std::string& option, const std::string& value) {
+    std::vector<size_t> indices;
+    for (const std::string& item : listItems(value)) {
+        size_t dash = item.find('-');
+        size_t first = indexValue(option, item.substr(0, dash));
+        size_t last = dash == std::string::npos ? first : indexValue(option,
+            item.substr(dash + 1));
+        if (last < first)
+            throw std::invalid_argument("Error: " + option + " must be a list of indices");
+        for (size_t i = first; i <= last; i++)
+            indices.push_back(i);
+    }
+    return indices;
+}
+
+}  // namespace
+
+Options parseOptions(int argc, const char* const argv[]) {
+    if (argc < 3) {
+        throw std::invalid_argument("Error: insufficient command line arguments");
+    }
+
+    Options options;
+    options.T = nonNegativeReal("T", argv[1]);
+    options.dt = positiveReal("dt", argv[2]);
+
+    for (int i = 3; i < argc; i++) {
+        std::string option(argv[i]);
+        if (option == "--threads") {
+            options.threads = positiveInteger(option, optionValue(argc, argv, i));
+        } else if (option == "--engine") {
+            options.engine = optionValue(argc, argv, i);
+            if (options.engine != "direct" && options.engine != "barneshut" &&
+                options.engine != "fmm")
+                throw std::invalid_argument("Error: unknown force engine " + options.engine);
+        } else if (option == "--integrator") {
+            options.integrator = optionValue(argc, argv, i);
+            makeIntegrator(options.integrator);
+        } else if (option == "--theta") {
+            options.theta = nonNegativeReal(option, optionValue(argc, argv, i));
+        } else if (option == "--order") {
+            options.order = positiveInteger(option, optionValue(argc, argv, i));
+            if (options.order > max_fmm_order)
+                throw std::invalid_argument("Error: --order must be at most " +
+                    std::to_string(max_fmm_order));
+        } else if (option == "--softening") {
+            options.softening = nonNegativeReal(option, optionValue(argc, argv, i));
+        } else if (option == "--merge-radius") {
+            options.merge_radius = nonNegativeReal(option, optionValue(argc, argv, i));
+        } else if (option == "--reorder") {
+            options.reorder = positiveInteger(option, optionValue(argc, argv, i));
+        } else if (option == "--curve") {
+            options.curve = optionValue(argc, argv, i);
+            curveFromName(options.curve);
+        } else if (option == "--render") {
+            options.render = optionValue(argc, argv, i);
+            renderModeFromName(options.render);
+        } else if (option == "--headless") {
+            options.headless = true;
+        } else if (option == "--theta-report") {
+            options.theta_report = true;
+        } else if (option == "--order-report") {
+            options.order_report = true;
+        } else if (option == "--precision") {
+            options.precision = optionValue(argc, argv, i);
+            precisionFromName(options.precision);
+        } else if (option == "--precision-report") {
+            options.precision_report = true;
+        } else if (option == "--trajectory") {
+            options.trajectory = optionValue(argc, argv, i);
+        } else if (option == "--every") {
+            options.every = positiveInteger(option, optionValue(argc, argv, i));
+        } else if (option == "--trajectory-format") {
+            std::string format = optionValue(argc, argv, i);
+            if (format != "text" && format != "binary")
+                throw std::invalid_argument("Error: unknown trajectory format " + format);
+            options.trajectory_format = format == "binary" ? TrajectoryFormat::Binary :
+                TrajectoryFormat::Text;
+        } else if (option == "--bodies") {
+            options.bodies = indexList(option, optionValue(argc, argv, i));
+        } else if (option == "--checkpoint") {
+            options.checkpoint = optionValue(argc, argv, i);
+        } else if (option == "--checkpoint-every") {
+            options.checkpoint_every = positiveInteger(option, optionValue(argc, argv, i));
+        } else if (option == "--resume") {
+            options.resume = optionValue(argc, argv, i);
+        } else if (option == "--conserved") {
+            options.conserved = optionValue(argc, argv, i);
+        } else if (option == "--conserved-every") {
+            options.conserved_every = positiveInteger(option, optionValue(argc, argv, i));
+        } else if (option == "--drift-warn") {
+            options.drift_warn = nonNegativeReal(option, optionValue(argc, argv, i));
+        } else if (option == "--profile") {
+            options.profile = true;
+        } else if (option == "--profile-every") {
+            options.profile = true;
+            options.profile_every = positiveInteger(option, optionValue(argc, argv, i));
+        } else if (option == "--export") {
+            options.export_target = optionValue(argc, argv, i);
+        } else if (option == "--export-every") {
+            options.export_every = positiveInteger(option, optionValue(argc, argv, i));
+        } else if (option == "--export-size") {
+            std::tie(options.export_width, options.export_height) =
+                sizeValue(option, optionValue(argc, argv, i));
+        } else if (option == "--export-threads") {
+            options.export_threads = positiveInteger(option, optionValue(argc, argv, i));
+        } else if (option == "--fields") {
+            options.fields.clear();
+            for (const std::string& name : listItems(optionValue(argc, argv, i)))
+                options.fields.push_back(fieldFromName(name));
+        } else {
+            throw std::invalid_argument("Error: unknown option " + option);
+        }
+    }
+
+    // Merges renumber the particles, so the bodies of a trajectory would change under it
+    if (options.merge_radius > 0 && !options.trajectory.empty())
+        throw std::invalid_argument("Error: --merge-radius cannot be used with --trajectory");
+    if (!options.export_target.empty() && options.headless)
+        throw std::invalid_argument("Error: --export draws the particles, so it cannot be used "
+            "with --headless");
+    if (options.precision != "double" && options.engine != "direct")
+        throw std::invalid_argument("Error: --precision " + options.precision +
+            " needs --engine direct");
+
+    return options;
+}
+
+std::unique_ptr<ForceEngine> makeForceEngine(const Options& options) {
+    std::unique_ptr<ForceEngine> engine;
+    if (options.engine == "barneshut")
+        engine = std::make_unique<BarnesHutEngine>(options.theta);
+    else if (options.engine == "fmm")
+        engine = std::make_unique<FmmEngine>(options.order, options.theta);
+    else
+        engine = std::make_unique<DirectEngine>(detectIsa(), precisionFromName(options.precision));
+    engine->setSoftening(options.softening);
+    return engine;
+}
+
+}  // namespace NB
@@ -0,0 +1,130 @@
+// Copyright 2024 Samuel Stanley
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "ForceEngine.hpp"
+#include "Trajectory.hpp"
+
+namespace NB {
+
+// Settings for a run of the NBody program, read from the command line
+struct Options {
+    // Total simulation duration in seconds
+    double T = 0.0;
+
+    // Time in seconds between simulation steps
+    double dt = 0.0;
+
+    // Number of threads the force and step passes run on
+    unsigned int threads = 1;
+
+    // Name of the force engine: "direct", "barneshut" or "fmm"
+    std::string engine = "direct";
+
+    // Name of the integrator: "euler", "leapfrog", "yoshida4", "rk4" or "block"
+    std::string integrator = "euler";
+
+    // Barnes-Hut opening angle, and FMM separation ratio
+    double theta = 0.5;
+
+    // FMM expansion order
+    unsigned int order = 6;
+
+    // Plummer softening length in meters, or 0 for exact Newtonian gravity
+    double softening = 0.0;
+
+    // Distance in meters below which particles are merged after each step, or 0 for never
+    double merge_radius = 0.0;
+
+    // Number of steps between reorders of the particle storage along a space-filling curve, or
+    // 0 for never
+    unsigned int reorder = 0;
+
+    // Curve the particle storage is reordered along: "hilbert" or "morton"
+    std::string curve = "hilbert";
+
+    // How particles are drawn: "sprites" or "points"
+    std::string render = "sprites";
+
+    // Run without a window, textures or sprites, as fast as possible
+    bool headless = false;
+
+    // Print the Barnes-Hut accuracy for a range of opening angles instead of simulating
+    bool theta_report = false;
+
+    // Print the FMM accuracy for a range of expansion orders instead of simulating
+    bool order_report = false;
+
+    // Precision of the direct force pass: "double" or "mixed"
+    std::string precision = "double";
+
+    // Print the error of the mixed precision force pass against the double one instead of
+    // simulating
+    bool precision_report = false;
+
+    // File or named pipe to stream trajectory frames to, or empty for none
+    std::string trajectory;
+
+    // Number of steps between trajectory frames
+    unsigned int every = 1;
+
+    // Format trajectory frames are written in
+    TrajectoryFormat trajectory_format = TrajectoryFormat::Text;
+
+    // Indices of the bodies to record in the trajectory, or empty for every body
+    std::vector<size_t> bodies;
+
+    // Fields to record in the trajectory
+    std::vector<TrajectoryField> fields = {TrajectoryField::X, TrajectoryField::Y,
+        TrajectoryField::VX, TrajectoryField::VY};
+
+    // File to write checkpoints to, or empty for none
+    std::string checkpoint;
+
+    // Number of steps between checkpoints
+    unsigned int checkpoint_every = 1000;
+
+    // Checkpoint file to continue a run from instead of reading stdin, or empty for none
+    std::string resume;
+
+    // File to log the energy, momenta and angular momentum to, or empty for none
+    std::string conserved;
+
+    // Number of steps between conserved quantity log rows
+    unsigned int conserved_every = 100;
+
+    // Relative energy drift beyond which a warning is printed, or 0 for none
+    double drift_warn = 0.0;
+
+    // Time each phase of the run and print the breakdown to stderr at exit
+    bool profile = false;
+
+    // Number of steps between profile reports during the run, or 0 for only at exit
+    unsigned int profile_every = 0;
+
+    // Image sequence pattern or file or named pipe for raw frames to render the run to off
+    // screen, without a window, or empty for none
+    std::string export_target;
+
+    // Number of steps between exported frames
+    unsigned int export_every = 1;
+
+    // Size in pixels of exported frames
+    unsigned int export_width = 800;
+    unsigned int export_height = 800;
+
+    // Number of threads encoding exported images
+    unsigned int export_threads = 2;
+};
+
+// Read Options from the command line. The first two arguments are T and dt, followed by any
+// optional "--name value" settings. If the arguments are invalid, std::invalid_argument is thrown
+Options parseOptions(int argc, const char* const argv[]);
+
+// Construct the force engine chosen in options, with its softening
+std::unique_ptr<ForceEngine> makeForceEngine(const Options& options);
+
+}  // namespace NB
@@ -0,0 +1,97 @@
+// Copyright 2024 Samuel Stanley
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "ParticleStore.hpp"
+
+namespace NB {
+
+void ParticleStore::reserve(size_t n) {
+    for (AlignedArray* array : {&x, &y, &vx, &vy, &mass, &ax, &ay, &potential})
+        array->reserve(n);
+}
+
+void ParticleStore::resize(size_t n) {
+    for (AlignedArray* array : {&x, &y, &vx, &vy, &mass, &ax, &ay, &potential})
+        array->resize(n, 0.0);
+}
+
+void ParticleStore::clear() {
+    for (AlignedArray* array : {&x, &y, &vx, &vy, &mass, &ax, &ay, &potential})
+        array->clear();
+}
+
+void ParticleStore::append(const ParticleStore& other) {
+    AlignedArray* arrays[] = {&x, &y, &vx, &vy, &mass, &ax, &ay, &potential};
+    const AlignedArray* others[] = {&other.x, &other.y, &other.vx, &other.vy, &other.mass,
+        &other.ax, &other.ay, &other.potential};
+    for (size_t k = 0; k < 8; k++)
+        arrays[k]->insert(arrays[k]->end(), others[k]->begin(), others[k]->end());
+}
+
+size_t ParticleStore::add(double px, double py, double pvx, double pvy, double m) {
+    x.push_back(px);
+    y.push_back(py);
+    vx.push_back(pvx);
+    vy.push_back(pvy);
+    mass.push_back(m);
+    ax.push_back(0.0);
+    ay.push_back(0.0);
+    potential.push_back(0.0);
+    return size() - 1;
+}
+
+void ParticleStore::keep(const std::vector<size_t>& indices) {
+    // indices[k] >= k, so each array can be compacted in place from the front
+    for (AlignedArray* array : {&x, &y, &vx, &vy, &mass, &ax, &ay, &potential}) {
+        for (size_t k = 0; k < indices.size(); k++)
+            (*array)[k] = (*array)[indices[k]];
+        array->resize(indices.size());
+    }
+}
+
+void ParticleStore::permute(const std::vector<size_t>& order) {
+    AlignedArray permuted(order.size());
+    for (AlignedArray* array : {&x, &y, &vx, &vy, &mass, &ax, &ay, &potential}) {
+        for (size_t k = 0; k < order.size(); k++)
+            permuted[k] = (*array)[order[k]];
+        array->swap(permuted);
+    }
+}
+
+void FloatParticles::assign(const ParticleStore& particles) {
+    const size_t n = particles.size();
+    x.resize(n);
+    y.resize(n);
+    mass.resize(n);
+    if (n == 0)
+        return;
+
+    double min_x = particles.x[0], max_x = particles.x[0];
+    double min_y = particles.y[0], max_y = particles.y[0];
+    double max_mass = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        min_x = std::min(min_x, particles.x[i]);
+        max_x = std::max(max_x, particles.x[i]);
+        min_y = std::min(min_y, particles.y[i]);
+        max_y = std::max(max_y, particles.y[i]);
+        max_mass = std::max(max_mass, std::abs(particles.mass[i]));
+    }
+    origin_x = min_x + (max_x - min_x) / 2;
+    origin_y = min_y + (max_y - min_y) / 2;
+    length = std::max(max_x - min_x, max_y - min_y) / 2;
+    if (!(length > 0))
+        length = 1.0;
+    mass_unit = max_mass > 0 ? max_mass : 1.0;
+
+    const double inv_length = 1.0 / length;
+    const double inv_mass = 1.0 / mass_unit;
+    for (size_t i = 0; i < n; i++) {
+        x[i] = static_cast<float>((particles.x[i] - origin_x) * inv_length);
+        y[i] = static_cast<float>((particles.y[i] - origin_y) * inv_length);
+        mass[i] = static_cast<float>(particles.mass[i] * inv_mass);
+    }
+}
+
+}  // namespace NB
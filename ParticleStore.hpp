@@ -0,0 +1,113 @@
+// Copyright 2024 Samuel Stanley
+
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+namespace NB {
+
+// Alignment in bytes of every ParticleStore array (one cache line, one AVX-512 register)
+constexpr size_t particle_alignment = 64;
+
+// Allocator returning memory aligned to Alignment bytes so kernels can use aligned loads
+template <typename T, size_t Alignment = particle_alignment>
+class AlignedAllocator {
+ public:
+    using value_type = T;
+
+    template <typename U>
+    struct rebind { using other = AlignedAllocator<U, Alignment>; };
+
+    AlignedAllocator() noexcept = default;
+
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) noexcept {}  // NOLINT
+
+    // Allocate space for n objects of type T
+    T* allocate(size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+    }
+
+    // Free space previously returned by allocate
+    void deallocate(T* p, size_t) noexcept {
+        ::operator delete(p, std::align_val_t(Alignment));
+    }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const noexcept { return true; }
+
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U, Alignment>&) const noexcept { return false; }
+};
+
+// A contiguous, aligned array of doubles
+using AlignedArray = std::vector<double, AlignedAllocator<double>>;
+
+// A contiguous, aligned array of floats
+using AlignedFloatArray = std::vector<float, AlignedAllocator<float>>;
+
+// Structure-of-arrays storage of the physical state of every particle in a Universe. Element i
+// of every array belongs to particle i. The physics kernels run only on this store
+struct ParticleStore {
+    AlignedArray x;
+    AlignedArray y;
+    AlignedArray vx;
+    AlignedArray vy;
+    AlignedArray mass;
+    AlignedArray ax;
+    AlignedArray ay;
+    // Gravitational potential at each particle, written with the accelerations by a full force
+    // pass, so the potential energy is half the sum of mass * potential
+    AlignedArray potential;
+
+    // Return the number of particles in the store
+    size_t size() const { return x.size(); }
+
+    // Reserve space for n particles in every array
+    void reserve(size_t n);
+
+    // Resize every array to n particles. New particles are zeroed
+    void resize(size_t n);
+
+    // Remove every particle
+    void clear();
+
+    // Append every particle of other, in order
+    void append(const ParticleStore& other);
+
+    // Append a particle with the given state and zero acceleration and return its index
+    size_t add(double px = 0, double py = 0, double pvx = 0, double pvy = 0, double m = 0);
+
+    // Keep only the particles at indices, which must be increasing, so particle indices[k]
+    // becomes particle k
+    void keep(const std::vector<size_t>& indices);
+
+    // Reorder the particles so particle order[k] becomes particle k. order must hold every index
+    // exactly once
+    void permute(const std::vector<size_t>& order);
+};
+
+// The positions and masses of the particles of a ParticleStore as floats, for the mixed
+// precision kernels. Positions are stored relative to a reference origin kept in double, in
+// units of length, and masses in units of mass_unit, so every pair term of the gravity kernels
+// fits in a float whatever the scale of the universe
+struct FloatParticles {
+    AlignedFloatArray x;
+    AlignedFloatArray y;
+    AlignedFloatArray mass;
+    double origin_x = 0.0;
+    double origin_y = 0.0;
+    double length = 1.0;
+    double mass_unit = 1.0;
+
+    // Return the number of particles
+    size_t size() const { return x.size(); }
+
+    // Set from the positions and masses of particles, with the origin at the center of their
+    // bounding box, length half its longer side and mass_unit the largest mass
+    void assign(const ParticleStore& particles);
+};
+
+}  // namespace NB
@@ -0,0 +1,107 @@
+// Copyright 2024 Samuel Stanley
+
+#include <chrono>
+#include <iomanip>
+#include <ios>
+#include <iostream>
+#include <string>
+#include "Profiler.hpp"
+
+namespace NB {
+
+namespace {
+
+// Return a monotonic time in nanoseconds
+uint64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}  // namespace
+
+std::string phaseName(Phase phase) {
+    switch (phase) {
+    case Phase::Forces:
+        return "forces";
+    case Phase::Integration:
+        return "integration";
+    case Phase::Lookup:
+        return "lookup";
+    case Phase::Render:
+        return "render";
+    case Phase::Input:
+        return "input";
+    default:
+        return "output";
+    }
+}
+
+Profiler::Profiler() : _enabled(false) {
+    reset();
+}
+
+double Profiler::seconds(Phase phase) const {
+    return _nanoseconds[static_cast<size_t>(phase)].load(std::memory_order_relaxed) * 1e-9;
+}
+
+uint64_t Profiler::calls(Phase phase) const {
+    return _calls[static_cast<size_t>(phase)].load(std::memory_order_relaxed);
+}
+
+uint64_t Profiler::counter(Counter counter) const {
+    return _counters[static_cast<size_t>(counter)].load(std::memory_order_relaxed);
+}
+
+void Profiler::reset() {
+    for (size_t p = 0; p < num_phases; p++) {
+        _nanoseconds[p].store(0, std::memory_order_relaxed);
+        _calls[p].store(0, std::memory_order_relaxed);
+    }
+    for (size_t c = 0; c < num_counters; c++)
+        _counters[c].store(0, std::memory_order_relaxed);
+}
+
+void Profiler::writeReport(std::ostream& out, double wall_seconds) const {
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::setw(12) << "phase" << std::setw(14) << "seconds" << std::setw(10) << "share"
+        << std::setw(14) << "calls" << std::endl;
+    for (size_t p = 0; p < num_phases; p++) {
+        Phase phase = static_cast<Phase>(p);
+        double share = wall_seconds > 0 ? 100 * seconds(phase) / wall_seconds : 0.0;
+        out << std::setw(12) << phaseName(phase) << std::scientific << std::setprecision(3)
+            << std::setw(14) << seconds(phase) << std::fixed << std::setprecision(1)
+            << std::setw(9) << share << '%' << std::setw(14) << calls(phase) << std::endl;
+    }
+
+    // Rates are per second of wall time, so they include everything outside the phases too
+    double per_second = wall_seconds > 0 ? 1 / wall_seconds : 0.0;
+    out << std::scientific << std::setprecision(3) << "wall " << wall_seconds << " s, "
+        << counter(Counter::Steps) << " steps (" << counter(Counter::Steps) * per_second
+        << " per second), " << counter(Counter::Interactions) << " interactions ("
+        << counter(Counter::Interactions) * per_second << " per second), "
+        << counter(Counter::Frames) << " frames (" << counter(Counter::Frames) * per_second
+        << " per second)" << std::endl;
+    out.flags(flags);
+    out.precision(precision);
+}
+
+thread_local ScopedTimer* ScopedTimer::_current = nullptr;
+
+void ScopedTimer::start(Phase phase) {
+    _phase = phase;
+    _parent = _current;
+    _current = this;
+    _nested = 0;
+    _start = now();
+}
+
+void ScopedTimer::stop() {
+    uint64_t elapsed = now() - _start;
+    _profiler->add(_phase, elapsed - _nested);
+    if (_parent)
+        _parent->_nested += elapsed;
+    _current = _parent;
+}
+
+}  // namespace NB
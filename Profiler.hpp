@@ -0,0 +1,107 @@
+// Copyright 2024 Samuel Stanley
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+namespace NB {
+
+// The parts of a run time is charged to
+enum class Phase { Forces, Integration, Lookup, Render, Input, Output };
+constexpr size_t num_phases = 6;
+
+// Events counted during a run
+enum class Counter { Steps, Interactions, Frames };
+constexpr size_t num_counters = 3;
+
+// Return the name of phase as printed in reports
+std::string phaseName(Phase phase);
+
+// Accumulates the time spent in each Phase and the Counters of a run. While disabled, timers
+// and counters cost one branch. Times and counts may be added from any thread
+class Profiler {
+ public:
+    Profiler();
+
+    Profiler(const Profiler&) = delete;
+    Profiler& operator=(const Profiler&) = delete;
+
+    // Start or stop collecting. Collected values are kept
+    void setEnabled(bool enabled) { _enabled = enabled; }
+
+    // Return if times and counts are being collected
+    bool enabled() const { return _enabled; }
+
+    // Charge nanoseconds and one call to phase
+    void add(Phase phase, uint64_t nanoseconds) {
+        _nanoseconds[static_cast<size_t>(phase)].fetch_add(nanoseconds, std::memory_order_relaxed);
+        _calls[static_cast<size_t>(phase)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Add n to counter if enabled
+    void count(Counter counter, uint64_t n = 1) {
+        if (_enabled)
+            _counters[static_cast<size_t>(counter)].fetch_add(n, std::memory_order_relaxed);
+    }
+
+    // Return the seconds charged to phase
+    double seconds(Phase phase) const;
+
+    // Return the number of timed calls charged to phase
+    uint64_t calls(Phase phase) const;
+
+    // Return the value of counter
+    uint64_t counter(Counter counter) const;
+
+    // Set every time and count back to zero
+    void reset();
+
+    // Write the time, share of wall_seconds and calls of every phase, then the steps,
+    // interactions and frames per second over wall_seconds
+    void writeReport(std::ostream& out, double wall_seconds) const;
+
+ private:
+    bool _enabled;
+    std::atomic<uint64_t> _nanoseconds[num_phases];
+    std::atomic<uint64_t> _calls[num_phases];
+    std::atomic<uint64_t> _counters[num_counters];
+};
+
+// Charges the time from its construction to its destruction to a phase of a Profiler, if the
+// Profiler is enabled. Time spent in timers nested inside it on the same thread is charged only
+// to theirs, so each phase's time excludes the phases it calls
+class ScopedTimer {
+ public:
+    ScopedTimer(Profiler& profiler, Phase phase)
+        : _profiler(profiler.enabled() ? &profiler : nullptr) {
+        if (_profiler)
+            start(phase);
+    }
+
+    ~ScopedTimer() {
+        if (_profiler)
+            stop();
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+ private:
+    void start(Phase phase);
+    void stop();
+
+    Profiler* _profiler;
+    Phase _phase;
+    ScopedTimer* _parent;
+    uint64_t _start;
+    uint64_t _nested;
+
+    // The innermost running timer on each thread
+    static thread_local ScopedTimer* _current;
+};
+
+}  // namespace NB
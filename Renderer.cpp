@@ -0,0 +1,149 @@
+// Copyright 2024 Samuel Stanley
+
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <SFML/Graphics.hpp>
+#include "Renderer.hpp"
+#include "Universe.hpp"
+#include "CelestialBody.hpp"
+
+namespace NB {
+
+RenderMode renderModeFromName(const std::string& name) {
+    if (name == "sprites")
+        return RenderMode::Sprites;
+    if (name == "points")
+        return RenderMode::Points;
+    throw std::invalid_argument("Error: unknown render mode " + name);
+}
+
+void BatchRenderer::group(const Universe& universe, const std::vector<uint32_t>& textures,
+    uint64_t layout) {
+    std::map<const sf::Texture*, size_t> batch_of;
+    _batches.clear();
+    for (size_t i = 0; i < textures.size(); i++) {
+        const sf::Texture* texture = universe.texture(textures[i]);
+        if (!texture)
+            continue;
+        auto [entry, added] = batch_of.emplace(texture, _batches.size());
+        if (added)
+            _batches.push_back({texture, {}, sf::VertexArray(sf::Triangles)});
+        _batches[entry->second].particles.push_back(i);
+    }
+    _layout = layout;
+}
+
+void BatchRenderer::build(const Universe& universe, sf::Vector2u size) {
+    build(universe, universe.particles().x.data(), universe.particles().y.data(), size);
+}
+
+void BatchRenderer::build(const Universe& universe, const double* x, const double* y,
+    sf::Vector2u size) {
+    if (_mode == RenderMode::Sprites && _layout != universe.layout()) {
+        std::vector<uint32_t> textures(universe.numPlanets());
+        // By storage order, which the positions are in
+        for (size_t i = 0; i < textures.size(); i++)
+            textures[universe[i].index()] = universe[i].textureIndex();
+        group(universe, textures, universe.layout());
+    }
+    fill(universe.radius(), universe.numPlanets(), x, y, size);
+}
+
+void BatchRenderer::build(const Universe& universe, const PositionFrame& frame,
+    sf::Vector2u size) {
+    if (_mode == RenderMode::Sprites && _layout != frame.layout)
+        group(universe, frame.textures, frame.layout);
+    fill(universe.radius(), frame.x.size(), frame.x.data(), frame.y.data(), size);
+}
+
+void BatchRenderer::fill(double radius, size_t num_particles, const double* x, const double* y,
+    sf::Vector2u size) {
+    // Viewport position = position * scale + offset, as in CelestialBody::draw
+    const double scale_x = (size.x / 2.0) / radius;
+    const double scale_y = -(size.y / 2.0) / radius;
+    const double offset_x = size.x / 2.0;
+    const double offset_y = size.y / 2.0;
+
+    if (_mode == RenderMode::Points) {
+        _points.setPrimitiveType(sf::Points);
+        _points.resize(num_particles);
+        for (size_t i = 0; i < num_particles; i++) {
+            _points[i].position = sf::Vector2f(x[i] * scale_x + offset_x,
+                y[i] * scale_y + offset_y);
+            _points[i].color = sf::Color::White;
+        }
+        return;
+    }
+
+    for (Batch& batch : _batches) {
+        // Two triangles per particle, centred on it like a sprite with its origin at the centre
+        sf::Vector2u texture_size = batch.texture->getSize();
+        const float width = texture_size.x;
+        const float height = texture_size.y;
+        const float half_width = width / 2;
+        const float half_height = height / 2;
+        batch.vertices.resize(batch.particles.size() * 6);
+        for (size_t k = 0; k < batch.particles.size(); k++) {
+            size_t i = batch.particles[k];
+            sf::Vector2f centre(x[i] * scale_x + offset_x, y[i] * scale_y + offset_y);
+            sf::Vertex* quad = &batch.vertices[k * 6];
+            sf::Vector2f top_left(centre.x - half_width, centre.y - half_height);
+            sf::Vector2f top_right(centre.x + half_width, centre.y - half_height);
+            sf::Vector2f bottom_right(centre.x + half_width, centre.y + half_height);
+            sf::Vector2f bottom_left(centre.x - half_width, centre.y + half_height);
+            quad[0] = sf::Vertex(top_left, sf::Vector2f(0, 0));
+            quad[1] = sf::Vertex(top_right, sf::Vector2f(width, 0));
+            quad[2] = sf::Vertex(bottom_right, sf::Vector2f(width, height));
+            quad[3] = sf::Vertex(top_left, sf::Vector2f(0, 0));
+            quad[4] = sf::Vertex(bottom_right, sf::Vector2f(width, height));
+            quad[5] = sf::Vertex(bottom_left, sf::Vector2f(0, height));
+        }
+    }
+}
+
+void BatchRenderer::draw(const Universe& universe, const double* x, const double* y,
+    sf::RenderTarget& target, sf::RenderStates states) {
+    build(universe, x, y, target.getSize());
+    submit(target, states);
+}
+
+void BatchRenderer::draw(const Universe& universe, const PositionFrame& frame,
+    sf::RenderTarget& target, sf::RenderStates states) {
+    build(universe, frame, target.getSize());
+    submit(target, states);
+}
+
+void BatchRenderer::submit(sf::RenderTarget& target, sf::RenderStates states) {
+    _drawCalls = 0;
+    if (_mode == RenderMode::Points) {
+        target.draw(_points, states);
+        _drawCalls++;
+        return;
+    }
+    for (const Batch& batch : _batches) {
+        states.texture = batch.texture;
+        target.draw(batch.vertices, states);
+        _drawCalls++;
+    }
+}
+
+size_t BatchRenderer::vertexCount() const {
+    if (_mode == RenderMode::Points)
+        return _points.getVertexCount();
+    size_t count = 0;
+    for (const Batch& batch : _batches)
+        count += batch.vertices.getVertexCount();
+    return count;
+}
+
+const sf::VertexArray* BatchRenderer::vertices(const sf::Texture* texture) const {
+    for (const Batch& batch : _batches) {
+        if (batch.texture == texture)
+            return &batch.vertices;
+    }
+    return nullptr;
+}
+
+}  // namespace NB
@@ -0,0 +1,105 @@
+// Copyright 2024 Samuel Stanley
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <SFML/Graphics.hpp>
+#include "ForwardDeclarations.hpp"
+
+namespace NB {
+
+// How the particles of a Universe are drawn: as their textures, or as one pixel each for very
+// large numbers of particles
+enum class RenderMode { Sprites, Points };
+
+// Return the render mode called name ("sprites" or "points"). If there is none,
+// std::invalid_argument is thrown
+RenderMode renderModeFromName(const std::string& name);
+
+// The positions of every particle of a Universe at one step, handed from the thread stepping it
+// to the thread drawing it
+struct PositionFrame {
+    uint64_t step = 0;
+    double time = 0.0;
+    std::vector<double> x;
+    std::vector<double> y;
+    // The texture table index of every particle, copied only when layout changes
+    uint64_t layout = 0;
+    std::vector<uint32_t> textures;
+};
+
+// Draws every particle of a Universe in a handful of draw calls. In Sprites mode the particles
+// are grouped by texture once, and each frame one vertex array of textured quads is built and
+// drawn per texture. In Points mode a single array of points is drawn
+class BatchRenderer {
+ public:
+    BatchRenderer() : _mode(RenderMode::Sprites), _layout(0), _drawCalls(0) {}
+
+    // Draw particles as mode from now on
+    void setMode(RenderMode mode) { _mode = mode; }
+
+    // Return how particles are drawn
+    RenderMode mode() const { return _mode; }
+
+    // Forget the grouping of particles by texture. Changes to the Universe's layout are noticed
+    // without it
+    void invalidate() { _layout = 0; }
+
+    // Fill the vertex arrays with every particle of universe, placed for a target of size like
+    // CelestialBody::draw places its sprite
+    void build(const Universe& universe, sf::Vector2u size);
+
+    // Fill the vertex arrays with every particle of universe as if particle i were at (x[i], y[i])
+    void build(const Universe& universe, const double* x, const double* y, sf::Vector2u size);
+
+    // Fill the vertex arrays with the particles of frame, taking only the radius and textures
+    // from universe, so the Universe may be stepped meanwhile
+    void build(const Universe& universe, const PositionFrame& frame, sf::Vector2u size);
+
+    // Build the vertex arrays for target with particle i at (x[i], y[i]) and draw them
+    void draw(const Universe& universe, const double* x, const double* y,
+        sf::RenderTarget& target, sf::RenderStates states);
+
+    // Build the vertex arrays for target from frame and draw them
+    void draw(const Universe& universe, const PositionFrame& frame, sf::RenderTarget& target,
+        sf::RenderStates states);
+
+    // Return the number of draw calls the last draw made
+    size_t drawCalls() const { return _drawCalls; }
+
+    // Return the total number of vertices built by the last build
+    size_t vertexCount() const;
+
+    // Return the vertex array built for texture, or nullptr if no particle uses it
+    const sf::VertexArray* vertices(const sf::Texture* texture) const;
+
+ private:
+    // The particles sharing one texture and the triangles drawing them
+    struct Batch {
+        const sf::Texture* texture;
+        std::vector<size_t> particles;
+        sf::VertexArray vertices;
+    };
+
+    // Group particle i by the texture of universe's texture table entry textures[i], for the
+    // Universe layout layout
+    void group(const Universe& universe, const std::vector<uint32_t>& textures, uint64_t layout);
+
+    // Fill the vertex arrays with num_particles particles, particle i at (x[i], y[i]), in a
+    // universe of radius
+    void fill(double radius, size_t num_particles, const double* x, const double* y,
+        sf::Vector2u size);
+
+    // Draw the vertex arrays to target
+    void submit(sf::RenderTarget& target, sf::RenderStates states);
+
+    RenderMode _mode;
+    uint64_t _layout;           // Universe layout the batches were grouped for, or 0 for none
+    std::vector<Batch> _batches;
+    sf::VertexArray _points;
+    size_t _drawCalls;
+};
+
+}  // namespace NB
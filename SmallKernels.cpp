@@ -0,0 +1,46 @@
+// Copyright 2024 Samuel Stanley
+
+#include <array>
+#include <utility>
+#include "SmallKernels.hpp"
+
+namespace NB {
+
+namespace {
+
+template <size_t N>
+void forcesOn(ParticleStore& particles, double softening_sqrd) {
+    smallForces<N>(particles.x.data(), particles.y.data(), particles.mass.data(),
+        particles.ax.data(), particles.ay.data(), particles.potential.data(), softening_sqrd);
+}
+
+template <size_t N>
+void kickOn(ParticleStore& particles, double h) {
+    smallKick<N>(particles.vx.data(), particles.vy.data(), particles.ax.data(),
+        particles.ay.data(), h);
+}
+
+template <size_t N>
+void driftOn(ParticleStore& particles, double h) {
+    smallDrift<N>(particles.x.data(), particles.y.data(), particles.vx.data(),
+        particles.vy.data(), h);
+}
+
+// Entry n - 1 holds the kernels for n particles
+template <size_t... I>
+constexpr std::array<SmallKernels, sizeof...(I)> makeTable(std::index_sequence<I...>) {
+    return {{SmallKernels{forcesOn<I + 1>, kickOn<I + 1>, driftOn<I + 1>}...}};
+}
+
+constexpr std::array<SmallKernels, max_small_n> table =
+    makeTable(std::make_index_sequence<max_small_n>());
+
+}  // namespace
+
+SmallKernels smallKernels(size_t n) {
+    if (n == 0 || n > max_small_n)
+        return SmallKernels();
+    return table[n - 1];
+}
+
+}  // namespace NB
@@ -0,0 +1,110 @@
+// Copyright 2024 Samuel Stanley
+
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <utility>
+#include "Constants.hpp"
+#include "ParticleStore.hpp"
+
+namespace NB {
+
+// Largest number of particles the force and step kernels are specialized for
+constexpr size_t max_small_n = 16;
+
+namespace small {
+
+// Add the pull of particle J on particle I and of I on J to the sums, from one distance
+// computation. The pull on J uses the terms of the pull on I with dx and dy negated, which are
+// exactly the terms the all-pairs kernel computes for J
+template <size_t I, size_t J, typename Real>
+inline void pair(const Real* x, const Real* y, const Real* mass, Real softening_sqrd,
+    Real* sum_x, Real* sum_y, Real* sum_p) {
+    Real dx = x[J] - x[I];
+    Real dy = y[J] - y[I];
+    Real distance_sqrd = (dx * dx) + (dy * dy);
+    if (distance_sqrd == 0)
+        return;
+    Real softened = distance_sqrd + softening_sqrd;
+    Real inv_r3 = 1 / (softened * std::sqrt(softened));
+    sum_x[I] += dx * mass[J] * inv_r3;
+    sum_y[I] += dy * mass[J] * inv_r3;
+    sum_p[I] += mass[J] * inv_r3 * softened;
+    sum_x[J] += -dx * mass[I] * inv_r3;
+    sum_y[J] += -dy * mass[I] * inv_r3;
+    sum_p[J] += mass[I] * inv_r3 * softened;
+}
+
+// Every pair (I, I + 1 + K)
+template <size_t I, typename Real, size_t... K>
+inline void row(const Real* x, const Real* y, const Real* mass, Real softening_sqrd,
+    Real* sum_x, Real* sum_y, Real* sum_p, std::index_sequence<K...>) {
+    (pair<I, I + 1 + K>(x, y, mass, softening_sqrd, sum_x, sum_y, sum_p), ...);
+}
+
+// Every pair (I, J) with I < J < N, with I in the outer loop, so each particle gets its terms
+// in increasing order of the other particle as in the all-pairs kernel
+template <size_t N, typename Real, size_t... I>
+inline void rows(const Real* x, const Real* y, const Real* mass, Real softening_sqrd,
+    Real* sum_x, Real* sum_y, Real* sum_p, std::index_sequence<I...>) {
+    (row<I>(x, y, mass, softening_sqrd, sum_x, sum_y, sum_p,
+        std::make_index_sequence<N - 1 - I>()), ...);
+}
+
+template <typename Real, size_t... I>
+inline void scale(const Real* sum_x, const Real* sum_y, const Real* sum_p, Real* ax, Real* ay,
+    Real* potential, std::index_sequence<I...>) {
+    const Real g = static_cast<Real>(G);
+    ((ax[I] = g * sum_x[I], ay[I] = g * sum_y[I], potential[I] = -g * sum_p[I]), ...);
+}
+
+template <typename Real, size_t... I>
+inline void axpy(Real* x, Real* y, const Real* dx, const Real* dy, Real h,
+    std::index_sequence<I...>) {
+    ((x[I] += h * dx[I], y[I] += h * dy[I]), ...);
+}
+
+}  // namespace small
+
+// Compute the acceleration and potential of each of N particles from the others, with every
+// pair loop unrolled at compile time and the distance of each pair computed once. Each particle
+// gets the same terms in the same order as from the scalar all-pairs kernel, so for doubles
+// the results are identical to it
+template <size_t N, typename Real>
+void smallForces(const Real* x, const Real* y, const Real* mass, Real* ax, Real* ay,
+    Real* potential, Real softening_sqrd) {
+    Real sum_x[N] = {};
+    Real sum_y[N] = {};
+    Real sum_p[N] = {};
+    small::rows<N>(x, y, mass, softening_sqrd, sum_x, sum_y, sum_p,
+        std::make_index_sequence<N>());
+    small::scale(sum_x, sum_y, sum_p, ax, ay, potential, std::make_index_sequence<N>());
+}
+
+// v += h * a for each of N particles
+template <size_t N, typename Real>
+void smallKick(Real* vx, Real* vy, const Real* ax, const Real* ay, Real h) {
+    small::axpy(vx, vy, ax, ay, h, std::make_index_sequence<N>());
+}
+
+// x += h * v for each of N particles
+template <size_t N, typename Real>
+void smallDrift(Real* x, Real* y, const Real* vx, const Real* vy, Real h) {
+    small::axpy(x, y, vx, vy, h, std::make_index_sequence<N>());
+}
+
+// The kernels specialized for one number of particles, run on a ParticleStore's columns
+struct SmallKernels {
+    void (*forces)(ParticleStore& particles, double softening_sqrd) = nullptr;
+    void (*kick)(ParticleStore& particles, double h) = nullptr;
+    void (*drift)(ParticleStore& particles, double h) = nullptr;
+
+    // Return if there are kernels
+    explicit operator bool() const { return forces != nullptr; }
+};
+
+// Return the kernels specialized for n particles, or none if n is 0 or above max_small_n
+SmallKernels smallKernels(size_t n);
+
+}  // namespace NB
@@ -0,0 +1,339 @@
+// Copyright 2024 Samuel Stanley
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "Snapshot.hpp"
+
+namespace NB {
+
+namespace {
+
+// Written as a whole to the start of every binary snapshot
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;        // byte_order_mark as written, to detect a foreign byte order
+    uint64_t count;             // Number of particles
+    double radius;
+    uint64_t texture_count;     // Entries in the texture name table
+    uint64_t texture_offset;    // Offset of the texture name table from the start of the file
+    uint64_t file_size;
+    uint64_t reserved;
+};
+
+static_assert(sizeof(SnapshotHeader) == 64, "the snapshot header must be 64 bytes");
+
+constexpr uint32_t byte_order_mark = 0x01020304;
+
+// Every column starts on a multiple of this many bytes
+constexpr size_t column_alignment = 64;
+
+// Fewest bytes a row of universe text can take: six one character tokens and five separators
+constexpr size_t min_row_bytes = 11;
+
+// Return bytes rounded up to a multiple of column_alignment
+size_t padded(size_t bytes) {
+    return (bytes + column_alignment - 1) / column_alignment * column_alignment;
+}
+
+// Return the offset of double column k (x, y, vx, vy, mass) in a snapshot of count particles.
+// Column 5 is the texture index column
+size_t columnOffset(size_t k, size_t count) {
+    return sizeof(SnapshotHeader) + k * padded(count * sizeof(double));
+}
+
+// Return the offset of the texture name table in a snapshot of count particles
+size_t textureTableOffset(size_t count) {
+    return columnOffset(5, count) + padded(count * sizeof(uint32_t));
+}
+
+// Reads whitespace separated tokens from universe text, keeping track of the line number for
+// error messages
+class TextCursor {
+ public:
+    explicit TextCursor(std::string_view text)
+        : _p(text.data()), _end(text.data() + text.size()), _line(1) {}
+
+    // Return the next token, or an empty token at the end of the text
+    std::string_view token() {
+        while (_p != _end && std::isspace(static_cast<unsigned char>(*_p))) {
+            if (*_p == '\n')
+                _line++;
+            _p++;
+        }
+        const char* begin = _p;
+        while (_p != _end && !std::isspace(static_cast<unsigned char>(*_p)))
+            _p++;
+        return std::string_view(begin, _p - begin);
+    }
+
+    // Return the next token converted to a number of type T. If it is not one,
+    // std::invalid_argument is thrown naming what was expected
+    template <typename T>
+    T number(const char* what) {
+        std::string_view text = token();
+        // Accept an explicit plus sign like formatted input does
+        if (text.size() > 1 && text[0] == '+' && text[1] != '-')
+            text.remove_prefix(1);
+        T value{};
+        auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+        if (text.empty() || error != std::errc() || end != text.data() + text.size())
+            fail(what);
+        return value;
+    }
+
+    // Throw std::invalid_argument saying what was expected on the current line
+    [[noreturn]] void fail(const char* what) const {
+        throw std::invalid_argument("Error: expected " + std::string(what) + " on line " +
+            std::to_string(_line));
+    }
+
+ private:
+    const char* _p;
+    const char* _end;
+    size_t _line;
+};
+
+// Write size bytes of data to out followed by zeros up to the next column boundary
+void writeColumn(std::ostream& out, const void* data, size_t size) {
+    static const char zeros[column_alignment] = {};
+    out.write(static_cast<const char*>(data), size);
+    out.write(zeros, padded(size) - size);
+}
+
+}  // namespace
+
+void appendNumber(std::string& line, double value) {
+    char buffer[32];
+    auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    line.append(buffer, result.ptr);
+}
+
+MappedFile::MappedFile(const std::string& file_name) : _data(nullptr), _size(0) {
+    int fd = ::open(file_name.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::invalid_argument("Error: file '" + file_name + "' could not be opened");
+    struct stat info;
+    if (::fstat(fd, &info) != 0) {
+        ::close(fd);
+        throw std::invalid_argument("Error: file '" + file_name + "' could not be read");
+    }
+    _size = static_cast<size_t>(info.st_size);
+    if (_size > 0) {
+        void* mapping = ::mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            ::close(fd);
+            throw std::invalid_argument("Error: file '" + file_name + "' could not be mapped");
+        }
+        _data = static_cast<const char*>(mapping);
+    }
+    ::close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (_data)
+        ::munmap(const_cast<char*>(_data), _size);
+}
+
+UniverseData parseText(std::string_view text) {
+    TextCursor cursor(text);
+    UniverseData data;
+    size_t count = cursor.number<size_t>("the number of particles");
+    data.radius = cursor.number<double>("the radius");
+    if (count > text.size() / min_row_bytes)
+        cursor.fail("a row for every particle");
+
+    data.particles.resize(count);
+    data.texture_index.resize(count);
+    ParticleStore& particles = data.particles;
+    // Views into text of every distinct texture name seen so far, resolved once each
+    std::unordered_map<std::string_view, uint32_t> texture_indices;
+    for (size_t i = 0; i < count; i++) {
+        particles.x[i] = cursor.number<double>("an x position");
+        particles.y[i] = cursor.number<double>("a y position");
+        particles.vx[i] = cursor.number<double>("an x velocity");
+        particles.vy[i] = cursor.number<double>("a y velocity");
+        particles.mass[i] = cursor.number<double>("a mass");
+        std::string_view texture = cursor.token();
+        if (texture.empty())
+            cursor.fail("a texture file name");
+        auto [entry, added] = texture_indices.emplace(texture, data.textures.size());
+        if (added)
+            data.textures.emplace_back(texture);
+        data.texture_index[i] = entry->second;
+    }
+    return data;
+}
+
+UniverseData readTextFile(const std::string& file_name) {
+    MappedFile file(file_name);
+    return parseText(std::string_view(file.data(), file.size()));
+}
+
+void writeText(std::ostream& out, const UniverseData& data) {
+    const ParticleStore& particles = data.particles;
+    std::string line = std::to_string(particles.size()) + '\n';
+    appendNumber(line, data.radius);
+    line += '\n';
+    out << line;
+    for (size_t i = 0; i < particles.size(); i++) {
+        line.clear();
+        for (double value : {particles.x[i], particles.y[i], particles.vx[i], particles.vy[i],
+            particles.mass[i]}) {
+            appendNumber(line, value);
+            line += ' ';
+        }
+        line += data.textures[data.texture_index[i]];
+        line += '\n';
+        out << line;
+    }
+}
+
+void writeSnapshot(std::ostream& out, const UniverseData& data) {
+    const ParticleStore& particles = data.particles;
+    size_t count = particles.size();
+    size_t table_size = 0;
+    for (const std::string& texture : data.textures)
+        table_size += sizeof(uint32_t) + texture.size();
+
+    SnapshotHeader header = {};
+    std::memcpy(header.magic, snapshot_magic, sizeof(header.magic));
+    header.version = snapshot_version;
+    header.byte_order = byte_order_mark;
+    header.count = count;
+    header.radius = data.radius;
+    header.texture_count = data.textures.size();
+    header.texture_offset = textureTableOffset(count);
+    header.file_size = header.texture_offset + table_size;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    for (const AlignedArray* column : {&particles.x, &particles.y, &particles.vx, &particles.vy,
+        &particles.mass})
+        writeColumn(out, column->data(), count * sizeof(double));
+    writeColumn(out, data.texture_index.data(), count * sizeof(uint32_t));
+
+    for (const std::string& texture : data.textures) {
+        uint32_t length = static_cast<uint32_t>(texture.size());
+        out.write(reinterpret_cast<const char*>(&length), sizeof(length));
+        out.write(texture.data(), texture.size());
+    }
+}
+
+void writeSnapshotFile(const std::string& file_name, const UniverseData& data) {
+    std::ofstream out(file_name, std::ios::binary);
+    if (out)
+        writeSnapshot(out, data);
+    if (!out)
+        throw std::invalid_argument("Error: file '" + file_name + "' could not be written");
+}
+
+bool isSnapshotFile(const std::string& file_name) {
+    std::ifstream in(file_name, std::ios::binary);
+    char magic[sizeof(snapshot_magic)];
+    return in.read(magic, sizeof(magic)) && isSnapshot(std::string_view(magic, sizeof(magic)));
+}
+
+bool isSnapshot(std::string_view bytes) {
+    return bytes.size() >= sizeof(snapshot_magic) && std::memcmp(bytes.data(), snapshot_magic,
+        sizeof(snapshot_magic)) == 0;
+}
+
+SnapshotView::SnapshotView(const std::string& file_name)
+    : _file(std::make_unique<MappedFile>(file_name)) {
+    open(_file->data(), _file->size(), "'" + file_name + "'");
+}
+
+SnapshotView::SnapshotView(const char* data, size_t size) {
+    open(data, size, "the snapshot");
+}
+
+void SnapshotView::open(const char* data, size_t size, const std::string& source) {
+    auto invalid = [&source](const std::string& reason) {
+        return std::invalid_argument("Error: " + source + " " + reason);
+    };
+
+    SnapshotHeader header;
+    if (size < sizeof(header))
+        throw invalid("is not a binary snapshot");
+    if (reinterpret_cast<uintptr_t>(data) % alignof(double) != 0)
+        throw invalid("is not aligned for reading in place");
+    std::memcpy(&header, data, sizeof(header));
+    if (std::memcmp(header.magic, snapshot_magic, sizeof(header.magic)) != 0)
+        throw invalid("is not a binary snapshot");
+    if (header.version != snapshot_version)
+        throw invalid("has unsupported snapshot version " + std::to_string(header.version));
+    if (header.byte_order != byte_order_mark)
+        throw invalid("was written with a different byte order");
+    if (header.file_size != size || header.count > size / sizeof(double) ||
+        header.texture_offset != textureTableOffset(header.count) || header.texture_offset > size)
+        throw invalid("is truncated or corrupt");
+
+    _size = header.count;
+    _radius = header.radius;
+    const char* base = data;
+    _x = reinterpret_cast<const double*>(base + columnOffset(0, _size));
+    _y = reinterpret_cast<const double*>(base + columnOffset(1, _size));
+    _vx = reinterpret_cast<const double*>(base + columnOffset(2, _size));
+    _vy = reinterpret_cast<const double*>(base + columnOffset(3, _size));
+    _mass = reinterpret_cast<const double*>(base + columnOffset(4, _size));
+    _textureIndex = reinterpret_cast<const uint32_t*>(base + columnOffset(5, _size));
+
+    const char* p = base + header.texture_offset;
+    const char* end = base + size;
+    _textures.reserve(std::min<uint64_t>(header.texture_count, size));
+    for (uint64_t t = 0; t < header.texture_count; t++) {
+        uint32_t length;
+        if (static_cast<size_t>(end - p) < sizeof(length))
+            throw invalid("is truncated or corrupt");
+        std::memcpy(&length, p, sizeof(length));
+        p += sizeof(length);
+        if (static_cast<size_t>(end - p) < length)
+            throw invalid("is truncated or corrupt");
+        _textures.emplace_back(p, length);
+        p += length;
+    }
+
+    // Check the indices once so textureName never reads outside the table
+    if (std::any_of(_textureIndex, _textureIndex + _size, [this](uint32_t index) {
+        return index >= _textures.size(); }))
+        throw invalid("has a texture index outside its texture table");
+}
+
+UniverseData SnapshotView::data() const {
+    UniverseData data;
+    data.radius = _radius;
+    ParticleStore& particles = data.particles;
+    particles.x.assign(_x, _x + _size);
+    particles.y.assign(_y, _y + _size);
+    particles.vx.assign(_vx, _vx + _size);
+    particles.vy.assign(_vy, _vy + _size);
+    particles.mass.assign(_mass, _mass + _size);
+    particles.ax.assign(_size, 0.0);
+    particles.ay.assign(_size, 0.0);
+    particles.potential.assign(_size, 0.0);
+    data.textures = _textures;
+    data.texture_index.assign(_textureIndex, _textureIndex + _size);
+    return data;
+}
+
+UniverseData readUniverseFile(const std::string& file_name) {
+    if (isSnapshotFile(file_name))
+        return SnapshotView(file_name).data();
+    return readTextFile(file_name);
+}
+
+}  // namespace NB
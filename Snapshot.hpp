@@ -0,0 +1,140 @@
+// Copyright 2024 Samuel Stanley
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "ParticleStore.hpp"
+
+namespace NB {
+
+// The contents of a universe file: the radius, the physical state of every particle and the
+// texture of every particle, given as an index into a table of distinct texture names
+struct UniverseData {
+    double radius = 0.0;
+    ParticleStore particles;
+    std::vector<std::string> textures;
+    std::vector<uint32_t> texture_index;
+};
+
+// A read-only memory mapping of a whole file, unmapped when destroyed
+class MappedFile {
+ public:
+    // Map file_name into memory. If it cannot be opened or mapped, std::invalid_argument is
+    // thrown
+    explicit MappedFile(const std::string& file_name);
+
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Return the first byte of the file
+    const char* data() const { return _data; }
+
+    // Return the size of the file in bytes
+    size_t size() const { return _size; }
+
+ private:
+    const char* _data;
+    size_t _size;
+};
+
+// Parse text in the universe file format: the number of particles N, the radius, then N rows of
+// x, y, vx, vy, mass and texture file name. Anything after the last row is ignored. If the text
+// is malformed, std::invalid_argument is thrown
+UniverseData parseText(std::string_view text);
+
+// Parse the universe text file file_name through a memory mapping. If it cannot be read or is
+// malformed, std::invalid_argument is thrown
+UniverseData readTextFile(const std::string& file_name);
+
+// Append the shortest text that reads back as exactly value to line
+void appendNumber(std::string& line, double value);
+
+// Write data to out in the universe file format. Every number is written with the fewest digits
+// that read back as the same double, so parseText restores data exactly
+void writeText(std::ostream& out, const UniverseData& data);
+
+// The binary snapshot format is a 64 byte header followed by the x, y, vx, vy and mass columns
+// as doubles, the texture index column as uint32_t and finally the texture name table. Every
+// column starts on a 64 byte boundary, so a mapped snapshot can be read in place
+constexpr char snapshot_magic[8] = {'N', 'B', 'S', 'N', 'A', 'P', '\r', '\n'};
+constexpr uint32_t snapshot_version = 1;
+
+// Write data to out as a binary snapshot
+void writeSnapshot(std::ostream& out, const UniverseData& data);
+
+// Write data to file_name as a binary snapshot. If the file cannot be written,
+// std::invalid_argument is thrown
+void writeSnapshotFile(const std::string& file_name, const UniverseData& data);
+
+// Return if file_name starts with the binary snapshot magic number
+bool isSnapshotFile(const std::string& file_name);
+
+// Return if bytes starts with the binary snapshot magic number
+bool isSnapshot(std::string_view bytes);
+
+// A binary snapshot read in place from a memory mapping or buffer. The columns point straight
+// into the snapshot's bytes, so opening one copies nothing but the texture name table
+class SnapshotView {
+ public:
+    // Map the binary snapshot file_name. If it cannot be read, is not a snapshot or is
+    // truncated, std::invalid_argument is thrown
+    explicit SnapshotView(const std::string& file_name);
+
+    // View the binary snapshot in the size bytes at data, which must stay valid while the view
+    // is used. If data is not aligned for doubles, is not a snapshot or is truncated,
+    // std::invalid_argument is thrown
+    SnapshotView(const char* data, size_t size);
+
+    // Return the number of particles
+    size_t size() const { return _size; }
+
+    // Return the radius of the universe
+    double radius() const { return _radius; }
+
+    // Return the columns of the snapshot, each holding size() values
+    const double* x() const { return _x; }
+    const double* y() const { return _y; }
+    const double* vx() const { return _vx; }
+    const double* vy() const { return _vy; }
+    const double* mass() const { return _mass; }
+    const uint32_t* textureIndex() const { return _textureIndex; }
+
+    // Return the table of distinct texture names
+    const std::vector<std::string>& textures() const { return _textures; }
+
+    // Return the texture name of particle i
+    const std::string& textureName(size_t i) const { return _textures[_textureIndex[i]]; }
+
+    // Return a copy of the snapshot with zero accelerations
+    UniverseData data() const;
+
+ private:
+    // Point the columns and read the texture table of the snapshot in the size bytes at data,
+    // naming it source in errors
+    void open(const char* data, size_t size, const std::string& source);
+
+    std::unique_ptr<MappedFile> _file;
+    size_t _size;
+    double _radius;
+    const double* _x;
+    const double* _y;
+    const double* _vx;
+    const double* _vy;
+    const double* _mass;
+    const uint32_t* _textureIndex;
+    std::vector<std::string> _textures;
+};
+
+// Read file_name as a binary snapshot if it is one and as universe text otherwise. If it cannot
+// be read or is malformed, std::invalid_argument is thrown
+UniverseData readUniverseFile(const std::string& file_name);
+
+}  // namespace NB
@@ -0,0 +1,102 @@
+// Copyright 2024 Samuel Stanley
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "SpaceFillingCurve.hpp"
+
+namespace NB {
+
+namespace {
+
+// Spread the bits of v so bit i moves to bit 2i
+uint64_t spreadBits(uint32_t v) {
+    uint64_t x = v;
+    x = (x | (x << 16)) & 0x0000FFFF0000FFFFull;
+    x = (x | (x << 8)) & 0x00FF00FF00FF00FFull;
+    x = (x | (x << 4)) & 0x0F0F0F0F0F0F0F0Full;
+    x = (x | (x << 2)) & 0x3333333333333333ull;
+    x = (x | (x << 1)) & 0x5555555555555555ull;
+    return x;
+}
+
+// Return the grid cell of coordinate v, given the low edge of the grid and the cells per meter
+uint32_t cellOf(double v, double low, double scale) {
+    double cell = (v - low) * scale;
+    // Also maps NaN to cell 0
+    if (!(cell >= 0))
+        return 0;
+    return static_cast<uint32_t>(std::min(cell, static_cast<double>(UINT32_MAX)));
+}
+
+}  // namespace
+
+Curve curveFromName(const std::string& name) {
+    if (name == "morton")
+        return Curve::Morton;
+    if (name == "hilbert")
+        return Curve::Hilbert;
+    throw std::invalid_argument("Error: unknown curve " + name);
+}
+
+std::string curveName(Curve curve) {
+    return curve == Curve::Morton ? "morton" : "hilbert";
+}
+
+uint64_t mortonKey(uint32_t x, uint32_t y) {
+    return spreadBits(x) | (spreadBits(y) << 1);
+}
+
+uint64_t hilbertKey(uint32_t x, uint32_t y) {
+    uint64_t key = 0;
+    for (uint32_t s = 1u << 31; s > 0; s >>= 1) {
+        uint32_t rx = (x & s) ? 1 : 0;
+        uint32_t ry = (y & s) ? 1 : 0;
+        key += static_cast<uint64_t>(s) * s * ((3 * rx) ^ ry);
+        // Rotate the quadrant so the curve through it starts and ends where it joins its
+        // neighbours; only the bits below s matter from here on
+        if (ry == 0) {
+            if (rx == 1) {
+                x = ~x;
+                y = ~y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return key;
+}
+
+std::vector<size_t> curveOrder(const ParticleStore& particles, Curve curve) {
+    const size_t n = particles.size();
+    std::vector<size_t> order(n);
+    if (n == 0)
+        return order;
+
+    double min_x = particles.x[0], max_x = particles.x[0];
+    double min_y = particles.y[0], max_y = particles.y[0];
+    for (size_t i = 1; i < n; i++) {
+        min_x = std::min(min_x, particles.x[i]);
+        max_x = std::max(max_x, particles.x[i]);
+        min_y = std::min(min_y, particles.y[i]);
+        max_y = std::max(max_y, particles.y[i]);
+    }
+    // A square grid, so the curve is not stretched along the longer side
+    double width = std::max(max_x - min_x, max_y - min_y);
+    double scale = width > 0 ? UINT32_MAX / width : 0.0;
+
+    std::vector<std::pair<uint64_t, size_t>> keys(n);
+    for (size_t i = 0; i < n; i++) {
+        uint32_t cx = cellOf(particles.x[i], min_x, scale);
+        uint32_t cy = cellOf(particles.y[i], min_y, scale);
+        keys[i] = {curve == Curve::Morton ? mortonKey(cx, cy) : hilbertKey(cx, cy), i};
+    }
+    std::sort(keys.begin(), keys.end());
+    for (size_t k = 0; k < n; k++)
+        order[k] = keys[k].second;
+    return order;
+}
+
+}  // namespace NB
@@ -0,0 +1,36 @@
+// Copyright 2024 Samuel Stanley
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "ParticleStore.hpp"
+
+namespace NB {
+
+// Space-filling curves particles can be ordered along, so particles close in space are close in
+// memory
+enum class Curve { Morton, Hilbert };
+
+// Return the curve called name ("morton" or "hilbert"). If there is none, std::invalid_argument
+// is thrown
+Curve curveFromName(const std::string& name);
+
+// Return the name of curve as given on the command line
+std::string curveName(Curve curve);
+
+// Return the position of cell (x, y) of a 2^32 by 2^32 grid along the Morton (Z-order) curve,
+// which interleaves the bits of x and y
+uint64_t mortonKey(uint32_t x, uint32_t y);
+
+// Return the position of cell (x, y) of a 2^32 by 2^32 grid along the Hilbert curve. Unlike the
+// Morton curve, consecutive cells along it are always neighbours
+uint64_t hilbertKey(uint32_t x, uint32_t y);
+
+// Return the indices of the particles sorted along curve through the smallest square holding
+// every particle, so particle order[k] is the k-th along the curve. Particles in the same cell
+// keep their relative order
+std::vector<size_t> curveOrder(const ParticleStore& particles, Curve curve);
+
+}  // namespace NB
@@ -0,0 +1,88 @@
+// Copyright 2024 Samuel Stanley
+
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "ThreadPool.hpp"
+
+namespace NB {
+
+ThreadPool::ThreadPool(unsigned int num_threads)
+    : _task(nullptr), _generation(0), _remaining(0), _stop(false) {
+    for (unsigned int id = 1; id < std::max(num_threads, 1u); id++)
+        _workers.emplace_back(&ThreadPool::workerLoop, this, id);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _start.notify_all();
+    for (std::thread& worker : _workers)
+        worker.join();
+}
+
+void ThreadPool::run(const std::function<void(unsigned int)>& task) {
+    if (_workers.empty()) {
+        task(0);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _task = &task;
+        _remaining = _workers.size();
+        _generation++;
+    }
+    _start.notify_all();
+
+    // The calling thread is thread 0
+    task(0);
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done.wait(lock, [this] { return _remaining == 0; });
+    _task = nullptr;
+}
+
+void ThreadPool::parallelFor(size_t n, const std::function<void(size_t, size_t)>& body,
+    size_t min_parallel) {
+    if (n < min_parallel || _workers.empty()) {
+        body(0, n);
+        return;
+    }
+
+    size_t threads = size();
+    run([n, threads, &body](unsigned int t) {
+        size_t begin = n * t / threads;
+        size_t end = n * (t + 1) / threads;
+        if (begin < end)
+            body(begin, end);
+    });
+}
+
+void ThreadPool::workerLoop(unsigned int id) {
+    size_t seen = 0;
+    while (true) {
+        const std::function<void(unsigned int)>* task;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _start.wait(lock, [this, seen] { return _stop || _generation != seen; });
+            if (_stop)
+                return;
+            seen = _generation;
+            task = _task;
+        }
+
+        (*task)(id);
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _remaining--;
+        }
+        _done.notify_one();
+    }
+}
+
+}  // namespace NB
@@ -0,0 +1,55 @@
+// Copyright 2024 Samuel Stanley
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace NB {
+
+// A fixed set of worker threads that persist between jobs. The thread that submits a job takes
+// part in it, so a pool of size 1 has no workers and runs everything inline
+class ThreadPool {
+ public:
+    // Construct a ThreadPool that runs jobs on num_threads threads (at least 1)
+    explicit ThreadPool(unsigned int num_threads);
+
+    // Stop and join every worker
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Return the number of threads jobs run on, including the calling thread
+    unsigned int size() const { return _workers.size() + 1; }
+
+    // Call task(t) once for every t in [0, size()), with thread t always running task(t), and
+    // return when every call has finished
+    void run(const std::function<void(unsigned int)>& task);
+
+    // Split [0, n) into size() contiguous chunks of near-equal length and call body(begin, end)
+    // for each chunk in parallel. Chunk boundaries depend only on n and size(), so results are
+    // deterministic for a fixed thread count. If n is below min_parallel, body(0, n) is called
+    // on the calling thread
+    void parallelFor(size_t n, const std::function<void(size_t, size_t)>& body,
+        size_t min_parallel = 1);
+
+ private:
+    // Wait for jobs and run this worker's share of each
+    void workerLoop(unsigned int id);
+
+    std::vector<std::thread> _workers;
+    std::mutex _mutex;
+    std::condition_variable _start;
+    std::condition_variable _done;
+    const std::function<void(unsigned int)>* _task;
+    size_t _generation;
+    unsigned int _remaining;
+    bool _stop;
+};
+
+}  // namespace NB
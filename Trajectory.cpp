@@ -0,0 +1,236 @@
+// Copyright 2024 Samuel Stanley
+
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "Trajectory.hpp"
+#include "Snapshot.hpp"
+
+namespace NB {
+
+namespace {
+
+constexpr uint32_t byte_order_mark = 0x01020304;
+
+// Return the array of particles holding field
+const AlignedArray& fieldArray(const ParticleStore& particles, TrajectoryField field) {
+    switch (field) {
+    case TrajectoryField::X:
+        return particles.x;
+    case TrajectoryField::Y:
+        return particles.y;
+    case TrajectoryField::VX:
+        return particles.vx;
+    case TrajectoryField::VY:
+        return particles.vy;
+    default:
+        return particles.mass;
+    }
+}
+
+// Write the raw bytes of value to out
+template <typename T>
+void writeRaw(std::ostream& out, const T& value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+}  // namespace
+
+std::string fieldName(TrajectoryField field) {
+    switch (field) {
+    case TrajectoryField::X:
+        return "x";
+    case TrajectoryField::Y:
+        return "y";
+    case TrajectoryField::VX:
+        return "vx";
+    case TrajectoryField::VY:
+        return "vy";
+    default:
+        return "mass";
+    }
+}
+
+TrajectoryField fieldFromName(const std::string& name) {
+    for (TrajectoryField field : {TrajectoryField::X, TrajectoryField::Y, TrajectoryField::VX,
+        TrajectoryField::VY, TrajectoryField::Mass}) {
+        if (fieldName(field) == name)
+            return field;
+    }
+    throw std::invalid_argument("Error: unknown trajectory field " + name);
+}
+
+TrajectoryWriter::TrajectoryWriter(const std::string& file_name, TrajectoryFormat format,
+    std::vector<TrajectoryField> fields, std::vector<size_t> bodies, size_t num_particles,
+    bool append)
+    : _fileName(file_name), _format(format), _fields(std::move(fields)),
+    _bodies(std::move(bodies)), _framesRecorded(0), _appending(false), _stop(false),
+    _finished(false) {
+    if (_bodies.empty()) {
+        _bodies.resize(num_particles);
+        for (size_t i = 0; i < num_particles; i++)
+            _bodies[i] = i;
+    }
+    for (size_t body : _bodies) {
+        if (body >= num_particles)
+            throw std::invalid_argument("Error: there is no body " + std::to_string(body));
+    }
+
+    std::ostringstream header;
+    writeHeader(header);
+    std::ios::openmode mode = std::ios::out;
+    if (format == TrajectoryFormat::Binary)
+        mode |= std::ios::binary;
+    if (append) {
+        // Only a trajectory of the same fields and bodies can be continued
+        std::ifstream existing(file_name, std::ios::binary);
+        std::string start(header.str().size(), '\0');
+        existing.read(&start[0], start.size());
+        if (existing.gcount() > 0) {
+            if (start != header.str())
+                throw std::invalid_argument("Error: trajectory '" + file_name +
+                    "' was written with other fields, bodies or format");
+            _appending = true;
+            mode |= std::ios::app;
+        }
+    }
+
+    _out.open(file_name, mode);
+    if (!_out)
+        throw std::invalid_argument("Error: file '" + file_name + "' could not be opened");
+    if (!_appending)
+        _out << header.str();
+    _thread = std::thread(&TrajectoryWriter::writerLoop, this);
+}
+
+TrajectoryWriter::~TrajectoryWriter() {
+    try {
+        finish();
+    } catch (const std::runtime_error&) {
+        // A destructor cannot report the failure; call finish to see it
+    }
+}
+
+void TrajectoryWriter::record(uint64_t step, double time, const ParticleStore& particles,
+    const std::vector<size_t>& slots) {
+    Frame frame;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_free.empty()) {
+            frame = std::move(_free.back());
+            _free.pop_back();
+        }
+    }
+
+    frame.step = step;
+    frame.time = time;
+    size_t num_bodies = _bodies.size();
+    frame.values.resize(_fields.size() * num_bodies);
+    double* values = frame.values.data();
+    for (TrajectoryField field : _fields) {
+        const double* array = fieldArray(particles, field).data();
+        if (slots.empty()) {
+            for (size_t k = 0; k < num_bodies; k++)
+                values[k] = array[_bodies[k]];
+        } else {
+            for (size_t k = 0; k < num_bodies; k++)
+                values[k] = array[slots[_bodies[k]]];
+        }
+        values += num_bodies;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _pending.push_back(std::move(frame));
+    }
+    _ready.notify_one();
+    _framesRecorded++;
+}
+
+void TrajectoryWriter::finish() {
+    if (_finished)
+        return;
+    _finished = true;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _ready.notify_one();
+    _thread.join();
+    _out.close();
+    if (_out.fail())
+        throw std::runtime_error("Error: trajectory file '" + _fileName +
+            "' could not be written");
+}
+
+void TrajectoryWriter::writerLoop() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+        _ready.wait(lock, [this] { return _stop || !_pending.empty(); });
+        if (_pending.empty())
+            break;
+        Frame frame = std::move(_pending.front());
+        _pending.pop_front();
+
+        lock.unlock();
+        writeFrame(frame);
+        lock.lock();
+        _free.push_back(std::move(frame));
+    }
+    lock.unlock();
+    _out.flush();
+}
+
+void TrajectoryWriter::writeHeader(std::ostream& out) const {
+    if (_format == TrajectoryFormat::Text) {
+        out << "step time index";
+        for (TrajectoryField field : _fields)
+            out << ' ' << fieldName(field);
+        out << '\n';
+        return;
+    }
+
+    out.write(trajectory_magic, sizeof(trajectory_magic));
+    writeRaw(out, trajectory_version);
+    writeRaw(out, byte_order_mark);
+    writeRaw(out, static_cast<uint32_t>(_fields.size()));
+    for (TrajectoryField field : _fields)
+        writeRaw(out, static_cast<uint32_t>(field));
+    writeRaw(out, static_cast<uint64_t>(_bodies.size()));
+    for (size_t body : _bodies)
+        writeRaw(out, static_cast<uint64_t>(body));
+}
+
+void TrajectoryWriter::writeFrame(const Frame& frame) {
+    if (_format == TrajectoryFormat::Binary) {
+        writeRaw(_out, frame.step);
+        writeRaw(_out, frame.time);
+        _out.write(reinterpret_cast<const char*>(frame.values.data()),
+            frame.values.size() * sizeof(double));
+        return;
+    }
+
+    // One row per body, so the file loads as a single table
+    size_t num_bodies = _bodies.size();
+    std::string prefix = std::to_string(frame.step) + ' ';
+    appendNumber(prefix, frame.time);
+    for (size_t k = 0; k < num_bodies; k++) {
+        _line = prefix;
+        _line += ' ';
+        _line += std::to_string(_bodies[k]);
+        for (size_t f = 0; f < _fields.size(); f++) {
+            _line += ' ';
+            appendNumber(_line, frame.values[f * num_bodies + k]);
+        }
+        _line += '\n';
+        _out << _line;
+    }
+}
+
+}  // namespace NB
@@ -0,0 +1,106 @@
+// Copyright 2024 Samuel Stanley
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ParticleStore.hpp"
+
+namespace NB {
+
+// Per-particle values a trajectory can record
+enum class TrajectoryField { X, Y, VX, VY, Mass };
+
+// Return the name of field ("x", "y", "vx", "vy" or "mass")
+std::string fieldName(TrajectoryField field);
+
+// Return the field called name. If there is none, std::invalid_argument is thrown
+TrajectoryField fieldFromName(const std::string& name);
+
+// Formats a trajectory can be written in
+enum class TrajectoryFormat { Text, Binary };
+
+// The binary trajectory format starts with this magic number, a uint32_t version, a uint32_t
+// byte order mark, the uint32_t number of fields, the uint32_t ids of the fields, the uint64_t
+// number of bodies and their uint64_t indices. Every frame that follows is a uint64_t step, a
+// double time and then one column of doubles per field, holding the value of every body
+constexpr char trajectory_magic[8] = {'N', 'B', 'T', 'R', 'A', 'J', '\r', '\n'};
+constexpr uint32_t trajectory_version = 1;
+
+// Streams snapshots of some fields of some particles to a file or named pipe. record only copies
+// the values into a frame buffer; a background thread does all the formatting and writing, so
+// the simulation never waits on I/O. Frame buffers are recycled, and if the writer falls behind,
+// frames queue up in memory rather than blocking
+class TrajectoryWriter {
+ public:
+    // Open file_name and write frames of fields of the particles listed in bodies, or of all
+    // num_particles particles if bodies is empty. If append is true and file_name already holds
+    // a trajectory, as when resuming the run that wrote it, frames are added after the ones it
+    // has. If the file cannot be opened, a body is out of range or the trajectory being appended
+    // to has another header, std::invalid_argument is thrown
+    TrajectoryWriter(const std::string& file_name, TrajectoryFormat format,
+        std::vector<TrajectoryField> fields, std::vector<size_t> bodies, size_t num_particles,
+        bool append = false);
+
+    // Write any queued frames and close the file
+    ~TrajectoryWriter();
+
+    TrajectoryWriter(const TrajectoryWriter&) = delete;
+    TrajectoryWriter& operator=(const TrajectoryWriter&) = delete;
+
+    // Queue the state of particles after step steps and time seconds to be written. slots[i] is
+    // where particle i is stored in particles, as from Universe::slots; if slots is empty,
+    // particle i is stored at i
+    void record(uint64_t step, double time, const ParticleStore& particles,
+        const std::vector<size_t>& slots = {});
+
+    // Write every queued frame, close the file and stop the writer thread. If any write failed,
+    // std::runtime_error is thrown
+    void finish();
+
+    // Return the number of frames recorded so far
+    uint64_t framesRecorded() const { return _framesRecorded; }
+
+    // Return if the frames are added to an existing trajectory
+    bool appending() const { return _appending; }
+
+ private:
+    // The values of one frame, field by field
+    struct Frame {
+        uint64_t step;
+        double time;
+        std::vector<double> values;
+    };
+
+    // Write queued frames until finish is called
+    void writerLoop();
+
+    // Write the header of the trajectory to out
+    void writeHeader(std::ostream& out) const;
+    void writeFrame(const Frame& frame);
+
+    std::string _fileName;
+    std::ofstream _out;
+    TrajectoryFormat _format;
+    std::vector<TrajectoryField> _fields;
+    std::vector<size_t> _bodies;
+    std::string _line;
+    uint64_t _framesRecorded;
+    bool _appending;
+
+    std::mutex _mutex;
+    std::condition_variable _ready;
+    std::deque<Frame> _pending;
+    std::vector<Frame> _free;
+    bool _stop;
+    bool _finished;
+    std::thread _thread;
+};
+
+}  // namespace NB
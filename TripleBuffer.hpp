@@ -0,0 +1,53 @@
+// Copyright 2024 Samuel Stanley
+
+#pragma once
+
+#include <atomic>
+
+namespace NB {
+
+// Hands the latest of a stream of values from one writer thread to one reader thread without
+// locks. The writer fills back() and publishes it; the reader takes the most recently published
+// value with update() and reads it through front(). Neither thread ever waits for the other, and
+// values the reader had no time for are simply overwritten
+template <typename T>
+class TripleBuffer {
+ public:
+    TripleBuffer() : _back(0), _middle(1), _front(2) {}
+
+    TripleBuffer(const TripleBuffer&) = delete;
+    TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+    // Return the buffer the writer fills next. Only the writer may call this
+    T& back() { return _buffers[_back]; }
+
+    // Make the filled back buffer the latest value and give the writer a free one. Only the
+    // writer may call this
+    void publish() {
+        _back = _middle.exchange(_back | fresh_bit, std::memory_order_acq_rel) & index_mask;
+    }
+
+    // Take the latest published value if there is one the reader has not taken yet, and return
+    // if there was. Only the reader may call this
+    bool update() {
+        if (!(_middle.load(std::memory_order_relaxed) & fresh_bit))
+            return false;
+        _front = _middle.exchange(_front, std::memory_order_acq_rel) & index_mask;
+        return true;
+    }
+
+    // Return the value last taken by update. Only the reader may call this
+    const T& front() const { return _buffers[_front]; }
+
+ private:
+    // The middle index carries a flag saying whether its buffer has been published but not taken
+    static constexpr unsigned int fresh_bit = 4;
+    static constexpr unsigned int index_mask = 3;
+
+    T _buffers[3];
+    unsigned int _back;
+    std::atomic<unsigned int> _middle;
+    unsigned int _front;
+};
+
+}  // namespace NB
@@ -8,37 +8,72 @@
 #include <map>
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
 #include <SFML/Graphics.hpp>
 #include "Universe.hpp"
 #include "CelestialBody.hpp"
 #include "Constants.hpp"
+#include "Snapshot.hpp"
+#include "Checkpoint.hpp"
+#include "Collisions.hpp"
 
 namespace NB {
 
-Universe::Universe(const std::string& file_name) {
-    std::ifstream fin(file_name);
-    fin >> *this;
+namespace {
+
+// Read file_name from the image directory or else the working directory into image, and return
+// if either could be read
+bool loadImage(sf::Image& image, const std::string& file_name) {
+    return image.loadFromFile(image_dir + file_name) || image.loadFromFile(file_name);
+}
+
+}  // namespace
+
+Universe::Universe(const std::string& file_name, bool headless) : Universe() {
+    _headless = headless;
+    // As with a stream, a file that cannot be read leaves the Universe empty
+    UniverseData data;
+    try {
+        data = readUniverseFile(file_name);
+    } catch (const std::invalid_argument&) {
+        data = UniverseData();
+    }
+    append(std::move(data));
 }
 
 std::istream& operator>>(std::istream& in, Universe& universe) {
-    // Set background texture
-    universe._background = std::make_unique<sf::Sprite>();
-    universe._background->setTexture(*universe.getTexture(background));
-    sf::Vector2u texture_size = universe.getTexture(background)->getSize();
-    universe._background->setOrigin(texture_size.x / 2.0, texture_size.y / 2.0);
-
-    // Get input data
-    size_t num_particles;
-    in >> num_particles >> universe._radius;
-    for (size_t i = 0; i < num_particles; i++) {
-        universe._forces.push_back(std::pair<std::shared_ptr<CelestialBody>, sf::Vector2<double>>(
-            std::make_shared<CelestialBody>(universe), sf::Vector2<double>(0, 0)));
-        in >> universe[universe.numPlanets() - 1];
+    ScopedTimer timer(universe.profiler(), Phase::Input);
+    // Take the rest of the stream in blocks that double in size, straight into the string that
+    // is parsed, so the input is held in memory once
+    std::string text;
+    size_t size = 0;
+    while (in) {
+        text.resize(size + std::max<size_t>(size, 1 << 16));
+        in.read(&text[size], text.size() - size);
+        size += in.gcount();
+    }
+    text.resize(size);
+    // Running out of input is expected; only a stream error is kept
+    in.clear(in.rdstate() & std::ios::badbit);
+
+    UniverseData data;
+    try {
+        if (isSnapshot(text))
+            data = SnapshotView(text.data(), text.size()).data();
+        else
+            data = parseText(text);
+    } catch (const std::invalid_argument&) {
+        in.setstate(std::ios::failbit);
+        return in;
     }
+    universe.append(std::move(data));
     return in;
 }
 
 std::ostream& operator<<(std::ostream& out, const Universe& universe) {
+    ScopedTimer timer(universe.profiler(), Phase::Output);
     out << universe.numPlanets() << std::endl;
     if (universe.radius() > 1000)
         out << std::scientific;
@@ -49,90 +84,314 @@ std::ostream& operator<<(std::ostream& out, const Universe& universe) {
     return out;
 }
 
-void Universe::step(double seconds) {
+void Universe::append(UniverseData data) {
+    // Set background texture
+    if (!_headless && !_background) {
+        _background = std::make_unique<sf::Sprite>();
+        const sf::Texture& texture = *this->texture(textureIndex(background));
+        _background->setTexture(texture);
+        sf::Vector2u texture_size = texture.getSize();
+        _background->setOrigin(texture_size.x / 2.0, texture_size.y / 2.0);
+    }
+
+    _radius = data.radius;
+    size_t first = _particles.size();
+    size_t count = data.particles.size();
+    if (first == 0)
+        _particles = std::move(data.particles);
+    else
+        _particles.append(data.particles);
+
+    // Resolve each distinct texture once rather than once per particle
+    if (!_headless)
+        loadTextures(data.textures);
+    std::vector<uint32_t> textures(data.textures.size());
+    for (size_t t = 0; t < textures.size(); t++)
+        textures[t] = textureIndex(data.textures[t]);
+
+    // Every body is a small value in one array, so there is one allocation for all of them
+    _bodies.reserve(first + count);
+    for (size_t i = 0; i < count; i++)
+        _bodies.emplace_back(*this, first + i, textures[data.texture_index[i]]);
+    updateSlots();
+    _layout++;
     _calculatedForces = false;
+    _potentialCurrent = false;
+}
 
-    for (size_t i = 0; i < numPlanets(); i++) {
-        (*this)[i].step(seconds);
+UniverseData Universe::data() const {
+    UniverseData data;
+    data.radius = _radius;
+    data.particles = _particles;
+    if (!_slots.empty())
+        data.particles.permute(_slots);
+    data.texture_index.reserve(_bodies.size());
+    // Only the textures some body uses, numbered in order of first use
+    std::vector<int64_t> indices(_textureNames.size(), -1);
+    for (const CelestialBody& body : _bodies) {
+        uint32_t t = body.textureIndex();
+        if (indices[t] < 0) {
+            indices[t] = data.textures.size();
+            data.textures.push_back(_textureNames[t]);
+        }
+        data.texture_index.push_back(static_cast<uint32_t>(indices[t]));
     }
+    return data;
 }
 
-void Universe::calculate_forces() {
-    sf::Vector2<double> distance;
-    double distance_sqrd;
-    double total_distance;
-    double total_force;
-
-    // Set all stored forces to {0, 0}
-    for (auto& force : _forces) {
-        force.second = {0, 0};
+Checkpoint Universe::checkpoint(uint64_t step, double time) const {
+    ScopedTimer timer(*_profiler, Phase::Output);
+    Checkpoint checkpoint;
+    checkpoint.step = step;
+    checkpoint.time = time;
+    checkpoint.integrator = _integrator->name();
+    checkpoint.engine = _engine->name();
+    checkpoint.calculated_forces = _calculatedForces;
+    checkpoint.data = data();
+    checkpoint.integrator_state = _integrator->saveState();
+    checkpoint.steps_since_reorder = _stepsSinceReorder;
+    checkpoint.slots.assign(_slots.begin(), _slots.end());
+    return checkpoint;
+}
+
+void Universe::restore(const Checkpoint& checkpoint) {
+    ScopedTimer timer(*_profiler, Phase::Input);
+    if (checkpoint.integrator != _integrator->name() || checkpoint.engine != _engine->name())
+        throw std::invalid_argument("Error: the checkpoint was taken with the " +
+            checkpoint.integrator + " integrator and " + checkpoint.engine + " force engine");
+    _integrator->loadState(checkpoint.integrator_state);
+
+    _bodies.clear();
+    _particles.clear();
+    append(checkpoint.data);
+    // The integrator's state is in storage order, so the particles go back where they were
+    if (!checkpoint.slots.empty()) {
+        std::vector<size_t> order(checkpoint.slots.size());
+        for (size_t n = 0; n < order.size(); n++)
+            order[checkpoint.slots[n]] = n;
+        permute(order);
     }
+    _calculatedForces = checkpoint.calculated_forces;
+    _stepsSinceReorder = checkpoint.steps_since_reorder;
+}
 
-    // Calculate all forces
-    for (size_t i = 0; i < numPlanets(); i++) {
-        for (size_t j = i + 1; j < numPlanets(); j++) {
-            // Calculate distances between Universe[i] and Universe[j]
-            distance = CelestialBody::distance((*this)[i], (*this)[j]);
-            distance_sqrd = (distance.x * distance.x) + (distance.y * distance.y);
-            total_distance = sqrt(distance_sqrd);
+void Universe::updateSlots() {
+    size_t n = 0;
+    while (n < _bodies.size() && _bodies[n].index() == n)
+        n++;
+    if (n == _bodies.size()) {
+        _slots.clear();
+        return;
+    }
+    _slots.resize(_bodies.size());
+    for (size_t i = 0; i < _bodies.size(); i++)
+        _slots[i] = _bodies[i].index();
+}
 
-            // Calculate force
-            total_force = G * ((*this)[i].mass() * (*this)[j].mass()) / distance_sqrd;
+ConservedQuantities Universe::conserved() {
+    if (!_potentialCurrent)
+        calculate_forces();
+    return measureConserved(_particles, *_pool);
+}
 
-            // Calculate x and y forces
-            _forces[i].second.x += total_force * (distance.x / total_distance);
-            _forces[i].second.y += total_force * (distance.y / total_distance);
+void Universe::step(double seconds) {
+    ScopedTimer timer(*_profiler, Phase::Integration);
+    _profiler->count(Counter::Steps);
+    _calculatedForces = _integrator->step(_particles, *_pool, seconds,
+        [this](const std::vector<size_t>* active) {
+            if (active)
+                calculate_forces(*active);
+            else
+                calculate_forces();
+        }, _calculatedForces);
+    // The positions moved unless forces were computed for every particle after they did
+    _potentialCurrent = _potentialCurrent && _calculatedForces;
+    if (_mergeRadius > 0)
+        mergeClose();
+    if (_reorderInterval > 0 && ++_stepsSinceReorder >= _reorderInterval)
+        reorder();
+}
 
-            _forces[j].second.x -= total_force * (distance.x / total_distance);
-            _forces[j].second.y -= total_force * (distance.y / total_distance);
-        }
+void Universe::setMergeRadius(double radius) {
+    if (!(radius >= 0))
+        throw std::invalid_argument("Error: merge radius must not be negative");
+    _mergeRadius = radius;
+}
+
+void Universe::mergeClose() {
+    std::vector<size_t> sources;
+    size_t removed = mergeCloseParticles(_particles, _mergeRadius, sources);
+    if (removed == 0)
+        return;
+
+    // Particle sources[k] moved to k. The bodies of the particles merged away are removed and the
+    // rest keep their order, which is not the storage order once the particles are reordered
+    constexpr size_t gone = SIZE_MAX;
+    std::vector<size_t> moved_to(_bodies.size(), gone);
+    for (size_t k = 0; k < sources.size(); k++)
+        moved_to[sources[k]] = k;
+    size_t kept = 0;
+    for (size_t i = 0; i < _bodies.size(); i++) {
+        size_t slot = moved_to[_bodies[i].index()];
+        if (slot != gone)
+            _bodies[kept++] = CelestialBody(*this, slot, _bodies[i].textureIndex());
     }
+    _bodies.erase(_bodies.begin() + kept, _bodies.end());
+    updateSlots();
+    _merged += removed;
+    _layout++;
+    _calculatedForces = false;
+    _potentialCurrent = false;
+}
+
+void Universe::setReorderInterval(uint64_t interval, Curve curve) {
+    _reorderInterval = interval;
+    _curve = curve;
+    _stepsSinceReorder = 0;
+}
+
+void Universe::reorder() {
+    std::vector<size_t> order = curveOrder(_particles, _curve);
+    permute(order);
+    _integrator->permute(order);
+    _stepsSinceReorder = 0;
+}
+
+void Universe::permute(const std::vector<size_t>& order) {
+    _particles.permute(order);
+    std::vector<size_t> moved_to(order.size());
+    for (size_t k = 0; k < order.size(); k++)
+        moved_to[order[k]] = k;
+    for (CelestialBody& body : _bodies)
+        body = CelestialBody(*this, moved_to[body.index()], body.textureIndex());
+    updateSlots();
+    // The accelerations and potentials moved with the particles, so they are still current
+    _layout++;
+}
+
+void Universe::calculate_forces() {
+    ScopedTimer timer(*_profiler, Phase::Forces);
+    _engine->computeAccelerations(_particles, *_pool);
+    _profiler->count(Counter::Interactions, _engine->interactions());
 
     _calculatedForces = true;
+    _potentialCurrent = true;
+}
+
+void Universe::calculate_forces(const std::vector<size_t>& active) {
+    ScopedTimer timer(*_profiler, Phase::Forces);
+    _engine->computeActiveAccelerations(_particles, *_pool, active);
+    _profiler->count(Counter::Interactions, _engine->interactions());
+    _potentialCurrent = active.size() == _particles.size();
 }
 
-std::shared_ptr<sf::Texture> Universe::getTexture(const std::string& file_name) {
-    // if the texture from file_name is not in the map
-    if (!_textures.count(file_name)) {
-        _textures[file_name] = std::make_shared<sf::Texture>();
-        // Check sub directory for file first and then base directory
-        if (!_textures[file_name]->loadFromFile(image_dir + file_name) &&
-            !_textures[file_name]->loadFromFile(file_name)) {
-            // throw std::invalid_argument("Error: file '" + file_name + "' could not be found");
+void Universe::setForceEngine(std::unique_ptr<ForceEngine> engine) {
+    _engine = std::move(engine);
+    _calculatedForces = false;
+    _potentialCurrent = false;
+}
+
+void Universe::setIntegrator(std::unique_ptr<Integrator> integrator) {
+    _integrator = std::move(integrator);
+}
+
+void Universe::setThreads(unsigned int num_threads) {
+    _pool = std::make_unique<ThreadPool>(num_threads);
+}
+
+void Universe::loadTextures(const std::vector<std::string>& file_names) {
+    std::vector<std::string> missing;
+    for (const std::string& file_name : file_names) {
+        if (!_textureIndices.count(file_name) &&
+            std::find(missing.begin(), missing.end(), file_name) == missing.end())
+            missing.push_back(file_name);
+    }
+    if (missing.empty())
+        return;
+
+    // Decoding is plain CPU work; only making the textures needs the graphics context
+    ScopedTimer timer(*_profiler, Phase::Input);
+    std::vector<sf::Image> images(missing.size());
+    std::vector<char> loaded(missing.size());
+    _pool->parallelFor(missing.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+            loaded[i] = loadImage(images[i], missing[i]);
+    });
+    for (size_t i = 0; i < missing.size(); i++)
+        addTexture(missing[i], loaded[i] ? &images[i] : nullptr);
+}
+
+uint32_t Universe::addTexture(const std::string& file_name, const sf::Image* image) {
+    std::unique_ptr<sf::Texture> texture;
+    if (!_headless) {
+        texture = std::make_unique<sf::Texture>();
+        if (!image || !texture->loadFromImage(*image))
             std::cout << "Error: file '" << file_name << "' could not be found" << std::endl;
-        }
     }
-    return _textures[file_name];
+    uint32_t index = static_cast<uint32_t>(_textureNames.size());
+    _textureIndices.emplace(file_name, index);
+    _textureNames.push_back(file_name);
+    _textureTable.push_back(std::move(texture));
+    return index;
 }
 
-std::string Universe::getTextureName(std::shared_ptr<sf::Texture> texture) const {
-    auto map_item = std::find_if(_textures.begin(), _textures.end(), [texture](auto t) {
-        return t.second == texture;
-    });
-    if (map_item == _textures.end())
-        throw std::out_of_range("Error: texture name not found");
-    return map_item->first;
+uint32_t Universe::textureIndex(const std::string& file_name) {
+    auto entry = _textureIndices.find(file_name);
+    if (entry != _textureIndices.end())
+        return entry->second;
+    sf::Image image;
+    bool loaded = !_headless && loadImage(image, file_name);
+    return addTexture(file_name, loaded ? &image : nullptr);
 }
 
 sf::Vector2<double> Universe::getForce(const CelestialBody& body) {
+    ScopedTimer timer(*_profiler, Phase::Lookup);
     if (!_calculatedForces)
         calculate_forces();
 
-    auto item = std::find_if(_forces.begin(), _forces.end(), [&body](auto i) {
-        return *(i.first) == body;
-    });
-    return item->second;
+    size_t i = body.index();
+    return sf::Vector2<double>(_particles.mass[i] * _particles.ax[i],
+        _particles.mass[i] * _particles.ay[i]);
+}
+
+void Universe::savePositions(PositionFrame& frame, uint64_t step, double time) const {
+    frame.step = step;
+    frame.time = time;
+    frame.x.assign(_particles.x.begin(), _particles.x.end());
+    frame.y.assign(_particles.y.begin(), _particles.y.end());
+    // The drawing thread must not read the bodies, which the stepping thread may be changing
+    if (frame.layout != _layout) {
+        frame.layout = _layout;
+        frame.textures.resize(_bodies.size());
+        for (const CelestialBody& body : _bodies)
+            frame.textures[body.index()] = body.textureIndex();
+    }
+}
+
+void Universe::drawFrame(sf::RenderTarget& target, const PositionFrame& frame) const {
+    drawAt(target, sf::RenderStates::Default, &frame);
 }
 
 void Universe::draw(sf::RenderTarget& target, sf::RenderStates states) const {
+    drawAt(target, states, nullptr);
+}
+
+void Universe::drawAt(sf::RenderTarget& target, sf::RenderStates states,
+    const PositionFrame* frame) const {
+    if (_headless)
+        return;
+    ScopedTimer timer(*_profiler, Phase::Render);
+    _profiler->count(Counter::Frames);
+
     // Draw background
     _background->setPosition(target.getSize().x / 2.0, target.getSize().y / 2.0);
     target.draw(*_background);
 
     // Draw every particle
-    for (size_t i = 0; i < numPlanets(); i++) {
-        target.draw((*this)[i], states);
-    }
+    if (frame)
+        _renderer->draw(*this, *frame, target, states);
+    else
+        _renderer->draw(*this, _particles.x.data(), _particles.y.data(), target, states);
 }
 
 }  // namespace NB
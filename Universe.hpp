@@ -2,70 +2,251 @@
 
 #pragma once
 
+#include <cstdint>
 #include <iostream>
 #include <string>
 #include <vector>
 #include <memory>
 #include <map>
-#include <utility>
 #include <SFML/Graphics.hpp>
 #include "CelestialBody.hpp"
+#include "ParticleStore.hpp"
+#include "ForceEngine.hpp"
+#include "Integrator.hpp"
+#include "Snapshot.hpp"
+#include "Checkpoint.hpp"
+#include "ThreadPool.hpp"
+#include "Renderer.hpp"
+#include "Profiler.hpp"
+#include "Conserved.hpp"
+#include "SpaceFillingCurve.hpp"
 
 namespace NB {
 
 class Universe : public sf::Drawable {
  public:
     // Construct a Universe object with default values
-    Universe() : _radius(0.0), _calculatedForces(false) {}
-
-    // Construct a Universe object with initial values from file_name
-    explicit Universe(const std::string& file_name);
-
-    // Give universe the values read from in
+    Universe() : _radius(0.0), _layout(1), _calculatedForces(false), _potentialCurrent(false),
+        _headless(false), _mergeRadius(0.0), _merged(0), _reorderInterval(0),
+        _curve(Curve::Hilbert), _stepsSinceReorder(0), _engine(std::make_unique<DirectEngine>()),
+        _integrator(std::make_unique<EulerIntegrator>()), _pool(std::make_unique<ThreadPool>(1)),
+        _renderer(std::make_unique<BatchRenderer>()),
+        _profiler(std::make_unique<Profiler>()) {}
+
+    // Construct a Universe object with initial values from file_name, which may hold universe
+    // text or a binary snapshot. If it cannot be read, the Universe is empty. A headless Universe
+    // loads no textures and cannot be drawn
+    explicit Universe(const std::string& file_name, bool headless = false);
+
+    // Give universe the values read from in, as universe text or a binary snapshot. The rest of in
+    // is consumed; if it is malformed, the failbit of in is set and universe is unchanged
     friend std::istream& operator>>(std::istream& in, Universe& universe);
 
     // Write the current state of universe to out
     friend std::ostream& operator<<(std::ostream& out, const Universe& universe);
 
     // Update the positions and velocities of every particle in the universe given the amount of
-    // seconds since the universe was last updated
+    // seconds since the universe was last updated, using the Universe's Integrator
     void step(double seconds);
 
-    // Calculate the forces between every particle in the universe and store them
+    // Calculate the forces between every particle in the universe and store the resulting
+    // accelerations in the ParticleStore
     void calculate_forces();
 
+    // Calculate the forces on only the particles listed in active and store the resulting
+    // accelerations. The stored accelerations are still considered out of date afterwards
+    void calculate_forces(const std::vector<size_t>& active);
+
     // Return the number of particles in the Universe
-    unsigned int numPlanets() const { return _forces.size(); }
+    unsigned int numPlanets() const { return _bodies.size(); }
 
     // Return the radius of the Universe
     double radius() const { return _radius; }
 
-    // Return the particle at index n
-    CelestialBody& operator[](size_t n) const { return *(_forces[n].first); }
+    // Return a number that changes whenever particles are added or removed
+    uint64_t layout() const { return _layout; }
+
+    // Return the particle at index n, in the order the particles were read. Its state is stored
+    // at its index() in the ParticleStore, which differs from n once the particles are reordered
+    CelestialBody& operator[](size_t n) { return _bodies[n]; }
+    const CelestialBody& operator[](size_t n) const { return _bodies[n]; }
+
+    // Return where in the ParticleStore each particle is stored, in the order the particles were
+    // read, or an empty vector if particle n is stored at n for every n. It is kept up to date as
+    // the particles move, so reading it costs nothing
+    const std::vector<size_t>& slots() const { return _slots; }
+
+    // Return a copy of the state of every particle and its texture name, as written to a
+    // universe file, in the order the particles were read
+    UniverseData data() const;
+
+    // Return a checkpoint of the Universe at step and time: the full precision state of every
+    // particle, whether its stored accelerations are current and the integrator's state
+    Checkpoint checkpoint(uint64_t step, double time) const;
+
+    // Replace every particle and the integrator's state with those of checkpoint, so stepping
+    // continues exactly as the checkpointed run would have. If checkpoint was taken with a
+    // different integrator or force engine, std::invalid_argument is thrown
+    void restore(const Checkpoint& checkpoint);
+
+    // Return the structure-of-arrays storage holding the state of every particle
+    ParticleStore& particles() { return _particles; }
+    const ParticleStore& particles() const { return _particles; }
+
+    // Return the index of the texture from file_name in the texture table the particles share,
+    // adding it if it is not there yet. Unless the Universe is headless, the texture is loaded
+    uint32_t textureIndex(const std::string& file_name);
 
-    // Get the texture from file_name and add it to the map if it's not already in the map
-    std::shared_ptr<sf::Texture> getTexture(const std::string& file_name);
+    // Return the file name of entry index of the texture table
+    const std::string& textureName(uint32_t index) const { return _textureNames[index]; }
 
-    // Get the name of the texture given if its in the map. If not, std::out_of_range is thrown
-    std::string getTextureName(std::shared_ptr<sf::Texture> texture) const;
+    // Return the texture of entry index of the texture table, or nullptr if the Universe is
+    // headless
+    const sf::Texture* texture(uint32_t index) const { return _textureTable[index].get(); }
 
-    // Get the force for the CelestialBody. If the stored forces are out of date, calculate_forces
-    // is called
+    // Get the force for the CelestialBody by its index. If the stored forces are out of date,
+    // calculate_forces is called
     sf::Vector2<double> getForce(const CelestialBody& body);
 
-    // Return if _forces is up to date
+    // Return if the stored accelerations are up to date
     bool calculatedForces() const { return _calculatedForces; }
 
+    // Merge particles that come closer than radius meters after each step, conserving mass and
+    // momentum (see mergeCloseParticles). 0, the default, never merges. If radius is negative,
+    // std::invalid_argument is thrown
+    void setMergeRadius(double radius);
+
+    // Return the distance in meters below which particles are merged
+    double mergeRadius() const { return _mergeRadius; }
+
+    // Return the number of particles removed by merges so far
+    uint64_t merged() const { return _merged; }
+
+    // Reorder the ParticleStore along curve after every interval steps (see reorder). 0, the
+    // default, never reorders
+    void setReorderInterval(uint64_t interval, Curve curve = Curve::Hilbert);
+
+    // Return the number of steps between reorders, or 0 if the particles are never reordered
+    uint64_t reorderInterval() const { return _reorderInterval; }
+
+    // Sort the ParticleStore along the reorder curve, so particles close in space are close in
+    // memory and the force passes touch fewer cache lines. The stored accelerations and the
+    // integrator's state move with the particles, and every CelestialBody keeps its place, so
+    // only the summation order of the forces, and so their rounding, changes
+    void reorder();
+
+    // Return the energy, momenta and angular momentum of the particles. The potential energy
+    // comes from the potentials the last force pass wrote if it covered every particle at their
+    // current positions, as it does after every leapfrog, yoshida4 or block step. Otherwise
+    // calculate_forces is called, which the next step would otherwise have called itself. The
+    // kinetic energy and momenta are summed here in one O(N) pass rather than in the step pass,
+    // so steps that are not logged do not pay for them
+    ConservedQuantities conserved();
+
+    // Compute forces with engine from now on
+    void setForceEngine(std::unique_ptr<ForceEngine> engine);
+
+    // Return the engine forces are computed with
+    ForceEngine& forceEngine() const { return *_engine; }
+
+    // Advance the particles with integrator from now on
+    void setIntegrator(std::unique_ptr<Integrator> integrator);
+
+    // Return the integrator the particles are advanced with
+    Integrator& integrator() const { return *_integrator; }
+
+    // Compute forces by direct summation with the all-pairs kernel compiled for isa. If the CPU
+    // does not support isa, std::invalid_argument is thrown
+    void setKernelIsa(KernelIsa isa) { setForceEngine(std::make_unique<DirectEngine>(isa)); }
+
+    // Set whether the Universe loads textures and builds sprites when it is read. Must be set
+    // before the Universe is read to take effect
+    void setHeadless(bool headless) { _headless = headless; }
+
+    // Return if the Universe skips loading textures and building sprites
+    bool headless() const { return _headless; }
+
+    // Draw the particles as mode from now on
+    void setRenderMode(RenderMode mode) { _renderer->setMode(mode); }
+
+    // Copy the position of every particle into frame, marking it as step and time. The texture
+    // of every particle is copied too if the layout changed since frame was last saved
+    void savePositions(PositionFrame& frame, uint64_t step, double time) const;
+
+    // Draw the background and then every particle of frame to target, as draw would if the
+    // particles were as they are in frame. A headless Universe draws nothing
+    void drawFrame(sf::RenderTarget& target, const PositionFrame& frame) const;
+
+    // Return the renderer that draws the particles in batches
+    BatchRenderer& renderer() const { return *_renderer; }
+
+    // Run the force and step passes on num_threads persistent threads (at least 1)
+    void setThreads(unsigned int num_threads);
+
+    // Return the number of threads the force and step passes run on
+    unsigned int threads() const { return _pool->size(); }
+
+    // Return the thread pool the force and step passes run on
+    ThreadPool& threadPool() const { return *_pool; }
+
+    // Return the profiler that times the force, integration, lookup, render and I/O phases of
+    // the Universe and counts its steps, interactions and frames. It starts disabled
+    Profiler& profiler() const { return *_profiler; }
+
  protected:
-    // Draw every object in the Universe to the target
+    // Draw the background and then every particle in a few batched draw calls to the target.
+    // A headless Universe draws nothing
     virtual void draw(sf::RenderTarget& target, sf::RenderStates states) const;
 
  private:
+    // Draw the background and then every particle of frame, or of the Universe if frame is
+    // nullptr, to target
+    void drawAt(sf::RenderTarget& target, sf::RenderStates states,
+        const PositionFrame* frame) const;
+
+    // Merge the particles closer than the merge radius and remove the bodies merged away
+    void mergeClose();
+
+    // Move particle order[k] of the ParticleStore to k and point every body at its new place
+    void permute(const std::vector<size_t>& order);
+
+    // Recompute _slots from the bodies, after they are added, removed or moved
+    void updateSlots();
+
+    // Add the particles of data after the existing ones, taking the radius of data
+    void append(UniverseData data);
+
+    // Load every texture of file_names that is not loaded yet. The image files are decoded in
+    // parallel and then made into textures on the calling thread
+    void loadTextures(const std::vector<std::string>& file_names);
+
+    // Add file_name to the texture table with a texture made from image, which is nullptr if the
+    // file could not be read, and return its index. If the texture cannot be made, an error is
+    // printed and the texture is empty. A headless Universe keeps only the name
+    uint32_t addTexture(const std::string& file_name, const sf::Image* image);
+
     double _radius;
+    uint64_t _layout;
     std::unique_ptr<sf::Sprite> _background;
-    std::map<std::string, std::shared_ptr<sf::Texture>> _textures;
-    std::vector<std::pair<std::shared_ptr<CelestialBody>, sf::Vector2<double>>> _forces;
+    std::map<std::string, uint32_t> _textureIndices;
+    std::vector<std::string> _textureNames;
+    std::vector<std::unique_ptr<sf::Texture>> _textureTable;
+    std::vector<CelestialBody> _bodies;
+    std::vector<size_t> _slots;  // Where each body is stored, or empty if body n is at n
+    ParticleStore _particles;
     bool _calculatedForces;
+    bool _potentialCurrent;
+    bool _headless;
+    double _mergeRadius;
+    uint64_t _merged;
+    uint64_t _reorderInterval;
+    Curve _curve;
+    uint64_t _stepsSinceReorder;
+    std::unique_ptr<ForceEngine> _engine;
+    std::unique_ptr<Integrator> _integrator;
+    std::unique_ptr<ThreadPool> _pool;
+    std::unique_ptr<BatchRenderer> _renderer;
+    std::unique_ptr<Profiler> _profiler;
 };
 
 }  // namespace NB
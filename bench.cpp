@@ -0,0 +1,338 @@
+// Copyright 2024 Samuel Stanley
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <SFML/Graphics.hpp>
+#include "Universe.hpp"
+#include "Constants.hpp"
+#include "BarnesHut.hpp"
+#include "Fmm.hpp"
+#include "Integrator.hpp"
+#include "CommandLine.hpp"
+#include "Snapshot.hpp"
+
+// Microbenchmarks of the force, step, force lookup, parsing and drawing paths on the bundled
+// scenarios and on generated universes of 10^2 up to 10^6 particles. Each result is the mean
+// time of one call, written as JSON or CSV so runs of different versions can be compared
+
+namespace {
+
+struct BenchOptions {
+    size_t max_n = 1000000;       // Largest generated universe
+    size_t direct_max = 10000;    // Largest universe direct summation is timed on
+    double min_time = 0.5;        // Seconds each benchmark repeats for
+    unsigned int threads = 1;
+    std::string format = "json";
+    std::string out;              // Empty for stdout
+    std::string scenarios = image_dir;
+};
+
+struct Result {
+    std::string scenario;
+    size_t n;
+    std::string benchmark;
+    uint64_t iterations;
+    double seconds;               // Mean seconds per iteration
+};
+
+// A universe to benchmark, as universe text and as a binary snapshot
+struct Scenario {
+    std::string name;
+    std::string text;
+    std::string snapshot;
+    size_t n;
+};
+
+// Return the time since start in seconds
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Time body. A first call that takes at least min_time is the result; otherwise it is a warm-up
+// and body is repeated until min_time has passed
+template <typename Body>
+Result measure(const Scenario& scenario, const std::string& benchmark, double min_time,
+    Body&& body) {
+    auto start = std::chrono::steady_clock::now();
+    body();
+    double first = secondsSince(start);
+    uint64_t iterations = 1;
+    double seconds = first;
+    if (first < min_time) {
+        iterations = 0;
+        start = std::chrono::steady_clock::now();
+        do {
+            body();
+            iterations++;
+            seconds = secondsSince(start);
+        } while (seconds < min_time);
+    }
+    Result result{scenario.name, scenario.n, benchmark, iterations, seconds / iterations};
+    std::cerr << scenario.name << " " << benchmark << ": " << result.seconds * 1e3 << " ms ("
+        << iterations << " iterations)" << std::endl;
+    return result;
+}
+
+// Return scenario with the text and snapshot of data
+Scenario makeScenario(const std::string& name, const NB::UniverseData& data) {
+    Scenario scenario{name, "", "", data.particles.size()};
+    std::ostringstream text;
+    NB::writeText(text, data);
+    scenario.text = std::move(text).str();
+    std::ostringstream snapshot;
+    NB::writeSnapshot(snapshot, data);
+    scenario.snapshot = std::move(snapshot).str();
+    return scenario;
+}
+
+// Return a disk of n particles on near-circular orbits around a central star, the same for every
+// run
+NB::UniverseData generateDisk(size_t n) {
+    const double radius = 2.5e11;
+    const double star_mass = 1.989e30;
+    NB::UniverseData data;
+    data.radius = radius;
+    data.textures = {"sun.gif", "earth.gif"};
+    data.particles.resize(n);
+    data.texture_index.assign(n, 1);
+    data.texture_index[0] = 0;
+    data.particles.mass[0] = star_mass;
+
+    std::mt19937_64 generator(n);
+    std::uniform_real_distribution<double> distance(0.1 * radius, radius);
+    std::uniform_real_distribution<double> angle(0, 2 * std::acos(-1.0));
+    for (size_t i = 1; i < n; i++) {
+        double r = distance(generator);
+        double a = angle(generator);
+        double speed = std::sqrt(G * star_mass / r);
+        data.particles.x[i] = r * std::cos(a);
+        data.particles.y[i] = r * std::sin(a);
+        data.particles.vx[i] = -speed * std::sin(a);
+        data.particles.vy[i] = speed * std::cos(a);
+        data.particles.mass[i] = 5.974e24;
+    }
+    return data;
+}
+
+// Return every universe file in directory, by name
+std::vector<Scenario> bundledScenarios(const std::string& directory) {
+    std::vector<std::string> files;
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(directory, error)) {
+        if (entry.path().extension() == ".txt")
+            files.push_back(entry.path().string());
+    }
+    std::sort(files.begin(), files.end());
+
+    std::vector<Scenario> scenarios;
+    for (const std::string& file : files) {
+        try {
+            scenarios.push_back(makeScenario(std::filesystem::path(file).stem().string(),
+                NB::readTextFile(file)));
+        } catch (const std::invalid_argument& failure) {
+            std::cerr << failure.what() << std::endl;
+        }
+    }
+    return scenarios;
+}
+
+// Return a Universe read from text
+std::unique_ptr<NB::Universe> readUniverse(const std::string& text, bool headless,
+    unsigned int threads) {
+    auto universe = std::make_unique<NB::Universe>();
+    universe->setHeadless(headless);
+    universe->setThreads(threads);
+    std::istringstream in(text);
+    in >> *universe;
+    if (!in)
+        throw std::invalid_argument("Error: scenario could not be read");
+    return universe;
+}
+
+// Run every benchmark on scenario and add the results to results
+void benchScenario(const Scenario& scenario, const BenchOptions& options,
+    std::vector<Result>& results) {
+    const double min_time = options.min_time;
+    const bool direct = scenario.n <= options.direct_max;
+    std::unique_ptr<NB::Universe> universe = readUniverse(scenario.text, true, options.threads);
+
+    if (direct) {
+        results.push_back(measure(scenario, "calculate_forces/direct", min_time,
+            [&]() { universe->calculate_forces(); }));
+    }
+    universe->setForceEngine(std::make_unique<NB::BarnesHutEngine>());
+    results.push_back(measure(scenario, "calculate_forces/barneshut", min_time,
+        [&]() { universe->calculate_forces(); }));
+    universe->setForceEngine(std::make_unique<NB::FmmEngine>());
+    results.push_back(measure(scenario, "calculate_forces/fmm", min_time,
+        [&]() { universe->calculate_forces(); }));
+    universe->setForceEngine(std::make_unique<NB::BarnesHutEngine>());
+
+    // The new engine has no forces yet; compute them first so only the lookups are timed
+    universe->calculate_forces();
+    double sum = 0;
+    results.push_back(measure(scenario, "getForce", min_time, [&]() {
+        for (size_t i = 0; i < universe->numPlanets(); i++)
+            sum += universe->getForce((*universe)[i]).x;
+    }));
+    if (!std::isfinite(sum))
+        std::cerr << "Warning: " << scenario.name << " has non-finite forces" << std::endl;
+
+    if (direct)
+        universe->setForceEngine(std::make_unique<NB::DirectEngine>());
+    std::string engine = universe->forceEngine().name();
+    for (const char* integrator : {"euler", "leapfrog"}) {
+        universe->setIntegrator(NB::makeIntegrator(integrator));
+        results.push_back(measure(scenario, std::string("step/") + integrator + "/" + engine,
+            min_time, [&]() { universe->step(1.0); }));
+    }
+    universe.reset();
+
+    // The tree passes again with the particles sorted along a Hilbert curve, and stepping while
+    // sorting every 10 steps, for the effect of memory locality. Generated universes are stored
+    // in random order
+    universe = readUniverse(scenario.text, true, options.threads);
+    universe->reorder();
+    universe->setForceEngine(std::make_unique<NB::BarnesHutEngine>());
+    results.push_back(measure(scenario, "calculate_forces/barneshut/reordered", min_time,
+        [&]() { universe->calculate_forces(); }));
+    universe->setForceEngine(std::make_unique<NB::FmmEngine>());
+    results.push_back(measure(scenario, "calculate_forces/fmm/reordered", min_time,
+        [&]() { universe->calculate_forces(); }));
+    if (direct)
+        universe->setForceEngine(std::make_unique<NB::DirectEngine>());
+    else
+        universe->setForceEngine(std::make_unique<NB::BarnesHutEngine>());
+    universe->setIntegrator(NB::makeIntegrator("leapfrog"));
+    universe->setReorderInterval(10);
+    results.push_back(measure(scenario, "step/leapfrog/" + engine + "/reorder10", min_time,
+        [&]() { universe->step(1.0); }));
+    universe.reset();
+
+    results.push_back(measure(scenario, "parse/text", min_time,
+        [&]() { readUniverse(scenario.text, true, 1); }));
+    results.push_back(measure(scenario, "parse/snapshot", min_time,
+        [&]() { readUniverse(scenario.snapshot, true, 1); }));
+
+    // Draw to an off-screen target, which needs a graphics context
+    sf::RenderTexture target;
+    if (!target.create(800, 800)) {
+        std::cerr << scenario.name << ": no off-screen render target, draw skipped" << std::endl;
+        return;
+    }
+    universe = readUniverse(scenario.text, false, 1);
+    for (NB::RenderMode mode : {NB::RenderMode::Sprites, NB::RenderMode::Points}) {
+        universe->setRenderMode(mode);
+        std::string name = mode == NB::RenderMode::Sprites ? "sprites" : "points";
+        results.push_back(measure(scenario, "draw/" + name, min_time, [&]() {
+            target.clear();
+            target.draw(*universe);
+            target.display();
+        }));
+    }
+}
+
+// Write results to out as a JSON array of objects
+void writeJson(std::ostream& out, const std::vector<Result>& results, unsigned int threads) {
+    out << "{\"threads\": " << threads << ", \"results\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& result = results[i];
+        std::string seconds;
+        NB::appendNumber(seconds, result.seconds);
+        out << (i ? ",\n  " : "\n  ") << "{\"scenario\": \"" << result.scenario << "\", \"n\": "
+            << result.n << ", \"benchmark\": \"" << result.benchmark << "\", \"iterations\": "
+            << result.iterations << ", \"seconds\": " << seconds << "}";
+    }
+    out << "\n]}\n";
+}
+
+// Write results to out as CSV with a header row
+void writeCsv(std::ostream& out, const std::vector<Result>& results, unsigned int threads) {
+    out << "scenario,n,benchmark,threads,iterations,seconds\n";
+    for (const Result& result : results) {
+        std::string seconds;
+        NB::appendNumber(seconds, result.seconds);
+        out << result.scenario << ',' << result.n << ',' << result.benchmark << ',' << threads
+            << ',' << result.iterations << ',' << seconds << '\n';
+    }
+}
+
+// Return the options given on the command line. If one is invalid, std::invalid_argument is
+// thrown
+BenchOptions parseBenchOptions(int argc, char* argv[]) {
+    BenchOptions options;
+    for (int i = 1; i < argc; i++) {
+        std::string option(argv[i]);
+        if (i + 1 >= argc)
+            throw std::invalid_argument("Error: missing value for " + option);
+        std::string value(argv[++i]);
+        if (option == "--max-n")
+            options.max_n = NB::countValue(option, value);
+        else if (option == "--direct-max")
+            options.direct_max = NB::countValue(option, value);
+        else if (option == "--min-time")
+            options.min_time = NB::nonNegativeReal(option, value);
+        else if (option == "--threads")
+            options.threads = NB::positiveInteger(option, value);
+        else if (option == "--format")
+            options.format = value;
+        else if (option == "--out")
+            options.out = value;
+        else if (option == "--scenarios")
+            options.scenarios = value;
+        else
+            throw std::invalid_argument("Error: unknown option " + option);
+    }
+    if (options.format != "json" && options.format != "csv")
+        throw std::invalid_argument("Error: --format must be json or csv");
+    return options;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    try {
+        options = parseBenchOptions(argc, argv);
+    } catch (const std::invalid_argument& error) {
+        std::cerr << error.what() << std::endl;
+        std::cerr << "Syntax: ./NBodyBench [--max-n N] [--direct-max N] [--min-time S] "
+            "[--threads N] [--format json|csv] [--out F] [--scenarios DIR]" << std::endl;
+        return 1;
+    }
+
+    std::vector<Scenario> scenarios = bundledScenarios(options.scenarios);
+    for (size_t n = 100; n <= options.max_n; n *= 10)
+        scenarios.push_back(makeScenario("disk-" + std::to_string(n), generateDisk(n)));
+
+    std::vector<Result> results;
+    for (const Scenario& scenario : scenarios)
+        benchScenario(scenario, options, results);
+
+    std::ofstream file;
+    if (!options.out.empty()) {
+        file.open(options.out);
+        if (!file) {
+            std::cerr << "Error: file '" << options.out << "' could not be opened" << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& out = options.out.empty() ? std::cout : file;
+    if (options.format == "json")
+        writeJson(out, results, options.threads);
+    else
+        writeCsv(out, results, options.threads);
+    return out ? 0 : 1;
+}
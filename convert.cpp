@@ -0,0 +1,33 @@
+// Copyright 2024 Samuel Stanley
+
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include "Snapshot.hpp"
+
+// Convert a universe text file to a binary snapshot, or a binary snapshot to universe text
+int main(int argc, char* argv[]) {
+    if (argc != 3) {
+        std::cerr << "Syntax: ./NBodyConvert (input file) (output file)" << std::endl;
+        return 1;
+    }
+    std::string input(argv[1]);
+    std::string output(argv[2]);
+
+    try {
+        if (NB::isSnapshotFile(input)) {
+            std::ofstream out(output);
+            NB::writeText(out, NB::SnapshotView(input).data());
+            if (!out)
+                throw std::invalid_argument("Error: file '" + output + "' could not be written");
+        } else {
+            NB::writeSnapshotFile(output, NB::readTextFile(input));
+        }
+    } catch (const std::invalid_argument& error) {
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
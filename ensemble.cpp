@@ -0,0 +1,95 @@
+// Copyright 2024 Samuel Stanley
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "CommandLine.hpp"
+#include "Ensemble.hpp"
+#include "ForceKernels.hpp"
+#include "ThreadPool.hpp"
+
+// Run every member of an ensemble file for T seconds on every core, without textures or a
+// window, and write one summary row per member and optionally each member's final state
+
+namespace {
+
+struct EnsembleOptions {
+    double T = 0.0;
+    std::string file;
+    std::string integrator = "leapfrog";
+    double softening = 0.0;
+    unsigned int threads = 1;
+    std::string out;              // Directory for the final states, or empty for none
+    NB::KernelIsa isa = NB::detectIsa();
+};
+
+// Return the options given on the command line. If one is invalid, std::invalid_argument is
+// thrown
+EnsembleOptions parseEnsembleOptions(int argc, char* argv[]) {
+    if (argc < 3)
+        throw std::invalid_argument("Error: insufficient command line arguments");
+    EnsembleOptions options;
+    options.T = NB::nonNegativeReal("T", argv[1]);
+    options.file = argv[2];
+    for (int i = 3; i < argc; i++) {
+        std::string option(argv[i]);
+        if (i + 1 >= argc)
+            throw std::invalid_argument("Error: missing value for " + option);
+        std::string value(argv[++i]);
+        if (option == "--integrator")
+            options.integrator = value;
+        else if (option == "--softening")
+            options.softening = NB::nonNegativeReal(option, value);
+        else if (option == "--threads")
+            options.threads = NB::positiveInteger(option, value);
+        else if (option == "--out")
+            options.out = value;
+        else if (option == "--isa")
+            options.isa = NB::isaFromName(value);
+        else
+            throw std::invalid_argument("Error: unknown option " + option);
+    }
+    return options;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        EnsembleOptions options;
+        try {
+            options = parseEnsembleOptions(argc, argv);
+        } catch (const std::invalid_argument&) {
+            std::cerr << "Syntax: ./NBodyEnsemble (T) (ensemble file) [--integrator "
+                "euler|leapfrog] [--softening S] [--threads N] [--out DIR] [--isa NAME]"
+                << std::endl;
+            throw;
+        }
+
+        std::vector<NB::EnsembleMember> members = NB::readEnsembleFile(options.file);
+        NB::ThreadPool pool(options.threads);
+        const auto start = std::chrono::steady_clock::now();
+        NB::runEnsemble(members, options.T, options.integrator, options.softening, pool,
+            options.isa);
+        double seconds =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        uint64_t steps = 0;
+        for (const NB::EnsembleMember& member : members)
+            steps += member.steps;
+        std::cerr << "Ran " << members.size() << " members for " << steps << " steps in "
+            << seconds << " s (" << (seconds > 0 ? members.size() / seconds : 0.0)
+            << " members per second)" << std::endl;
+
+        NB::writeEnsembleSummary(std::cout, members);
+        if (!options.out.empty())
+            NB::writeEnsembleStates(options.out, members);
+    } catch (const std::invalid_argument& error) {
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
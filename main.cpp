@@ -1,30 +1,214 @@
 // Copyright 2024 Samuel Stanley
 
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <exception>
 #include <iostream>
+#include <memory>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <SFML/Graphics.hpp>
 #include <SFML/Audio.hpp>
 #include "Universe.hpp"
 #include "CelestialBody.hpp"
 #include "Constants.hpp"
+#include "Options.hpp"
+#include "BarnesHut.hpp"
+#include "Fmm.hpp"
+#include "Trajectory.hpp"
+#include "Checkpoint.hpp"
+#include "TripleBuffer.hpp"
+#include "Profiler.hpp"
+#include "Conserved.hpp"
+#include "FrameExport.hpp"
+
+namespace {
+
+// Write how many steps were taken in seconds and the rate to err
+void reportRate(std::ostream& err, uint64_t steps, double seconds) {
+    err << "Stepped " << steps << " times in " << seconds << " s ("
+        << (seconds > 0 ? steps / seconds : 0.0) << " steps per second)\n";
+}
+
+}  // namespace
 
 int main(int argc, char* argv[]) {
     // Get command line arguments
-    if (argc < 3) {
-        throw std::invalid_argument("Error: insufficient command line arguments");
-    }
-    double T = std::stod(std::string(argv[1]));
-    double dt = std::stod(std::string(argv[2]));
+    NB::Options options = NB::parseOptions(argc, argv);
+    double T = options.T;
+    double dt = options.dt;
 
     NB::Universe universe;
-    std::cin >> universe;
+    universe.setThreads(options.threads);
+    universe.setForceEngine(NB::makeForceEngine(options));
+    universe.setIntegrator(NB::makeIntegrator(options.integrator));
+    universe.setMergeRadius(options.merge_radius);
+    universe.setReorderInterval(options.reorder, NB::curveFromName(options.curve));
+    universe.setHeadless(options.headless || options.theta_report || options.order_report ||
+        options.precision_report);
+    universe.setRenderMode(NB::renderModeFromName(options.render));
+    NB::Profiler& profiler = universe.profiler();
+    profiler.setEnabled(options.profile);
+    const auto start = std::chrono::steady_clock::now();
+    auto elapsed = [&start]() {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    // Continue from a checkpoint instead of reading a new universe from stdin
+    uint64_t steps = 0;
+    double time_passed = 0;
+    if (!options.resume.empty()) {
+        NB::Checkpoint checkpoint = NB::readCheckpointFile(options.resume);
+        universe.restore(checkpoint);
+        steps = checkpoint.step;
+        time_passed = checkpoint.time;
+    } else {
+        std::cin >> universe;
+    }
+
+    if (options.theta_report) {
+        NB::writeAccuracyReport(std::cout, NB::barnesHutAccuracy(universe.particles(),
+            universe.threadPool(), {0.1, 0.2, 0.3, 0.5, 0.7, 1.0}));
+        return 0;
+    }
+    if (options.precision_report) {
+        NB::writePrecisionReport(std::cout, NB::mixedPrecisionAccuracy(universe.particles(),
+            universe.threadPool(), options.softening));
+        return 0;
+    }
+    if (options.order_report) {
+        NB::writeFmmAccuracyReport(std::cout, NB::fmmAccuracy(universe.particles(),
+            universe.threadPool(), {2, 4, 6, 8, 10, 12}, options.theta));
+        return 0;
+    }
+
+    // Stream the starting state and then every options.every steps to the trajectory file. A
+    // resumed run continues the trajectory its checkpoint came from, which has the starting state
+    std::unique_ptr<NB::TrajectoryWriter> trajectory;
+    if (!options.trajectory.empty()) {
+        trajectory = std::make_unique<NB::TrajectoryWriter>(options.trajectory,
+            options.trajectory_format, options.fields, options.bodies, universe.numPlanets(),
+            !options.resume.empty());
+        if (!trajectory->appending())
+            trajectory->record(steps, time_passed, universe.particles(), universe.slots());
+    }
+
+    // Log the conserved quantities at the start and every options.conserved_every steps, and
+    // warn the first time the energy drifts further than options.drift_warn
+    std::unique_ptr<NB::ConservedLog> conserved;
+    bool drift_warned = false;
+    auto logConserved = [&]() {
+        double drift = conserved->record(steps, time_passed, universe.conserved());
+        if (options.drift_warn > 0 && !drift_warned && std::abs(drift) > options.drift_warn) {
+            std::cerr << "Warning: energy drift " << drift << " at step " << steps
+                << " exceeds " << options.drift_warn << std::endl;
+            drift_warned = true;
+        }
+    };
+    if (!options.conserved.empty()) {
+        conserved = std::make_unique<NB::ConservedLog>(options.conserved);
+        logConserved();
+    }
+
+    // Render the starting state and then every options.export_every steps off screen, and hand
+    // the frames to the exporter's background threads
+    std::unique_ptr<NB::FrameExporter> exporter;
+    sf::RenderTexture export_target;
+    auto exportFrame = [&]() {
+        export_target.clear();
+        export_target.draw(universe);
+        export_target.display();
+        NB::ScopedTimer timer(profiler, NB::Phase::Output);
+        exporter->add(steps / options.export_every, export_target);
+    };
+    if (!options.export_target.empty()) {
+        if (!export_target.create(options.export_width, options.export_height))
+            throw std::invalid_argument("Error: no off-screen render target could be made");
+        exporter = std::make_unique<NB::FrameExporter>(options.export_target,
+            sf::Vector2u(options.export_width, options.export_height), options.export_threads);
+        if (steps % options.export_every == 0)
+            exportFrame();
+    }
+
+    auto advance = [&]() {
+        universe.step(dt);
+        steps++;
+        time_passed += dt;
+        if (exporter && steps % options.export_every == 0)
+            exportFrame();
+        NB::ScopedTimer timer(profiler, NB::Phase::Output);
+        if (trajectory && steps % options.every == 0)
+            trajectory->record(steps, time_passed, universe.particles(), universe.slots());
+        if (!options.checkpoint.empty() && steps % options.checkpoint_every == 0)
+            NB::writeCheckpointFile(options.checkpoint, universe.checkpoint(steps, time_passed));
+        if (conserved && steps % options.conserved_every == 0)
+            logConserved();
+        if (options.profile_every && steps % options.profile_every == 0)
+            profiler.writeReport(std::cerr, elapsed());
+    };
+
+    const uint64_t first_step = steps;
+
+    // Close the output files, then report and write the final state
+    auto finish = [&]() {
+        {
+            NB::ScopedTimer timer(profiler, NB::Phase::Output);
+            if (trajectory)
+                trajectory->finish();
+            if (conserved)
+                conserved->close();
+            if (exporter)
+                exporter->finish();
+        }
+        reportRate(std::cerr, steps - first_step, elapsed());
+        if (options.merge_radius > 0)
+            std::cerr << "Merged away " << universe.merged() << " particles" << std::endl;
+        std::cout << universe;
+        if (options.profile)
+            profiler.writeReport(std::cerr, elapsed());
+    };
+
+    if (options.headless || exporter) {
+        // Step as fast as possible without a window, drawing only the exported frames
+        while (time_passed < T)
+            advance();
+
+        finish();
+        return 0;
+    }
+
+    // Step on a thread of its own as fast as possible, publishing the positions after every
+    // step. The window draws the latest published positions at its own rate, so neither waits
+    // for the other
+    NB::TripleBuffer<NB::PositionFrame> frames;
+    universe.savePositions(frames.back(), steps, time_passed);
+    frames.publish();
+    std::atomic<bool> stop(false);
+    std::atomic<bool> finished(false);
+    std::exception_ptr failure;
+    std::thread physics([&]() {
+        try {
+            while (!stop.load(std::memory_order_relaxed) && time_passed < T) {
+                advance();
+                universe.savePositions(frames.back(), steps, time_passed);
+                frames.publish();
+            }
+        } catch (...) {
+            failure = std::current_exception();
+        }
+        finished.store(true);
+    });
 
     sf::VideoMode mode(800, 800);
     sf::RenderWindow window(mode, "NBody Simulation");
+    window.setVerticalSyncEnabled(true);
 
-    double time_passed = 0;
-
+    // Show the rate the physics thread reaches in the title, updated every second
+    uint64_t title_step = first_step;
+    double title_time = 0;
     while (window.isOpen()) {
         sf::Event event;
         while (window.pollEvent(event)) {
@@ -32,19 +216,32 @@ int main(int argc, char* argv[]) {
                 window.close();
         }
 
-        if (time_passed >= T)
-            window.close();
-
-        universe.step(dt);
-
+        // The last frame is published before finished is set, so it is still drawn
+        bool done = finished.load();
+        frames.update();
+        const NB::PositionFrame& frame = frames.front();
         window.clear();
-        window.draw(universe);
+        universe.drawFrame(window, frame);
         window.display();
+        if (done)
+            window.close();
 
-        time_passed += dt;
+        double now = elapsed();
+        if (now - title_time >= 1.0) {
+            double rate = (frame.step - title_step) / (now - title_time);
+            window.setTitle("NBody Simulation - " + std::to_string(static_cast<uint64_t>(rate)) +
+                " steps/s");
+            title_step = frame.step;
+            title_time = now;
+        }
     }
 
-    std::cout << universe;
+    stop.store(true);
+    physics.join();
+    if (failure)
+        std::rethrow_exception(failure);
+
+    finish();
 
     return 0;
 }
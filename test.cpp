@@ -5,8 +5,31 @@
 #include <fstream>
 #include <string>
 #include <limits>
+#include <vector>
+#include <cmath>
+#include <filesystem>
+#include <thread>
+#include <chrono>
+#include <iomanip>
 #include "Universe.hpp"
 #include "CelestialBody.hpp"
+#include "Constants.hpp"
+#include "Options.hpp"
+#include "BarnesHut.hpp"
+#include "Fmm.hpp"
+#include "Integrator.hpp"
+#include "Snapshot.hpp"
+#include "Trajectory.hpp"
+#include "Checkpoint.hpp"
+#include "Renderer.hpp"
+#include "TripleBuffer.hpp"
+#include "Profiler.hpp"
+#include "Conserved.hpp"
+#include "Collisions.hpp"
+#include "Ensemble.hpp"
+#include "SmallKernels.hpp"
+#include "SpaceFillingCurve.hpp"
+#include "FrameExport.hpp"
 
 #define BOOST_TEST_DYN_LINK
 #define BOOST_TEST_MODULE Main
@@ -254,3 +277,1085 @@ BOOST_AUTO_TEST_CASE(parallelVelocity) {
     BOOST_CHECK_CLOSE(universe[2].velocity().x, 0.0, 0.001);
     BOOST_CHECK_CLOSE(universe[2].velocity().y, 0.0, 0.001);
 }
+
+BOOST_AUTO_TEST_CASE(forceLookup) {
+    NB::Universe universe("Test Files/horizontalGravity.txt");
+    BOOST_REQUIRE_EQUAL(universe.numPlanets(), 2);
+    BOOST_REQUIRE_EQUAL(universe[0].index(), 0);
+    BOOST_REQUIRE_EQUAL(universe[1].index(), 1);
+
+    sf::Vector2<double> force0 = universe.getForce(universe[0]);
+    sf::Vector2<double> force1 = universe.getForce(universe[1]);
+    BOOST_CHECK(universe.calculatedForces());
+    BOOST_CHECK_CLOSE(force0.x, 8.3375e-7, 0.001);
+    BOOST_CHECK_CLOSE(force1.x, -8.3375e-7, 0.001);
+    BOOST_CHECK_SMALL(force0.y, 1e-20);
+    BOOST_CHECK_SMALL(force1.y, 1e-20);
+}
+
+BOOST_AUTO_TEST_CASE(particleStore) {
+    NB::Universe universe("Test Files/3body.txt");
+    const NB::ParticleStore& particles = universe.particles();
+    BOOST_REQUIRE_EQUAL(particles.size(), 3);
+    for (const double* array : {particles.x.data(), particles.y.data(), particles.vx.data(),
+        particles.vy.data(), particles.mass.data(), particles.ax.data(), particles.ay.data()}) {
+        BOOST_CHECK_EQUAL(reinterpret_cast<uintptr_t>(array) % NB::particle_alignment, 0);
+    }
+
+    BOOST_CHECK_CLOSE(particles.y[1], 4.5e10, 0.001);
+    BOOST_CHECK_CLOSE(particles.vx[2], -3e4, 0.001);
+    BOOST_CHECK_CLOSE(particles.mass[0], 5.974e24, 0.001);
+
+    // The views read straight from the store
+    universe.particles().x[0] = 1.0e9;
+    BOOST_CHECK_CLOSE(universe[0].position().x, 1.0e9, 0.001);
+}
+
+BOOST_AUTO_TEST_CASE(vectorKernelsMatchScalar) {
+    // Check every supported instruction set against the scalar reference on every scenario
+    for (const auto& entry : std::filesystem::directory_iterator("nbody")) {
+        if (entry.path().extension() != ".txt")
+            continue;
+        NB::Universe universe(entry.path().string());
+        const NB::ParticleStore& particles = universe.particles();
+        size_t n = particles.size();
+
+        // Rounding error scales with the sum of the magnitudes of the terms, not with their
+        // (possibly cancelling) total. Softening only makes the terms smaller
+        std::vector<double> scale(n, 0.0);
+        for (size_t i = 0; i < n; i++) {
+            for (size_t j = 0; j < n; j++) {
+                double dx = particles.x[j] - particles.x[i];
+                double dy = particles.y[j] - particles.y[i];
+                if (dx != 0.0 || dy != 0.0)
+                    scale[i] += G * std::abs(particles.mass[j]) / (dx * dx + dy * dy);
+            }
+        }
+
+        for (double softening : {0.0, 1e-2 * universe.radius()}) {
+            double softening_sqrd = softening * softening;
+            std::vector<double> ref_x(n), ref_y(n), ref_p(n);
+            NB::forceKernel(NB::KernelIsa::Scalar)(particles, 0, n, ref_x.data(), ref_y.data(),
+                ref_p.data(), softening_sqrd);
+            for (NB::KernelIsa isa : NB::supportedIsas()) {
+                std::vector<double> ax(n), ay(n), potential(n);
+                NB::forceKernel(isa)(particles, 0, n, ax.data(), ay.data(), potential.data(),
+                    softening_sqrd);
+                for (size_t i = 0; i < n; i++) {
+                    double error = std::hypot(ax[i] - ref_x[i], ay[i] - ref_y[i]);
+                    BOOST_CHECK_MESSAGE(error <= 1e-12 * scale[i], entry.path().string() << " "
+                        << NB::isaName(isa) << " particle " << i << " error " << error);
+                    BOOST_CHECK_CLOSE(potential[i], ref_p[i], 1e-9);
+                }
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(smallKernelsMatchScalar) {
+    // The first n particles of a galaxy, for every n with specialized kernels
+    NB::UniverseData galaxy = NB::readTextFile("nbody/galaxy.txt");
+    BOOST_CHECK(!NB::smallKernels(0));
+    BOOST_CHECK(!NB::smallKernels(NB::max_small_n + 1));
+    for (size_t n = 1; n <= NB::max_small_n; n++) {
+        NB::ParticleStore particles;
+        for (size_t i = 0; i < n; i++) {
+            particles.add(galaxy.particles.x[i], galaxy.particles.y[i], galaxy.particles.vx[i],
+                galaxy.particles.vy[i], galaxy.particles.mass[i]);
+        }
+        // Two coincident particles, which both kernels skip
+        if (n > 2)
+            particles.x[n - 1] = particles.x[n - 2], particles.y[n - 1] = particles.y[n - 2];
+
+        NB::SmallKernels small = NB::smallKernels(n);
+        BOOST_REQUIRE(small);
+        for (double softening_sqrd : {0.0, 1e18}) {
+            std::vector<double> ref_x(n), ref_y(n), ref_p(n);
+            NB::forceKernel(NB::KernelIsa::Scalar)(particles, 0, n, ref_x.data(), ref_y.data(),
+                ref_p.data(), softening_sqrd);
+            small.forces(particles, softening_sqrd);
+            for (size_t i = 0; i < n; i++) {
+                BOOST_CHECK_EQUAL(particles.ax[i], ref_x[i]);
+                BOOST_CHECK_EQUAL(particles.ay[i], ref_y[i]);
+                BOOST_CHECK_EQUAL(particles.potential[i], ref_p[i]);
+            }
+        }
+
+        NB::ParticleStore moved = particles;
+        small.kick(moved, 10.0);
+        small.drift(moved, 10.0);
+        for (size_t i = 0; i < n; i++) {
+            BOOST_CHECK_EQUAL(moved.vx[i], particles.vx[i] + 10.0 * particles.ax[i]);
+            BOOST_CHECK_EQUAL(moved.x[i], particles.x[i] + 10.0 * moved.vx[i]);
+        }
+    }
+
+    // The float kernels follow the double ones to float precision on a system in units where
+    // every term fits in a float
+    const float x[3] = {0.0f, 1.0f, -2.0f};
+    const float y[3] = {0.5f, -1.0f, 0.25f};
+    const float mass[3] = {1.0f, 2.0f, 3.0f};
+    float ax[3], ay[3], potential[3];
+    NB::smallForces<3>(x, y, mass, ax, ay, potential, 0.0f);
+    const double dx[3] = {0.0, 1.0, -2.0};
+    const double dy[3] = {0.5, -1.0, 0.25};
+    const double dmass[3] = {1.0, 2.0, 3.0};
+    double dax[3], day[3], dpotential[3];
+    NB::smallForces<3>(dx, dy, dmass, dax, day, dpotential, 0.0);
+    for (size_t i = 0; i < 3; i++) {
+        BOOST_CHECK_CLOSE(ax[i], dax[i], 1e-4);
+        BOOST_CHECK_CLOSE(ay[i], day[i], 1e-4);
+        BOOST_CHECK_CLOSE(potential[i], dpotential[i], 1e-4);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(mixedPrecision) {
+    // Far from the origin, where float positions in SI units could not resolve the galaxy
+    NB::Universe universe("nbody/galaxy.txt");
+    NB::ParticleStore& particles = universe.particles();
+    for (size_t i = 0; i < particles.size(); i++) {
+        particles.x[i] += 1e16;
+        particles.y[i] -= 3e15;
+    }
+    size_t n = particles.size();
+
+    NB::FloatParticles floats;
+    floats.assign(particles);
+    BOOST_REQUIRE_EQUAL(floats.size(), n);
+    for (size_t i = 0; i < n; i++) {
+        BOOST_CHECK_LE(std::abs(floats.x[i]), 1.0f);
+        BOOST_CHECK_LE(std::abs(floats.y[i]), 1.0f);
+        BOOST_CHECK_LE(floats.mass[i], 1.0f);
+    }
+
+    // Every instruction set stays close to the scalar mixed kernel and to double precision
+    std::vector<double> ref_x(n), ref_y(n), ref_p(n), exact_x(n), exact_y(n), exact_p(n);
+    NB::mixedForceKernel(NB::KernelIsa::Scalar)(floats, 0, n, ref_x.data(), ref_y.data(),
+        ref_p.data(), 0.0);
+    NB::forceKernel(NB::KernelIsa::Scalar)(particles, 0, n, exact_x.data(), exact_y.data(),
+        exact_p.data(), 0.0);
+    for (NB::KernelIsa isa : NB::supportedIsas()) {
+        std::vector<double> ax(n), ay(n), potential(n);
+        NB::mixedForceKernel(isa)(floats, 0, n, ax.data(), ay.data(), potential.data(), 0.0);
+        for (size_t i = 0; i < n; i++) {
+            BOOST_CHECK_CLOSE(ax[i], ref_x[i], 1e-6);
+            BOOST_CHECK_CLOSE(potential[i], ref_p[i], 1e-6);
+        }
+    }
+
+    NB::DirectEngine engine(NB::detectIsa(), NB::Precision::Mixed);
+    BOOST_CHECK_EQUAL(NB::precisionName(engine.precision()), "mixed");
+    engine.computeAccelerations(particles, universe.threadPool());
+    BOOST_CHECK_LT(NB::accelerationError(particles, exact_x, exact_y).rms_error, 1e-4);
+
+    NB::PrecisionAccuracy accuracy = NB::mixedPrecisionAccuracy(particles,
+        universe.threadPool(), 0.0);
+    std::stringstream report;
+    NB::writePrecisionReport(report, accuracy);
+    BOOST_TEST_MESSAGE(report.str());
+    BOOST_CHECK_GT(accuracy.rms_error, 0.0);
+    BOOST_CHECK_LT(accuracy.rms_error, 1e-4);
+    BOOST_CHECK_LT(accuracy.potential_error, 1e-5);
+
+    BOOST_CHECK(NB::precisionFromName("double") == NB::Precision::Double);
+    BOOST_CHECK_THROW(NB::precisionFromName("half"), std::invalid_argument);
+    const char* mixed[] = {"NBody", "1", "1", "--precision", "mixed"};
+    BOOST_CHECK_EQUAL(NB::parseOptions(5, mixed).precision, "mixed");
+    const char* tree[] = {"NBody", "1", "1", "--precision", "mixed", "--engine", "barneshut"};
+    BOOST_CHECK_THROW(NB::parseOptions(7, tree), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(threadedStepsAreDeterministic) {
+    NB::Universe serial("nbody/galaxy.txt");
+    NB::Universe threaded1("nbody/galaxy.txt");
+    NB::Universe threaded2("nbody/galaxy.txt");
+    threaded1.setThreads(4);
+    threaded2.setThreads(4);
+    BOOST_REQUIRE_EQUAL(threaded1.threads(), 4);
+
+    for (int step = 0; step < 10; step++) {
+        serial.step(25000);
+        threaded1.step(25000);
+        threaded2.step(25000);
+    }
+
+    // Each thread owns whole rows of the force pass, so every thread count gives the same bits
+    BOOST_CHECK(threaded1.particles().x == threaded2.particles().x);
+    BOOST_CHECK(threaded1.particles().vy == threaded2.particles().vy);
+    BOOST_CHECK(serial.particles().x == threaded1.particles().x);
+    BOOST_CHECK(serial.particles().vy == threaded1.particles().vy);
+}
+
+BOOST_AUTO_TEST_CASE(commandLineOptions) {
+    const char* args[] = {"NBody", "1e6", "2.5e4", "--threads", "8"};
+    NB::Options options = NB::parseOptions(5, args);
+    BOOST_CHECK_CLOSE(options.T, 1e6, 0.001);
+    BOOST_CHECK_CLOSE(options.dt, 2.5e4, 0.001);
+    BOOST_CHECK_EQUAL(options.threads, 8);
+
+    const char* zero_threads[] = {"NBody", "1e6", "2.5e4", "--threads", "0"};
+    BOOST_CHECK_THROW(NB::parseOptions(5, zero_threads), std::invalid_argument);
+    const char* missing[] = {"NBody", "1e6", "2.5e4", "--threads"};
+    BOOST_CHECK_THROW(NB::parseOptions(4, missing), std::invalid_argument);
+    const char* unknown[] = {"NBody", "1e6", "2.5e4", "--bogus"};
+    BOOST_CHECK_THROW(NB::parseOptions(4, unknown), std::invalid_argument);
+    BOOST_CHECK_THROW(NB::parseOptions(2, args), std::invalid_argument);
+    // A step that is not positive would never let the run reach T
+    for (const char* dt : {"0", "-1", "nan", "inf", "1s"}) {
+        const char* bad_dt[] = {"NBody", "1e6", dt};
+        BOOST_CHECK_THROW(NB::parseOptions(3, bad_dt), std::invalid_argument);
+    }
+    // and an infinite T would never end
+    for (const char* T : {"-1", "inf"}) {
+        const char* bad_T[] = {"NBody", T, "2.5e4"};
+        BOOST_CHECK_THROW(NB::parseOptions(3, bad_T), std::invalid_argument);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(barnesHutAccuracy) {
+    NB::Universe universe("nbody/uniform100.txt");
+    std::vector<NB::ThetaAccuracy> accuracy = NB::barnesHutAccuracy(universe.particles(),
+        universe.threadPool(), {0.0, 0.3, 0.5, 1.0});
+    BOOST_REQUIRE_EQUAL(accuracy.size(), 4);
+    std::stringstream report;
+    NB::writeAccuracyReport(report, accuracy);
+    BOOST_TEST_MESSAGE(report.str());
+
+    // theta = 0 opens every node, so it is direct summation in a different order
+    BOOST_CHECK_SMALL(accuracy[0].max_error, 1e-9);
+    BOOST_CHECK_LT(accuracy[1].rms_error, 5e-2);
+    BOOST_CHECK_LE(accuracy[1].rms_error, accuracy[2].rms_error);
+    BOOST_CHECK_LE(accuracy[2].rms_error, accuracy[3].rms_error);
+}
+
+BOOST_AUTO_TEST_CASE(barnesHutSteps) {
+    NB::Universe direct("Test Files/3body.txt");
+    NB::Universe tree("Test Files/3body.txt");
+    tree.setForceEngine(std::make_unique<NB::BarnesHutEngine>(0.5));
+    BOOST_CHECK_EQUAL(tree.forceEngine().name(), "barneshut");
+
+    for (int step = 0; step < 100; step++) {
+        direct.step(25000);
+        tree.step(25000);
+    }
+    for (size_t i = 0; i < 3; i++) {
+        BOOST_CHECK_SMALL(tree[i].position().x - direct[i].position().x, 1e-4f * 1.25e11f);
+        BOOST_CHECK_SMALL(tree[i].position().y - direct[i].position().y, 1e-4f * 1.25e11f);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(fmmAccuracy) {
+    NB::Universe universe("nbody/galaxy.txt");
+    std::vector<NB::FmmAccuracy> accuracy = NB::fmmAccuracy(universe.particles(),
+        universe.threadPool(), {2, 4, 8}, 0.5);
+    BOOST_REQUIRE_EQUAL(accuracy.size(), 3);
+    std::stringstream report;
+    NB::writeFmmAccuracyReport(report, accuracy);
+    BOOST_TEST_MESSAGE(report.str());
+
+    BOOST_CHECK_LT(accuracy[1].rms_error, accuracy[0].rms_error);
+    BOOST_CHECK_LT(accuracy[2].rms_error, accuracy[1].rms_error);
+    BOOST_CHECK_LT(accuracy[2].rms_error, 1e-4);
+
+    BOOST_CHECK_THROW(NB::FmmEngine(0), std::invalid_argument);
+    BOOST_CHECK_THROW(NB::FmmEngine(NB::max_fmm_order + 1), std::invalid_argument);
+    BOOST_CHECK_THROW(NB::FmmEngine(6, 1.0), std::invalid_argument);
+    BOOST_CHECK_THROW(NB::FmmEngine(6, 0.5, 0), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(fmmStepsAreDeterministic) {
+    NB::Universe serial("nbody/galaxy.txt");
+    NB::Universe threaded("nbody/galaxy.txt");
+    serial.setForceEngine(std::make_unique<NB::FmmEngine>());
+    threaded.setForceEngine(std::make_unique<NB::FmmEngine>());
+    threaded.setThreads(4);
+    BOOST_CHECK_EQUAL(threaded.forceEngine().name(), "fmm");
+
+    for (int step = 0; step < 10; step++) {
+        serial.step(25000);
+        threaded.step(25000);
+    }
+
+    // The tree is split into subtrees by particle count alone, so threads only change who
+    // evaluates each subtree
+    BOOST_CHECK(serial.particles().x == threaded.particles().x);
+    BOOST_CHECK(serial.particles().vy == threaded.particles().vy);
+}
+
+BOOST_AUTO_TEST_CASE(headless) {
+    NB::Universe universe("Test Files/3body.txt", true);
+    BOOST_REQUIRE(universe.headless());
+    BOOST_REQUIRE_EQUAL(universe.numPlanets(), 3);
+    BOOST_CHECK_EQUAL(universe[0].textureName(), "earth.gif");
+    BOOST_CHECK_EQUAL(universe[1].textureName(), "sun.gif");
+
+    // No textures are loaded, but the output format is unchanged
+    BOOST_CHECK(universe[1].texture() == nullptr);
+    NB::Universe rendered("Test Files/3body.txt");
+    uint32_t sun = rendered.textureIndex("sun.gif");
+    BOOST_CHECK_EQUAL(rendered.textureName(sun), "sun.gif");
+    BOOST_CHECK_EQUAL(rendered[1].texture(), rendered.texture(sun));
+    BOOST_CHECK(rendered.texture(sun) != nullptr);
+    universe.step(25000);
+    rendered.step(25000);
+    std::stringstream headless_out, rendered_out;
+    headless_out << universe;
+    rendered_out << rendered;
+    BOOST_CHECK_EQUAL(headless_out.str(), rendered_out.str());
+}
+
+// Return how far the earth in circularOrbit.txt is from its start after one period taken in
+// steps timesteps by integrator, relative to the orbit radius
+double orbitError(const std::string& integrator, int steps) {
+    const double period = 31564357.248845227;
+    NB::Universe universe("Test Files/circularOrbit.txt", true);
+    universe.setIntegrator(NB::makeIntegrator(integrator));
+    for (int step = 0; step < steps; step++)
+        universe.step(period / steps);
+    const NB::ParticleStore& particles = universe.particles();
+    return std::hypot(particles.x[1] - 1.496e11, particles.y[1]) / 1.496e11;
+}
+
+BOOST_AUTO_TEST_CASE(integrators) {
+    double euler = orbitError("euler", 200);
+    double leapfrog = orbitError("leapfrog", 200);
+    double yoshida = orbitError("yoshida4", 200);
+    double rk4 = orbitError("rk4", 200);
+    BOOST_TEST_MESSAGE("euler " << euler << " leapfrog " << leapfrog << " yoshida4 " << yoshida
+        << " rk4 " << rk4);
+    BOOST_CHECK_LT(leapfrog, euler);
+    BOOST_CHECK_LT(yoshida, leapfrog);
+    BOOST_CHECK_LT(rk4, leapfrog);
+
+    // Halving the timestep cuts the error by about 2^order
+    BOOST_CHECK_GT(leapfrog / orbitError("leapfrog", 400), 3.0);
+    BOOST_CHECK_GT(yoshida / orbitError("yoshida4", 400), 12.0);
+    BOOST_CHECK_GT(rk4 / orbitError("rk4", 400), 12.0);
+
+    BOOST_CHECK_THROW(NB::makeIntegrator("verlet"), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(blockTimesteps) {
+    // A planet on a 2.2 day orbit and one on a 1 year orbit around the same sun
+    NB::Universe universe("Test Files/hierarchical.txt", true);
+    auto block = std::make_unique<NB::BlockIntegrator>(0.02, 12);
+    NB::BlockIntegrator& integrator = *block;
+    universe.setIntegrator(std::move(block));
+    BOOST_CHECK_EQUAL(universe.integrator().name(), "block");
+
+    const double period = 31564357.248845227;
+    const int steps = 100;
+    for (int step = 0; step < steps; step++)
+        universe.step(period / steps);
+
+    // The inner planet takes much finer steps than the outer one
+    BOOST_REQUIRE_EQUAL(integrator.levels().size(), 3);
+    BOOST_CHECK_GE(integrator.levels()[1], integrator.levels()[2] + 4);
+    BOOST_TEST_MESSAGE("levels " << int(integrator.levels()[0]) << " "
+        << int(integrator.levels()[1]) << " " << int(integrator.levels()[2])
+        << " accelerations " << integrator.accelerationsComputed());
+
+    // The sun shares the inner planet's timescale, so a shared finest step would need about
+    // half as many accelerations again as the outer planet's coarse steps add
+    uint64_t shared = 3 * steps * (uint64_t(1) << integrator.levels()[1]);
+    BOOST_CHECK_LT(integrator.accelerationsComputed(), shared * 3 / 4);
+
+    // and both orbits stay accurate
+    const NB::ParticleStore& particles = universe.particles();
+    BOOST_CHECK_CLOSE(std::hypot(particles.x[1], particles.y[1]), 5.0e9, 1.0);
+    BOOST_CHECK_SMALL(std::hypot(particles.x[2] - 1.496e11, particles.y[2]) / 1.496e11, 1e-2);
+    BOOST_CHECK_LT(orbitError("block", 200), orbitError("leapfrog", 200));
+
+    // A body released from rest in a strong field has no velocity to size its first step by,
+    // so it starts fine rather than falling the whole step in one go. Falling most of the way
+    // in, its speed still matches the energy it gained
+    NB::ParticleStore released;
+    released.add(0, 0, 0, 0, 2e30);
+    released.add(1e9, 0, 0, 0, 1);
+    NB::ThreadPool pool(1);
+    NB::DirectEngine engine;
+    NB::BlockIntegrator fall(0.02, 12);
+    fall.step(released, pool, 2500, [&](const std::vector<size_t>*) {
+        engine.computeAccelerations(released, pool);
+    }, false);
+    double r = std::hypot(released.x[1] - released.x[0], released.y[1] - released.y[0]);
+    double speed = std::hypot(released.vx[1], released.vy[1]);
+    BOOST_TEST_MESSAGE("released r " << r << " level " << int(fall.levels()[1]));
+    BOOST_CHECK_CLOSE(speed * speed / 2, G * 2e30 * (1 / r - 1 / 1e9), 1.0);
+
+    BOOST_CHECK_THROW(NB::BlockIntegrator(0.0), std::invalid_argument);
+    BOOST_CHECK_THROW(NB::BlockIntegrator(0.02, 31), std::invalid_argument);
+}
+
+// Check that every particle, the radius and every texture name of a and b are identical
+void checkSameData(const NB::UniverseData& a, const NB::UniverseData& b, const std::string& name) {
+    BOOST_REQUIRE_EQUAL(a.particles.size(), b.particles.size());
+    BOOST_CHECK_MESSAGE(a.radius == b.radius, name << " radius");
+    BOOST_CHECK_MESSAGE(a.particles.x == b.particles.x && a.particles.y == b.particles.y &&
+        a.particles.vx == b.particles.vx && a.particles.vy == b.particles.vy &&
+        a.particles.mass == b.particles.mass, name << " particles");
+    for (size_t i = 0; i < a.particles.size(); i++) {
+        BOOST_CHECK_EQUAL(a.textures[a.texture_index[i]], b.textures[b.texture_index[i]]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(snapshotRoundTrip) {
+    for (const auto& entry : std::filesystem::directory_iterator("nbody")) {
+        if (entry.path().extension() != ".txt" || entry.path().filename() == "readme.txt")
+            continue;
+        std::string name = entry.path().string();
+        NB::UniverseData data = NB::readTextFile(name);
+
+        // The fast parser reads the same values as formatted input
+        std::ifstream fin(name);
+        size_t count;
+        double radius;
+        fin >> count >> radius;
+        BOOST_REQUIRE_EQUAL(data.particles.size(), count);
+        BOOST_CHECK_EQUAL(data.radius, radius);
+        for (size_t i = 0; i < count; i++) {
+            double x, y, vx, vy, mass;
+            std::string texture;
+            fin >> x >> y >> vx >> vy >> mass >> texture;
+            BOOST_CHECK(data.particles.x[i] == x && data.particles.y[i] == y &&
+                data.particles.vx[i] == vx && data.particles.vy[i] == vy &&
+                data.particles.mass[i] == mass);
+            BOOST_CHECK_EQUAL(data.textures[data.texture_index[i]], texture);
+        }
+
+        // Binary snapshots are read in place with every column aligned
+        std::stringstream binary;
+        NB::writeSnapshot(binary, data);
+        std::string bytes = binary.str();
+        BOOST_REQUIRE(NB::isSnapshot(bytes));
+        NB::SnapshotView view(bytes.data(), bytes.size());
+        BOOST_CHECK_EQUAL(view.size(), count);
+        BOOST_CHECK_EQUAL(reinterpret_cast<uintptr_t>(view.vx()) % 64,
+            reinterpret_cast<uintptr_t>(bytes.data()) % 64);
+        checkSameData(view.data(), data, name);
+
+        // Text written back out parses to the same bits
+        std::stringstream text;
+        NB::writeText(text, data);
+        checkSameData(NB::parseText(text.str()), data, name);
+    }
+
+    // A Universe loads a snapshot file and writes the same state it was read with
+    std::string snapshot = (std::filesystem::temp_directory_path() / "nbody_3body.bin").string();
+    NB::Universe text("nbody/3body.txt", true);
+    NB::writeSnapshotFile(snapshot, text.data());
+    BOOST_CHECK(NB::isSnapshotFile(snapshot));
+    NB::Universe binary(snapshot, true);
+    checkSameData(binary.data(), text.data(), snapshot);
+    std::ifstream snapshot_in(snapshot, std::ios::binary);
+    NB::Universe streamed;
+    streamed.setHeadless(true);
+    snapshot_in >> streamed;
+    checkSameData(streamed.data(), text.data(), snapshot);
+    std::filesystem::remove(snapshot);
+
+    BOOST_CHECK_THROW(NB::parseText("2 1.0\n0 0 0 0 1 a.gif\n"), std::invalid_argument);
+    BOOST_CHECK_THROW(NB::parseText("1 1.0\n0 0 x 0 1 a.gif\n"), std::invalid_argument);
+    BOOST_CHECK_THROW(NB::parseText("/* not a universe */"), std::invalid_argument);
+    std::stringstream truncated;
+    NB::writeSnapshot(truncated, text.data());
+    std::string cut = truncated.str().substr(0, 100);
+    BOOST_CHECK_THROW(NB::SnapshotView(cut.data(), cut.size()), std::invalid_argument);
+
+    std::istringstream malformed("3 1.0\n0 0 0 0 1 a.gif\n");
+    NB::Universe unchanged;
+    unchanged.setHeadless(true);
+    malformed >> unchanged;
+    BOOST_CHECK(malformed.fail());
+    BOOST_CHECK_EQUAL(unchanged.numPlanets(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(trajectoryOutput) {
+    const char* args[] = {"NBody", "1e6", "2.5e4", "--trajectory", "out.bin", "--every", "5",
+        "--trajectory-format", "binary", "--bodies", "0,3-5", "--fields", "y,mass"};
+    NB::Options options = NB::parseOptions(13, args);
+    BOOST_CHECK_EQUAL(options.trajectory, "out.bin");
+    BOOST_CHECK_EQUAL(options.every, 5);
+    BOOST_CHECK(options.trajectory_format == NB::TrajectoryFormat::Binary);
+    BOOST_CHECK(options.bodies == std::vector<size_t>({0, 3, 4, 5}));
+    BOOST_CHECK(options.fields == std::vector<NB::TrajectoryField>({NB::TrajectoryField::Y,
+        NB::TrajectoryField::Mass}));
+    const char* bad_field[] = {"NBody", "1e6", "2.5e4", "--fields", "x,z"};
+    BOOST_CHECK_THROW(NB::parseOptions(5, bad_field), std::invalid_argument);
+    const char* bad_range[] = {"NBody", "1e6", "2.5e4", "--bodies", "4-2"};
+    BOOST_CHECK_THROW(NB::parseOptions(5, bad_range), std::invalid_argument);
+
+    NB::Universe universe("Test Files/3body.txt", true);
+    const std::vector<size_t> bodies = {2, 0};
+    const std::vector<NB::TrajectoryField> fields = {NB::TrajectoryField::X,
+        NB::TrajectoryField::VY};
+    std::string text_name = (std::filesystem::temp_directory_path() /
+        "nbody_trajectory.txt").string();
+    std::string binary_name = (std::filesystem::temp_directory_path() /
+        "nbody_trajectory.bin").string();
+    BOOST_CHECK_THROW(NB::TrajectoryWriter(text_name, NB::TrajectoryFormat::Text, fields, {3},
+        3), std::invalid_argument);
+
+    // Keep every recorded state to compare the files against
+    std::vector<std::vector<double>> expected;
+    {
+        NB::TrajectoryWriter binary(binary_name, NB::TrajectoryFormat::Binary, fields, bodies, 3);
+        // The text trajectory is written in two parts, as by a run and then its resumed run
+        for (bool append : {false, true}) {
+            NB::TrajectoryWriter text(text_name, NB::TrajectoryFormat::Text, fields, bodies, 3,
+                append);
+            BOOST_CHECK_EQUAL(text.appending(), append);
+            for (int step = append ? 2 : 0; step < (append ? 4 : 2); step++) {
+                const NB::ParticleStore& particles = universe.particles();
+                expected.push_back({particles.x[2], particles.x[0], particles.vy[2],
+                    particles.vy[0]});
+                text.record(step, step * 25000.0, particles);
+                binary.record(step, step * 25000.0, particles);
+                universe.step(25000);
+            }
+            BOOST_CHECK_EQUAL(text.framesRecorded(), 2);
+            text.finish();
+        }
+    }
+    BOOST_CHECK_THROW(NB::TrajectoryWriter(text_name, NB::TrajectoryFormat::Text,
+        {NB::TrajectoryField::X}, bodies, 3, true), std::invalid_argument);
+
+    // Text has a header and then one row per body per frame, at full precision
+    std::ifstream text_in(text_name);
+    std::string header;
+    std::getline(text_in, header);
+    BOOST_CHECK_EQUAL(header, "step time index x vy");
+    for (size_t frame = 0; frame < expected.size(); frame++) {
+        for (size_t k = 0; k < bodies.size(); k++) {
+            uint64_t step, index;
+            double time, x, vy;
+            text_in >> step >> time >> index >> x >> vy;
+            BOOST_CHECK_EQUAL(step, frame);
+            BOOST_CHECK_EQUAL(time, frame * 25000.0);
+            BOOST_CHECK_EQUAL(index, bodies[k]);
+            BOOST_CHECK_EQUAL(x, expected[frame][k]);
+            BOOST_CHECK_EQUAL(vy, expected[frame][2 + k]);
+        }
+    }
+
+    // Binary has the header and then fixed-size frames of field columns
+    std::ifstream binary_in(binary_name, std::ios::binary);
+    char magic[8];
+    uint32_t version, byte_order, num_fields, field_ids[2];
+    uint64_t num_bodies, indices[2];
+    binary_in.read(magic, 8);
+    binary_in.read(reinterpret_cast<char*>(&version), 4);
+    binary_in.read(reinterpret_cast<char*>(&byte_order), 4);
+    binary_in.read(reinterpret_cast<char*>(&num_fields), 4);
+    binary_in.read(reinterpret_cast<char*>(field_ids), 8);
+    binary_in.read(reinterpret_cast<char*>(&num_bodies), 8);
+    binary_in.read(reinterpret_cast<char*>(indices), 16);
+    BOOST_CHECK(std::equal(magic, magic + 8, NB::trajectory_magic));
+    BOOST_CHECK_EQUAL(num_fields, 2);
+    BOOST_CHECK_EQUAL(field_ids[1], static_cast<uint32_t>(NB::TrajectoryField::VY));
+    BOOST_CHECK_EQUAL(num_bodies, 2);
+    BOOST_CHECK_EQUAL(indices[0], 2);
+    for (size_t frame = 0; frame < expected.size(); frame++) {
+        uint64_t step;
+        double time, values[4];
+        binary_in.read(reinterpret_cast<char*>(&step), 8);
+        binary_in.read(reinterpret_cast<char*>(&time), 8);
+        binary_in.read(reinterpret_cast<char*>(values), sizeof(values));
+        BOOST_CHECK_EQUAL(step, frame);
+        BOOST_CHECK(std::equal(values, values + 4, expected[frame].begin()));
+    }
+    BOOST_CHECK(binary_in.peek() == EOF);
+
+    std::filesystem::remove(text_name);
+    std::filesystem::remove(binary_name);
+}
+
+BOOST_AUTO_TEST_CASE(checkpointResume) {
+    std::string file_name = (std::filesystem::temp_directory_path() / "nbody.checkpoint").string();
+    for (std::string integrator : {"euler", "leapfrog", "block"}) {
+        NB::Universe uninterrupted("nbody/planets.txt", true);
+        uninterrupted.setIntegrator(NB::makeIntegrator(integrator));
+        for (int step = 0; step < 15; step++)
+            uninterrupted.step(25000);
+        NB::writeCheckpointFile(file_name, uninterrupted.checkpoint(15, 15 * 25000.0));
+        BOOST_CHECK(!std::filesystem::exists(file_name + ".tmp"));
+        for (int step = 0; step < 15; step++)
+            uninterrupted.step(25000);
+
+        NB::Universe resumed;
+        resumed.setHeadless(true);
+        resumed.setIntegrator(NB::makeIntegrator(integrator));
+        NB::Checkpoint checkpoint = NB::readCheckpointFile(file_name);
+        BOOST_CHECK_EQUAL(checkpoint.step, 15);
+        BOOST_CHECK_EQUAL(checkpoint.integrator, integrator);
+        resumed.restore(checkpoint);
+        BOOST_REQUIRE_EQUAL(resumed.numPlanets(), 5);
+        BOOST_CHECK_EQUAL(resumed[4].textureName(), uninterrupted[4].textureName());
+        for (int step = 0; step < 15; step++)
+            resumed.step(25000);
+
+        // Every bit of the state matches the run that was never interrupted
+        const NB::ParticleStore& a = uninterrupted.particles();
+        const NB::ParticleStore& b = resumed.particles();
+        BOOST_CHECK_MESSAGE(a.x == b.x && a.y == b.y && a.vx == b.vx && a.vy == b.vy &&
+            a.ax == b.ax && a.ay == b.ay, integrator);
+        BOOST_CHECK_EQUAL(uninterrupted.integrator().saveState(),
+            resumed.integrator().saveState());
+    }
+
+    // A checkpoint only resumes with the integrator and engine it was taken with
+    NB::Universe other;
+    other.setIntegrator(NB::makeIntegrator("rk4"));
+    BOOST_CHECK_THROW(other.restore(NB::readCheckpointFile(file_name)), std::invalid_argument);
+    BOOST_CHECK_THROW(NB::makeIntegrator("leapfrog")->loadState("x"), std::invalid_argument);
+    std::filesystem::remove(file_name);
+    BOOST_CHECK_THROW(NB::readCheckpointFile(file_name), std::invalid_argument);
+    BOOST_CHECK_THROW(NB::readCheckpointFile("nbody/planets.txt"), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(batchRenderer) {
+    const sf::Vector2u size(800, 600);
+    NB::Universe headless("Test Files/3body.txt", true);
+    headless.renderer().build(headless, size);
+    BOOST_CHECK_EQUAL(headless.renderer().vertexCount(), 0);
+
+    // Group by texture: one batch of two triangles per particle for each texture
+    NB::Universe universe("Test Files/3body.txt");
+    NB::BatchRenderer& renderer = universe.renderer();
+    renderer.build(universe, size);
+    BOOST_CHECK_EQUAL(renderer.vertexCount(), 18);
+    const sf::VertexArray* suns = renderer.vertices(universe[1].texture());
+    BOOST_REQUIRE(suns);
+    BOOST_CHECK(suns == renderer.vertices(universe[2].texture()));
+    BOOST_REQUIRE_EQUAL(suns->getVertexCount(), 12);
+
+    // Each quad is centred where CelestialBody::draw places the sprite
+    const NB::ParticleStore& particles = universe.particles();
+    for (size_t k = 0; k < 2; k++) {
+        const sf::Vertex* quad = &(*suns)[k * 6];
+        double centre_x = (quad[0].position.x + quad[2].position.x) / 2;
+        double centre_y = (quad[0].position.y + quad[2].position.y) / 2;
+        BOOST_CHECK_CLOSE(centre_x, particles.x[k + 1] / universe.radius() * 400 + 400, 1e-3);
+        BOOST_CHECK_CLOSE(centre_y, particles.y[k + 1] / universe.radius() * -300 + 300, 1e-3);
+        BOOST_CHECK_EQUAL(quad[2].texCoords.x, universe[1].texture()->getSize().x);
+    }
+
+    // Points mode draws one vertex per particle regardless of texture
+    universe.setRenderMode(NB::RenderMode::Points);
+    renderer.build(universe, size);
+    BOOST_CHECK_EQUAL(renderer.vertexCount(), 3);
+    BOOST_CHECK(NB::renderModeFromName("points") == NB::RenderMode::Points);
+    BOOST_CHECK_THROW(NB::renderModeFromName("voxels"), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(tripleBuffer) {
+    // Nothing is taken before the first publish, and each publish is taken once
+    NB::TripleBuffer<std::vector<uint64_t>> buffer;
+    BOOST_CHECK(!buffer.update());
+    buffer.back().assign(4, 1);
+    buffer.publish();
+    BOOST_CHECK(buffer.update());
+    BOOST_CHECK(!buffer.update());
+    BOOST_CHECK_EQUAL(buffer.front()[3], 1);
+
+    // Only the latest of several publishes is seen
+    for (uint64_t value = 2; value <= 4; value++) {
+        buffer.back().assign(4, value);
+        buffer.publish();
+    }
+    BOOST_CHECK(buffer.update());
+    BOOST_CHECK_EQUAL(buffer.front()[0], 4);
+
+    // A reader racing a writer only ever sees whole values, in order
+    const uint64_t last = 100000;
+    std::thread writer([&buffer, last]() {
+        for (uint64_t value = 5; value <= last; value++) {
+            buffer.back().assign(4, value);
+            buffer.publish();
+        }
+    });
+    uint64_t seen = 4;
+    bool whole = true;
+    bool ordered = true;
+    while (seen < last) {
+        if (!buffer.update())
+            continue;
+        const std::vector<uint64_t>& value = buffer.front();
+        whole = whole && value.size() == 4 && value[0] == value[3];
+        ordered = ordered && value[0] > seen;
+        seen = value[0];
+    }
+    writer.join();
+    BOOST_CHECK(whole);
+    BOOST_CHECK(ordered);
+}
+
+BOOST_AUTO_TEST_CASE(profiler) {
+    // A disabled profiler collects nothing
+    NB::Universe universe("Test Files/3body.txt", true);
+    NB::Profiler& profiler = universe.profiler();
+    universe.step(1);
+    BOOST_CHECK_EQUAL(profiler.counter(NB::Counter::Steps), 0);
+    BOOST_CHECK_EQUAL(profiler.calls(NB::Phase::Integration), 0);
+
+    // Each step computes the forces on all 3 particles from the 2 others once
+    profiler.setEnabled(true);
+    for (int i = 0; i < 4; i++)
+        universe.step(1);
+    BOOST_CHECK_EQUAL(profiler.counter(NB::Counter::Steps), 4);
+    BOOST_CHECK_EQUAL(profiler.calls(NB::Phase::Integration), 4);
+    BOOST_CHECK_EQUAL(profiler.calls(NB::Phase::Forces), 4);
+    BOOST_CHECK_EQUAL(profiler.counter(NB::Counter::Interactions), 4 * 3 * 2);
+    universe.getForce(universe[0]);
+    BOOST_CHECK_EQUAL(profiler.calls(NB::Phase::Lookup), 1);
+
+    // Time in a nested timer is charged only to the inner phase
+    profiler.reset();
+    {
+        NB::ScopedTimer outer(profiler, NB::Phase::Output);
+        NB::ScopedTimer inner(profiler, NB::Phase::Input);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    BOOST_CHECK_GE(profiler.seconds(NB::Phase::Input), 0.02);
+    BOOST_CHECK_LT(profiler.seconds(NB::Phase::Output), 0.01);
+
+    std::ostringstream report;
+    report.precision(9);
+    profiler.writeReport(report, 1.0);
+    BOOST_CHECK(report.str().find("input") != std::string::npos);
+    // Later output to the stream is formatted as it was before the report
+    BOOST_CHECK_EQUAL(report.precision(), 9);
+    BOOST_CHECK(report.flags() == std::ostringstream().flags());
+}
+
+BOOST_AUTO_TEST_CASE(conservedQuantities) {
+    NB::Universe universe("nbody/3body.txt", true);
+    universe.setIntegrator(NB::makeIntegrator("leapfrog"));
+    const NB::ParticleStore& particles = universe.particles();
+    size_t n = particles.size();
+
+    // The potential energy from the force pass matches the sum over every pair
+    NB::ConservedQuantities start = universe.conserved();
+    double potential = 0.0;
+    double kinetic = 0.0;
+    double angular_momentum = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = i + 1; j < n; j++) {
+            potential -= G * particles.mass[i] * particles.mass[j] / std::hypot(
+                particles.x[j] - particles.x[i], particles.y[j] - particles.y[i]);
+        }
+        kinetic += 0.5 * particles.mass[i] * (particles.vx[i] * particles.vx[i] +
+            particles.vy[i] * particles.vy[i]);
+        angular_momentum += particles.mass[i] * (particles.x[i] * particles.vy[i] -
+            particles.y[i] * particles.vx[i]);
+    }
+    BOOST_CHECK_CLOSE(start.potential, potential, 1e-9);
+    BOOST_CHECK_CLOSE(start.kinetic, kinetic, 1e-9);
+    BOOST_CHECK_CLOSE(start.angular_momentum, angular_momentum, 1e-9);
+
+    // After a leapfrog step the potentials are already current, so no extra force pass runs
+    NB::Profiler& profiler = universe.profiler();
+    profiler.setEnabled(true);
+    for (int i = 0; i < 100; i++)
+        universe.step(25000);
+    universe.conserved();
+    BOOST_CHECK_EQUAL(profiler.calls(NB::Phase::Forces), 100);
+
+    // Energy and angular momentum are kept to within the integration error
+    NB::ConservedQuantities end = universe.conserved();
+    BOOST_CHECK_CLOSE(end.energy(), start.energy(), 0.1);
+    BOOST_CHECK_CLOSE(end.angular_momentum, start.angular_momentum, 1e-6);
+
+    // The log writes a header and one row per record, with the drift from the first
+    std::string file_name = "conserved_test.txt";
+    {
+        NB::ConservedLog log(file_name);
+        BOOST_CHECK_EQUAL(log.record(0, 0, start), 0.0);
+        double drift = log.record(100, 2.5e6, end);
+        BOOST_CHECK_CLOSE(drift, (end.energy() - start.energy()) / std::abs(start.energy()), 1e-9);
+        log.close();
+    }
+    std::ifstream in(file_name);
+    std::string line;
+    int lines = 0;
+    while (std::getline(in, line))
+        lines++;
+    BOOST_CHECK_EQUAL(lines, 3);
+    std::remove(file_name.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(softening) {
+    // Two particles closer than the softening length pull as if they were at sqrt(r^2 + L^2)
+    NB::ParticleStore particles;
+    particles.add(0, 0, 0, 0, 1e24);
+    particles.add(1e6, 0, 0, 0, 1e24);
+    NB::ThreadPool pool(1);
+    const double length = 1e7;
+    const double softened = std::hypot(1e6, length);
+    std::vector<std::unique_ptr<NB::ForceEngine>> engines;
+    engines.push_back(std::make_unique<NB::DirectEngine>());
+    engines.push_back(std::make_unique<NB::BarnesHutEngine>());
+    for (const std::unique_ptr<NB::ForceEngine>& engine : engines) {
+        engine->setSoftening(length);
+        engine->computeAccelerations(particles, pool);
+        BOOST_CHECK_CLOSE(particles.ax[0], G * 1e24 * 1e6 / std::pow(softened, 3), 1e-9);
+        BOOST_CHECK_CLOSE(particles.ax[1], -particles.ax[0], 1e-9);
+        BOOST_CHECK_CLOSE(particles.potential[0], -G * 1e24 / softened, 1e-9);
+    }
+    BOOST_CHECK_THROW(NB::DirectEngine().setSoftening(-1), std::invalid_argument);
+
+    const char* argv[] = {"NBody", "1", "1", "--softening", "1e7", "--engine", "barneshut"};
+    BOOST_CHECK_EQUAL(NB::makeForceEngine(NB::parseOptions(7, argv))->softening(), 1e7);
+}
+
+BOOST_AUTO_TEST_CASE(mergeCloseParticles) {
+    NB::ParticleStore particles;
+    particles.add(0, 0, 1, 0, 1);
+    particles.add(10, 0, 0, 0, 5);
+    particles.add(10.5, 0, 0, 2, 3);
+    particles.add(-20, 0, 0, 0, 1);
+
+    // Particles 1 and 2 become one, in the place of the heavier, with their mass and momentum
+    std::vector<size_t> sources;
+    BOOST_CHECK_EQUAL(NB::mergeCloseParticles(particles, 1.0, sources), 1);
+    BOOST_CHECK(sources == std::vector<size_t>({0, 1, 3}));
+    BOOST_REQUIRE_EQUAL(particles.size(), 3);
+    BOOST_CHECK_EQUAL(particles.mass[1], 8);
+    BOOST_CHECK_CLOSE(particles.x[1], (5 * 10 + 3 * 10.5) / 8.0, 1e-12);
+    BOOST_CHECK_EQUAL(particles.vx[1], 0);
+    BOOST_CHECK_CLOSE(particles.vy[1], 6 / 8.0, 1e-12);
+    BOOST_CHECK_EQUAL(particles.x[2], -20);
+    BOOST_CHECK_EQUAL(NB::mergeCloseParticles(particles, 1.0, sources), 0);
+
+    // A Universe merges after each step and keeps the texture of the heavier body
+    std::stringstream in("3 1e11\n"
+        "0 0 0 0 1e24 earth.gif\n"
+        "1e3 0 0 0 2e30 sun.gif\n"
+        "5e10 0 0 0 1e24 earth.gif\n");
+    NB::Universe universe;
+    universe.setHeadless(true);
+    in >> universe;
+    universe.setMergeRadius(1e6);
+    universe.step(1e-6);
+    BOOST_REQUIRE_EQUAL(universe.numPlanets(), 2);
+    BOOST_CHECK_EQUAL(universe.merged(), 1);
+    BOOST_CHECK_EQUAL(universe[0].textureName(), "sun.gif");
+    BOOST_CHECK_CLOSE(universe[0].mass(), 2e30 + 1e24, 1e-12);
+    BOOST_CHECK_EQUAL(universe[1].textureName(), "earth.gif");
+    BOOST_CHECK_THROW(universe.setMergeRadius(-1), std::invalid_argument);
+
+    const char* argv[] = {"NBody", "1", "1", "--merge-radius", "1", "--trajectory", "t.txt"};
+    BOOST_CHECK_THROW(NB::parseOptions(7, argv), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(spaceFillingCurves) {
+    BOOST_CHECK_EQUAL(NB::mortonKey(1, 0), 1);
+    BOOST_CHECK_EQUAL(NB::mortonKey(0, 1), 2);
+    BOOST_CHECK_EQUAL(NB::mortonKey(3, 3), 15);
+    BOOST_CHECK_EQUAL(NB::mortonKey(UINT32_MAX, UINT32_MAX), UINT64_MAX);
+    BOOST_CHECK(NB::curveFromName("morton") == NB::Curve::Morton);
+    BOOST_CHECK_THROW(NB::curveFromName("peano"), std::invalid_argument);
+
+    // The first 16 cells along the Hilbert curve fill the 4 by 4 corner at the origin, each next
+    // to the one before
+    std::vector<int> cell_x(16, -1), cell_y(16, -1);
+    for (uint32_t x = 0; x < 4; x++) {
+        for (uint32_t y = 0; y < 4; y++) {
+            uint64_t key = NB::hilbertKey(x, y);
+            BOOST_REQUIRE_LT(key, 16);
+            cell_x[key] = x;
+            cell_y[key] = y;
+        }
+    }
+    for (size_t k = 1; k < 16; k++)
+        BOOST_CHECK_EQUAL(std::abs(cell_x[k] - cell_x[k - 1]) +
+            std::abs(cell_y[k] - cell_y[k - 1]), 1);
+
+    // Reordering moves the particles in the store, but not the bodies or what is written out
+    for (NB::Curve curve : {NB::Curve::Hilbert, NB::Curve::Morton}) {
+        NB::Universe plain("nbody/galaxy.txt", true);
+        NB::Universe reordered("nbody/galaxy.txt", true);
+        for (NB::Universe* universe : {&plain, &reordered}) {
+            universe->setForceEngine(std::make_unique<NB::BarnesHutEngine>());
+            universe->setIntegrator(NB::makeIntegrator("leapfrog"));
+        }
+        reordered.setReorderInterval(4, curve);
+        BOOST_CHECK(reordered.slots().empty());
+        for (int step = 0; step < 10; step++) {
+            plain.step(25000);
+            reordered.step(25000);
+        }
+        std::vector<size_t> slots = reordered.slots();
+        BOOST_REQUIRE_EQUAL(slots.size(), 1000);
+        BOOST_CHECK(plain.slots().empty());
+
+        // Only the order the forces were summed in differs
+        NB::UniverseData a = plain.data();
+        NB::UniverseData b = reordered.data();
+        BOOST_CHECK(a.texture_index == b.texture_index);
+        for (size_t i = 0; i < a.particles.size(); i++) {
+            BOOST_CHECK_EQUAL(b.particles.x[i], reordered.particles().x[slots[i]]);
+            BOOST_CHECK_CLOSE(a.particles.x[i], b.particles.x[i], 1e-6);
+            BOOST_CHECK_CLOSE(a.particles.vy[i], b.particles.vy[i], 1e-6);
+        }
+        std::ostringstream plain_text, reordered_text;
+        plain_text << std::setprecision(6) << plain;
+        reordered_text << std::setprecision(6) << reordered;
+        BOOST_CHECK_EQUAL(plain_text.str(), reordered_text.str());
+    }
+
+    // Textures and the block integrator's levels move with the particles, and a checkpoint of
+    // reordered particles resumes exactly
+    std::string file_name = (std::filesystem::temp_directory_path() / "nbody.reorder").string();
+    NB::Universe uninterrupted("nbody/planets.txt", true);
+    uninterrupted.setIntegrator(NB::makeIntegrator("block"));
+    uninterrupted.setReorderInterval(1);
+    for (int step = 0; step < 15; step++)
+        uninterrupted.step(25000);
+    BOOST_REQUIRE(!uninterrupted.slots().empty());
+    BOOST_CHECK_EQUAL(uninterrupted[3].textureName(), "sun.gif");
+    NB::writeCheckpointFile(file_name, uninterrupted.checkpoint(15, 15 * 25000.0));
+    for (int step = 0; step < 15; step++)
+        uninterrupted.step(25000);
+
+    NB::Universe resumed;
+    resumed.setHeadless(true);
+    resumed.setIntegrator(NB::makeIntegrator("block"));
+    resumed.setReorderInterval(1);
+    resumed.restore(NB::readCheckpointFile(file_name));
+    for (int step = 0; step < 15; step++)
+        resumed.step(25000);
+    const NB::ParticleStore& a = uninterrupted.particles();
+    const NB::ParticleStore& b = resumed.particles();
+    BOOST_CHECK(a.x == b.x && a.y == b.y && a.vx == b.vx && a.vy == b.vy);
+    BOOST_CHECK(uninterrupted.slots() == resumed.slots());
+    BOOST_CHECK_EQUAL(uninterrupted.integrator().saveState(), resumed.integrator().saveState());
+    for (size_t i = 0; i < 5; i++)
+        BOOST_CHECK_EQUAL(resumed[i].textureName(), uninterrupted[i].textureName());
+    std::filesystem::remove(file_name);
+}
+
+BOOST_AUTO_TEST_CASE(frameExport) {
+    BOOST_CHECK_EQUAL(NB::frameFileName("frames/%06d.png", 42), "frames/000042.png");
+    BOOST_CHECK_EQUAL(NB::frameFileName("f%d.bmp", 7), "f7.bmp");
+    BOOST_CHECK_EQUAL(NB::frameFileName("f%3d.bmp", 7), "f  7.bmp");
+    for (const char* pattern : {"f.png", "f%s.png", "f%d%d.png", "f%100d.png", "f%"})
+        BOOST_CHECK_THROW(NB::frameFileName(pattern, 0), std::invalid_argument);
+    BOOST_CHECK(NB::isImageSequence("frames/%06d.png"));
+    BOOST_CHECK(!NB::isImageSequence("frames.rgba"));
+    BOOST_CHECK_THROW(NB::FrameExporter("f%d.gif", sf::Vector2u(4, 4), 1), std::invalid_argument);
+    BOOST_CHECK_THROW(NB::FrameExporter("no/such/dir/%d.png", sf::Vector2u(4, 4), 1),
+        std::invalid_argument);
+
+    // Raw frames reach the file whole and in order, however many workers are asked for
+    std::string file_name = (std::filesystem::temp_directory_path() / "nbody.rgba").string();
+    {
+        NB::FrameExporter exporter(file_name, sf::Vector2u(3, 2), 4);
+        for (uint8_t k = 0; k < 5; k++) {
+            sf::Image image;
+            image.create(3, 2, sf::Color(k, 10, 20));
+            exporter.add(k, image);
+        }
+        sf::Image wrong;
+        wrong.create(2, 2);
+        BOOST_CHECK_THROW(exporter.add(5, wrong), std::invalid_argument);
+        exporter.finish();
+        BOOST_CHECK_EQUAL(exporter.framesAdded(), 5);
+    }
+    std::ifstream in(file_name, std::ios::binary);
+    std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    BOOST_REQUIRE_EQUAL(bytes.size(), 5 * 3 * 2 * 4);
+    for (size_t k = 0; k < 5; k++) {
+        BOOST_CHECK_EQUAL(bytes[k * 24], static_cast<char>(k));
+        BOOST_CHECK_EQUAL(bytes[k * 24 + 23], static_cast<char>(255));
+    }
+    std::filesystem::remove(file_name);
+
+    const char* argv[] = {"NBody", "1", "1", "--export", "f.rgba", "--export-size", "640x480"};
+    NB::Options options = NB::parseOptions(7, argv);
+    BOOST_CHECK_EQUAL(options.export_width, 640);
+    BOOST_CHECK_EQUAL(options.export_height, 480);
+    const char* headless[] = {"NBody", "1", "1", "--export", "f.rgba", "--headless"};
+    BOOST_CHECK_THROW(NB::parseOptions(6, headless), std::invalid_argument);
+    const char* size[] = {"NBody", "1", "1", "--export-size", "640"};
+    BOOST_CHECK_THROW(NB::parseOptions(5, size), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(ensemble) {
+    std::string file_name = (std::filesystem::temp_directory_path() / "nbody.ensemble").string();
+    {
+        std::ofstream out(file_name);
+        out << "# name, universe file, dt and optional fields\n"
+            << "a nbody/3body.txt 25000\n"
+            << "\n"
+            << "b nbody/3body.txt 40000\n"
+            << "c nbody/8star-rotation.txt 25000 mass0=2\n"
+            << "d nbody/3body.txt 25000 perturb=1e-3 seed=7 copies=5\n";
+    }
+    std::vector<NB::EnsembleMember> members = NB::readEnsembleFile(file_name);
+    BOOST_REQUIRE_EQUAL(members.size(), 8);
+    BOOST_CHECK_EQUAL(members[2].name, "c");
+    BOOST_CHECK_EQUAL(members[7].name, "d-4");
+    BOOST_CHECK(members[3].data.particles.x != members[4].data.particles.x);
+
+    // Every lane steps its member exactly as a Universe on the scalar kernel would
+    const double T = 2.5e6;
+    std::vector<NB::EnsembleMember> scalar = members;
+    NB::ThreadPool pool(3);
+    NB::runEnsemble(scalar, T, "leapfrog", 0.0, pool, NB::KernelIsa::Scalar);
+    NB::runEnsemble(members, T, "leapfrog", 0.0, pool);
+    for (size_t m = 0; m < members.size(); m++) {
+        BOOST_CHECK(members[m].data.particles.x == scalar[m].data.particles.x);
+        BOOST_CHECK(members[m].data.particles.vy == scalar[m].data.particles.vy);
+    }
+    BOOST_CHECK_EQUAL(members[0].steps, 100);
+    BOOST_CHECK_EQUAL(members[1].steps, 63);
+
+    for (size_t m : {0, 1, 2, 3}) {
+        NB::UniverseData start = NB::readTextFile(m == 2 ? "nbody/8star-rotation.txt" :
+            "nbody/3body.txt");
+        NB::Universe universe;
+        universe.setHeadless(true);
+        std::stringstream text;
+        NB::writeText(text, start);
+        text >> universe;
+        if (m == 2)
+            universe.particles().mass[0] *= 2;
+        if (m == 3)
+            NB::perturb(universe.particles(), 1e-3, 7);
+        universe.setForceEngine(std::make_unique<NB::DirectEngine>(NB::KernelIsa::Scalar));
+        universe.setIntegrator(NB::makeIntegrator("leapfrog"));
+        double time = 0;
+        uint64_t steps = 0;
+        while (time < T) {
+            universe.step(members[m].dt);
+            time += members[m].dt;
+            steps++;
+        }
+        BOOST_CHECK_EQUAL(members[m].steps, steps);
+        BOOST_CHECK(members[m].data.particles.x == universe.particles().x);
+        BOOST_CHECK(members[m].data.particles.vx == universe.particles().vx);
+    }
+
+    BOOST_CHECK_SMALL(members[0].drift(), 1e-3);
+    BOOST_CHECK_SMALL(members[3].drift(), 1e-3);
+
+    std::stringstream summary;
+    NB::writeEnsembleSummary(summary, members);
+    std::string header;
+    std::getline(summary, header);
+    BOOST_CHECK_EQUAL(header, "name n dt steps energy0 energy drift");
+
+    BOOST_CHECK_THROW(NB::runEnsemble(members, T, "rk4", 0.0, pool), std::invalid_argument);
+    {
+        std::ofstream out(file_name);
+        out << "a nbody/3body.txt 25000 bogus=1\n";
+    }
+    BOOST_CHECK_THROW(NB::readEnsembleFile(file_name), std::invalid_argument);
+    {
+        std::ofstream out(file_name);
+        out << "a nbody/3body.txt 0\n";
+    }
+    BOOST_CHECK_THROW(NB::readEnsembleFile(file_name), std::invalid_argument);
+    std::filesystem::remove(file_name);
+}